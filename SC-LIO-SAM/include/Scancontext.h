@@ -8,7 +8,9 @@
 #include <algorithm> 
 #include <cstdlib>
 #include <memory>
+#include <atomic>
 #include <iostream>
+#include <stdexcept>
 
 #include <Eigen/Dense>
 
@@ -23,9 +25,11 @@
 #include <pcl_conversions/pcl_conversions.h>
 
 #include "nanoflann.hpp"
-#include "KDTreeVectorOfVectorsAdaptor.h"
+#include "scKernel.h"
 
 #include "tictoc.h"
+#include "metrics.h"
+#include "trace.h"
 
 using namespace Eigen;
 using namespace nanoflann;
@@ -39,8 +43,200 @@ using std::cos;
 using std::sin;
 
 using SCPointType = pcl::PointXYZI; // using xyz only. but a user can exchange the original bin encoding function (i.e., max hegiht) to max intensity (for detail, refer 20 ICRA Intensity Scan Context)
-using KeyMat = std::vector<std::vector<float> >;
-using InvKeyTree = KDTreeVectorOfVectorsAdaptor< KeyMat, float >;
+
+// descriptor size is fixed at compile time (20 x 60 in the original paper (IROS 18)), so descriptors and keys need no heap allocation
+using SCDescriptor = Eigen::Matrix<float, SC_NUM_RING, SC_NUM_SECTOR>; // column-major, i.e., each sector is contiguous
+using SCRingKey = Eigen::Matrix<float, SC_NUM_RING, 1>;
+using SCSectorKey = Eigen::Matrix<float, 1, SC_NUM_SECTOR>;
+
+
+/*
+ * Flat float storage for all descriptors and their keys.
+ * A record is [descriptor | column norms | ring key | sector key] and records are allocated in chunks,
+ * so a stored record never moves (the ring-key tree reads keys in place) and appending a keyframe does not reallocate history.
+ * One thread appends; records published through an SCSnapshot are immutable and may be read from any thread.
+ */
+class SCArena
+{
+public:
+    static constexpr int DESC_SIZE = SC_NUM_RING * SC_NUM_SECTOR;
+    static constexpr int NORMS_OFFSET = DESC_SIZE;
+    static constexpr int RINGKEY_OFFSET = NORMS_OFFSET + SC_NUM_SECTOR;
+    static constexpr int SECTORKEY_OFFSET = RINGKEY_OFFSET + SC_NUM_RING;
+    static constexpr int RECORD_SIZE = SECTORKEY_OFFSET + SC_NUM_SECTOR;
+    static constexpr size_t RECORDS_PER_CHUNK = 1024;
+    static constexpr size_t MAX_CHUNKS = 4096; // i.e., 4M keyframes; the chunk table itself is never reallocated
+
+    SCArena() { chunks_.reserve(MAX_CHUNKS); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void push_back( const SCDescriptor &_desc, const SCRingKey &_ringkey, const SCSectorKey &_sectorkey )
+    {
+        if( size_ == chunks_.size() * RECORDS_PER_CHUNK )
+        {
+            // readers index the chunk table without a lock, so it cannot grow past its reservation
+            if( chunks_.size() == MAX_CHUNKS )
+                throw std::length_error( "SCArena: more than MAX_CHUNKS * RECORDS_PER_CHUNK descriptors" );
+            chunks_.emplace_back( new float[RECORDS_PER_CHUNK * RECORD_SIZE] );
+        }
+
+        float* rec = record( size_ );
+        Eigen::Map<SCDescriptor> desc( rec );
+        Eigen::Map<SCRingKey> ringkey( rec + RINGKEY_OFFSET );
+        Eigen::Map<SCSectorKey> sectorkey( rec + SECTORKEY_OFFSET );
+        desc = _desc;
+        ringkey = _ringkey;
+        sectorkey = _sectorkey;
+        scColumnNorms( rec, rec + NORMS_OFFSET ); // once per descriptor, reused by every distance evaluation
+        ++size_;
+    }
+
+    Eigen::Map<const SCDescriptor> descriptor( size_t _idx ) const { return Eigen::Map<const SCDescriptor>( record(_idx) ); }
+    Eigen::Map<const SCRingKey> ringkey( size_t _idx ) const { return Eigen::Map<const SCRingKey>( ringkeyData(_idx) ); }
+    Eigen::Map<const SCSectorKey> sectorkey( size_t _idx ) const { return Eigen::Map<const SCSectorKey>( sectorkeyData(_idx) ); }
+    const float* descriptorData( size_t _idx ) const { return record(_idx); }
+    const float* columnNormsData( size_t _idx ) const { return record(_idx) + NORMS_OFFSET; }
+    const float* ringkeyData( size_t _idx ) const { return record(_idx) + RINGKEY_OFFSET; }
+    const float* sectorkeyData( size_t _idx ) const { return record(_idx) + SECTORKEY_OFFSET; }
+
+private:
+    float* record( size_t _idx ) const { return chunks_[_idx / RECORDS_PER_CHUNK].get() + (_idx % RECORDS_PER_CHUNK) * RECORD_SIZE; }
+
+    std::vector<std::unique_ptr<float[]>> chunks_;
+    size_t size_ = 0;
+}; // SCArena
+
+
+// nanoflann dataset adaptor over the ring keys of arena records [begin, begin + count), read in place (no copy of the keys)
+struct SCRingKeyRangeAdaptor
+{
+    const SCArena *arena;
+    size_t begin;
+    size_t count;
+
+    inline size_t kdtree_get_point_count() const { return count; }
+    inline float kdtree_get_pt( const size_t _idx, const size_t _dim ) const { return arena->ringkeyData(begin + _idx)[_dim]; }
+    template <class BBOX> bool kdtree_get_bbox( BBOX & /*bb*/ ) const { return false; }
+};
+
+// static ring-key tree over a contiguous range of records; built once and never modified, so any thread may search it
+struct InvKeySubtree
+{
+    using index_t = nanoflann::KDTreeSingleIndexAdaptor< nanoflann::L2_Adaptor<float, SCRingKeyRangeAdaptor>, SCRingKeyRangeAdaptor, SC_NUM_RING >;
+
+    SCRingKeyRangeAdaptor dataset;
+    index_t index;
+
+    InvKeySubtree( const SCArena &_arena, size_t _begin, size_t _count, int _leaf_max_size = 10 )
+        : dataset{ &_arena, _begin, _count }, index( SC_NUM_RING, dataset, nanoflann::KDTreeSingleIndexAdaptorParams(_leaf_max_size) )
+    {
+        index.buildIndex();
+    }
+
+    InvKeySubtree( const InvKeySubtree & ) = delete; // index refers to dataset
+    InvKeySubtree &operator=( const InvKeySubtree & ) = delete;
+};
+
+// knn result set that only accepts keys with index < index_limit, i.e., the recent-keyframe exclusion is applied at query time
+// subtree-local indices are shifted by the offset of the subtree being searched, so one result set collects the knn over all subtrees
+class SCExcludeRecentResultSet
+{
+public:
+    typedef float DistanceType;
+    typedef size_t IndexType;
+
+    SCExcludeRecentResultSet( size_t _capacity, size_t _index_limit ) : knn_( _capacity ), index_limit_( _index_limit ) {}
+
+    void init( size_t* _indices, float* _dists ) { knn_.init( _indices, _dists ); }
+    void setOffset( size_t _offset ) { offset_ = _offset; }
+    size_t indexLimit() const { return index_limit_; }
+    size_t size() const { return knn_.size(); }
+    bool full() const { return knn_.full(); }
+    float worstDist() const { return knn_.worstDist(); }
+    bool addPoint( float _dist, size_t _index )
+    {
+        _index += offset_;
+        if( _index >= index_limit_ )
+            return true; // skip, but continue the search
+        return knn_.addPoint( _dist, _index );
+    }
+
+private:
+    nanoflann::KNNResultSet<float> knn_;
+    size_t index_limit_;
+    size_t offset_ = 0;
+};
+
+/*
+ * Immutable view of the first size() descriptors and a ring-key index over exactly those.
+ *
+ * The index is a forest of static subtrees over contiguous record ranges with sizes following the binary digits of size()
+ * (like nanoflann's dynamic index, but a subtree is never modified after it is built). Appending a keyframe builds one new
+ * subtree from the merged tail ranges and shares every other subtree with the previous snapshot, so a snapshot is O(log N)
+ * pointers and the descriptors themselves are never copied (arena records do not move).
+ */
+class SCSnapshot
+{
+public:
+    SCSnapshot( const SCArena &_arena ) : arena_( &_arena ) {}
+
+    // the snapshot after appending record size()
+    std::shared_ptr<const SCSnapshot> append( int _leaf_max_size = 10 ) const
+    {
+        std::shared_ptr<SCSnapshot> next = std::make_shared<SCSnapshot>( *arena_ );
+        next->subtrees_ = subtrees_;
+        next->size_ = size_ + 1;
+
+        size_t begin = size_, count = 1;
+        while( ! next->subtrees_.empty() && next->subtrees_.back()->dataset.count == count )
+        {
+            begin = next->subtrees_.back()->dataset.begin;
+            count *= 2;
+            next->subtrees_.pop_back();
+        }
+        next->subtrees_.push_back( std::make_shared<const InvKeySubtree>( *arena_, begin, count, _leaf_max_size ) );
+        return next;
+    }
+
+    // bulk build over records [0, _size): the forest append() ends up with, but every subtree is built exactly once
+    static std::shared_ptr<const SCSnapshot> build( const SCArena &_arena, size_t _size, int _leaf_max_size = 10 )
+    {
+        std::shared_ptr<SCSnapshot> snap = std::make_shared<SCSnapshot>( _arena );
+        snap->size_ = _size;
+
+        size_t begin = 0;
+        for( int bit = sizeof(size_t) * 8 - 1; bit >= 0; --bit )
+        {
+            const size_t count = size_t(1) << bit;
+            if( (_size & count) == 0 )
+                continue;
+            snap->subtrees_.push_back( std::make_shared<const InvKeySubtree>( _arena, begin, count, _leaf_max_size ) );
+            begin += count;
+        }
+        return snap;
+    }
+
+    size_t size() const { return size_; }
+    const SCArena &arena() const { return *arena_; } // only records < size() belong to this snapshot
+
+    void findNeighbors( SCExcludeRecentResultSet &_result, const float* _query, const nanoflann::SearchParams &_params ) const
+    {
+        for( const auto &subtree : subtrees_ )
+        {
+            if( subtree->dataset.begin >= _result.indexLimit() )
+                break; // subtrees are in index order
+            _result.setOffset( subtree->dataset.begin );
+            subtree->index.findNeighbors( _result, _query, _params );
+        }
+    }
+
+private:
+    const SCArena *arena_;
+    size_t size_ = 0;
+    std::vector<std::shared_ptr<const InvKeySubtree>> subtrees_; // in index order, halving sizes
+};
 
 
 // namespace SC2
@@ -51,36 +247,78 @@ void coreImportTest ( void );
 
 // sc param-independent helper functions 
 float xy2theta( const float & _x, const float & _y );
-MatrixXd circshift( MatrixXd &_mat, int _num_shift );
-std::vector<float> eig2stdvec( MatrixXd _eigmat );
+
+template <typename Derived>
+typename Derived::PlainObject circshift( const Eigen::MatrixBase<Derived> &_mat, int _num_shift )
+{
+    // shift columns to right direction 
+    assert(_num_shift >= 0);
+
+    typename Derived::PlainObject shifted_mat;
+    for ( int col_idx = 0; col_idx < _mat.cols(); col_idx++ )
+    {
+        int new_location = (col_idx + _num_shift) % _mat.cols();
+        shifted_mat.col(new_location) = _mat.col(col_idx);
+    }
+
+    return shifted_mat;
+} // circshift
+
+
+// a loop candidate that passed the descriptor distance check
+struct SCLoopCandidate
+{
+    int index; // stored descriptor index
+    double distance; // "D" (eq 6) in the original paper (IROS 18)
+    float yaw_diff_rad; // the candidate's scan seen from the query is rotated by this yaw: p_query = Rz(yaw) p_candidate
+};
 
 
 class SCManager
 {
 public: 
     SCManager( ) = default; // reserving data space (of std::vector) could be considered. but the descriptor is lightweight so don't care.
+    SCManager( const SCManager & ) = delete; // snapshots refer to this manager's arena
+    SCManager &operator=( const SCManager & ) = delete;
 
-    Eigen::MatrixXd makeScancontext( pcl::PointCloud<SCPointType> & _scan_down );
-    Eigen::MatrixXd makeRingkeyFromScancontext( Eigen::MatrixXd &_desc );
-    Eigen::MatrixXd makeSectorkeyFromScancontext( Eigen::MatrixXd &_desc );
+    SCDescriptor makeScancontext( pcl::PointCloud<SCPointType> & _scan_down );
+    SCRingKey makeRingkeyFromScancontext( const SCDescriptor &_desc );
+    SCSectorKey makeSectorkeyFromScancontext( const SCDescriptor &_desc );
 
-    int fastAlignUsingVkey ( MatrixXd & _vkey1, MatrixXd & _vkey2 ); 
-    double distDirectSC ( MatrixXd &_sc1, MatrixXd &_sc2 ); // "d" (eq 5) in the original paper (IROS 18)
-    std::pair<double, int> distanceBtnScanContext ( MatrixXd &_sc1, MatrixXd &_sc2 ); // "D" (eq 6) in the original paper (IROS 18)
+    int fastAlignUsingVkey ( const SCSectorKey & _vkey1, const SCSectorKey & _vkey2 ); 
+    double distDirectSC ( const SCDescriptor &_sc1, const SCDescriptor &_sc2 ); // "d" (eq 5) in the original paper (IROS 18)
+    std::pair<double, int> distanceBtnScanContext ( const SCDescriptor &_sc1, const SCDescriptor &_sc2 ); // "D" (eq 6) in the original paper (IROS 18)
+    std::pair<double, int> distanceBtnScanContext ( size_t _idx1, size_t _idx2 ) const; // same, between two stored descriptors (uses their stored norms and sector keys)
 
     // User-side API
-    void makeAndSaveScancontextAndKeys( pcl::PointCloud<SCPointType> & _scan_down );
+    void makeAndSaveScancontextAndKeys( pcl::PointCloud<SCPointType> & _scan_down ); // mapping thread only
     std::pair<int, float> detectLoopClosureID( void ); // int: nearest node index, float: relative yaw  
 
-    // for ltmapper 
-    const Eigen::MatrixXd& getConstRefRecentSCD(void);
+    // any thread: a consistent view of the stored descriptors, unaffected by later appends
+    std::shared_ptr<const SCSnapshot> snapshot( void ) const { return std::atomic_load( &snapshot_ ); }
+    // loop candidate for descriptor _query_idx (< _snapshot.size()) among the descriptors older than it by more than NUM_EXCLUDE_RECENT
+    std::pair<int, float> detectLoopClosureID( const SCSnapshot &_snapshot, size_t _query_idx );
+    // same search, every tree candidate within SC_DIST_THRES (at most NUM_CANDIDATES_FROM_TREE), nearest first
+    std::vector<SCLoopCandidate> detectLoopClosureCandidates( const SCSnapshot &_snapshot, size_t _query_idx );
+
+    // prior session (mapping thread): append stored descriptors without indexing them, then index all of them at once
+    void loadScancontext( const SCDescriptor &_desc );
+    void buildIndex( void );
+    // relocalization: stored descriptors within SC_DIST_THRES of the descriptor of _scan_down (at most NUM_CANDIDATES_FROM_TREE), nearest first
+    std::vector<SCLoopCandidate> detectRelocalizationCandidates( pcl::PointCloud<SCPointType> & _scan_down );
+    // same, for descriptor _query_idx of another manager's snapshot (any thread, once buildIndex() was called)
+    std::vector<SCLoopCandidate> detectRelocalizationCandidates( const SCSnapshot &_query_snapshot, size_t _query_idx );
+
+    // for ltmapper (mapping thread)
+    Eigen::Map<const SCDescriptor> getConstRefRecentSCD(void);
+    size_t numDescriptors(void) const { return polarcontexts_.size(); }
 
 public:
     // hyper parameters ()
     const double LIDAR_HEIGHT = 2.0; // lidar height : add this for simply directly using lidar scan in the lidar local coord (not robot base coord) / if you use robot-coord-transformed lidar scans, just set this as 0.
 
-    const int    PC_NUM_RING = 20; // 20 in the original paper (IROS 18)
-    const int    PC_NUM_SECTOR = 60; // 60 in the original paper (IROS 18)
+    static constexpr int PC_NUM_RING = SC_NUM_RING; // 20 in the original paper (IROS 18)
+    static constexpr int PC_NUM_SECTOR = SC_NUM_SECTOR; // 60 in the original paper (IROS 18)
     const double PC_MAX_RADIUS = 80.0; // 80 meter max in the original paper (IROS 18)
     const double PC_UNIT_SECTORANGLE = 360.0 / double(PC_NUM_SECTOR);
     const double PC_UNIT_RINGGAP = PC_MAX_RADIUS / double(PC_NUM_RING);
@@ -95,19 +333,19 @@ public:
     const double SC_DIST_THRES = 0.3; // 0.4-0.6 is good choice for using with robust kernel (e.g., Cauchy, DCS) + icp fitness threshold / if not, recommend 0.1-0.15
     // const double SC_DIST_THRES = 0.7; // 0.4-0.6 is good choice for using with robust kernel (e.g., Cauchy, DCS) + icp fitness threshold / if not, recommend 0.1-0.15
 
-    // config 
-    const int    TREE_MAKING_PERIOD_ = 10; // i.e., remaking tree frequency, to avoid non-mandatory every remaking, to save time cost / in the LeGO-LOAM integration, it is synchronized with the loop detection callback (which is 1Hz) so it means the tree is updated evrey 10 sec. But you can use the smaller value because it is enough fast ~ 5-50ms wrt N.
-    int          tree_making_period_conter = 0;
-
     // data 
     std::vector<double> polarcontexts_timestamp_; // optional.
-    std::vector<Eigen::MatrixXd> polarcontexts_;
-    std::vector<Eigen::MatrixXd> polarcontext_invkeys_;
-    std::vector<Eigen::MatrixXd> polarcontext_vkeys_;
+    SCArena polarcontexts_; // descriptors, ring keys (invariant keys) and sector keys (variant keys); appended by the mapping thread only
+
+private:
+    // ring-key knn among the records < _index_limit, then the descriptor distance of the query to each, nearest first (not thresholded)
+    std::vector<SCLoopCandidate> rankCandidates( const SCSnapshot &_snapshot, const float* _desc, const float* _norms, const float* _ringkey,
+                                                 const float* _sectorkey, size_t _index_limit ) const;
+    // rankCandidates over all stored descriptors, within SC_DIST_THRES
+    std::vector<SCLoopCandidate> relocalizationCandidates( const float* _desc, const float* _norms, const float* _ringkey, const float* _sectorkey ) const;
 
-    KeyMat polarcontext_invkeys_mat_;
-    KeyMat polarcontext_invkeys_to_search_;
-    std::unique_ptr<InvKeyTree> polarcontext_tree_;
+    // published with an atomic pointer swap after each append; a reader keeps its snapshot (and the subtrees it shares) alive (RCU)
+    std::shared_ptr<const SCSnapshot> snapshot_ = std::make_shared<const SCSnapshot>( polarcontexts_ );
 
 }; // SCManager
 
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations (malloc, calloc, realloc and the aligned variants, so also operator new, Eigen and PCL) made by the
+// calling thread so far. Counting replaces malloc for the whole process (src/allocationCounter.cpp, glibc only) and is
+// opt-in at build time, see COUNT_ALLOCATIONS in CMakeLists.txt; otherwise the count is always 0.
+#ifdef LIO_SAM_COUNT_ALLOCATIONS
+uint64_t threadAllocationCount();
+#else
+inline uint64_t threadAllocationCount() { return 0; }
+#endif
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * Background file writer with a bounded job queue.
+ *
+ * A job is a callable that owns whatever it writes (e.g., a shared pointer to a keyframe cloud),
+ * so the producer hands data over without copying it. When the queue is full, push() blocks
+ * until the writer catches up (back-pressure, nothing is dropped); how often and for how long
+ * that happens is kept in the stats. Pending jobs are always written before the worker exits.
+ */
+class AsyncWriter
+{
+public:
+    using Job = std::function<void()>;
+
+    struct Stats
+    {
+        size_t pushed = 0;
+        size_t written = 0;
+        size_t max_depth = 0;      // high-water mark of the queue
+        size_t blocked_pushes = 0; // pushes that had to wait for a free slot
+        double blocked_ms = 0;     // total time producers spent waiting
+    };
+
+    explicit AsyncWriter(size_t _capacity = 64) : capacity_(_capacity == 0 ? 1 : _capacity)
+    {
+        worker_ = std::thread(&AsyncWriter::run, this);
+    }
+
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+    ~AsyncWriter()
+    {
+        stop();
+    }
+
+    void push(Job _job)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (jobs_.size() >= capacity_)
+        {
+            auto wait_start = std::chrono::steady_clock::now();
+            not_full_.wait(lock, [this] { return jobs_.size() < capacity_ || stopping_; });
+            ++stats_.blocked_pushes;
+            stats_.blocked_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+        }
+        if (stopping_)
+        {
+            lock.unlock();
+            _job(); // the worker is gone, write synchronously rather than lose data
+            return;
+        }
+
+        jobs_.push_back(std::move(_job));
+        ++stats_.pushed;
+        stats_.max_depth = std::max(stats_.max_depth, jobs_.size());
+        not_empty_.notify_one();
+    }
+
+    // blocks until every job pushed so far has been written
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        idle_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+    }
+
+    // writes the pending jobs and joins the worker; later pushes are written synchronously
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (stopping_)
+                return;
+            stopping_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return jobs_.size() + (busy_ ? 1 : 0);
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return stats_;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (true)
+        {
+            not_empty_.wait(lock, [this] { return !jobs_.empty() || stopping_; });
+            if (jobs_.empty())
+                break; // stopping and drained
+
+            Job job = std::move(jobs_.front());
+            jobs_.pop_front();
+            busy_ = true;
+            not_full_.notify_one();
+
+            lock.unlock();
+            job();
+            lock.lock();
+
+            busy_ = false;
+            ++stats_.written;
+            if (jobs_.empty())
+                idle_.notify_all();
+        }
+        idle_.notify_all();
+    }
+
+    const size_t capacity_;
+    mutable std::mutex mtx_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::condition_variable idle_;
+    std::deque<Job> jobs_;
+    bool busy_ = false;
+    bool stopping_ = false;
+    Stats stats_;
+    std::thread worker_;
+}; // AsyncWriter
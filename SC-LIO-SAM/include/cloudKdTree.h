@@ -0,0 +1,79 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "nanoflann.hpp"
+
+/*
+ * kd-tree over the xyz of a point cloud, read in place (nanoflann, as the Scan Context ring-key trees).
+ *
+ * Unlike pcl::KdTreeFLANN, searching does not allocate: the query lives on the stack, k-nearest results go to arrays the
+ * caller provides and radius results to a vector whose capacity is reused. Only setInputCloud() allocates, when it builds the
+ * tree. The cloud is shared, not copied, so it must not be modified until the next setInputCloud(). Searches are const and
+ * may run concurrently.
+ */
+template <typename PointT>
+class CloudKdTree
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudConstPtr = typename Cloud::ConstPtr;
+
+    CloudKdTree() : index_(3, dataset_, nanoflann::KDTreeSingleIndexAdaptorParams(10)) {}
+
+    CloudKdTree(const CloudKdTree &) = delete; // index_ refers to dataset_
+    CloudKdTree &operator=(const CloudKdTree &) = delete;
+
+    void setInputCloud(const CloudConstPtr &_cloud)
+    {
+        cloud_ = _cloud;
+        dataset_.cloud = cloud_.get();
+        index_.buildIndex();
+    }
+
+    size_t size() const { return dataset_.kdtree_get_point_count(); }
+
+    // up to _k nearest neighbors of _point, closest first; returns how many were found
+    int nearestKSearch(const PointT &_point, int _k, int *_indices, float *_sq_distances) const
+    {
+        if (size() == 0)
+            return 0;
+        const float query[3] = {_point.x, _point.y, _point.z};
+        return static_cast<int>(index_.knnSearch(query, _k, _indices, _sq_distances));
+    }
+
+    // all points within _radius of _point as (index, squared distance), closest first; _matches is cleared first
+    int radiusSearch(const PointT &_point, float _radius, std::vector<std::pair<int, float>> &_matches) const
+    {
+        _matches.clear();
+        if (size() == 0)
+            return 0;
+        const float query[3] = {_point.x, _point.y, _point.z};
+        nanoflann::SearchParams params;
+        params.sorted = true;
+        return static_cast<int>(index_.radiusSearch(query, _radius * _radius, _matches, params)); // nanoflann's L2 radius is squared
+    }
+
+private:
+    struct CloudAdaptor
+    {
+        const Cloud *cloud = nullptr;
+
+        inline size_t kdtree_get_point_count() const { return cloud == nullptr ? 0 : cloud->points.size(); }
+        inline float kdtree_get_pt(const size_t _idx, const size_t _dim) const
+        {
+            const PointT &pt = cloud->points[_idx];
+            return _dim == 0 ? pt.x : (_dim == 1 ? pt.y : pt.z);
+        }
+        template <class BBOX> bool kdtree_get_bbox(BBOX & /*bb*/) const { return false; }
+    };
+
+    using index_t = nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<float, CloudAdaptor>, CloudAdaptor, 3, int>;
+
+    CloudConstPtr cloud_;
+    CloudAdaptor dataset_;
+    index_t index_;
+}; // CloudKdTree
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+/*
+ * Reads x y z intensity ring time straight out of a sensor_msgs::PointCloud2 buffer.
+ *
+ * The field offsets and datatypes are resolved once from the message layout (and again only if the
+ * layout changes), so a scan is projected without converting it to a pcl::PointCloud first. The
+ * time field is scaled to seconds relative to the first point by a per-sensor factor: "time" in
+ * seconds for Velodyne, "t" in nanoseconds for Ouster, "t" as-is for MulRan.
+ *
+ * TypedPointCloud2Reader<Traits> reads a model's exact layout with the field types of its traits
+ * (sensorTraits.h); PointCloud2Reader converts whatever datatypes the message has, per point, and is
+ * the fallback for a driver whose layout differs from the traits.
+ */
+struct RawLidarPoint
+{
+    float x;
+    float y;
+    float z;
+    float intensity;
+    int ring;
+    float time;
+};
+
+class PointCloud2Reader
+{
+public:
+    // _time_field: "time" or "t"; _time_scale: factor from the field's unit to seconds; _absolute: the field is a time stamp,
+    // the header stamp is subtracted
+    void setTimeField(const std::string &_time_field, double _time_scale, bool _absolute = false)
+    {
+        time_name_ = _time_field;
+        time_scale_ = _time_scale;
+        absolute_time_ = _absolute;
+        layout_point_step_ = 0;
+    }
+
+    void setRingField(const std::string &_ring_field)
+    {
+        ring_name_ = _ring_field;
+        layout_point_step_ = 0;
+    }
+
+    // the field names of a model
+    template <typename Traits>
+    void setFields()
+    {
+        setTimeField(Traits::timeField(), Traits::timeScale(), Traits::absoluteTime);
+        setRingField(Traits::ringField());
+    }
+
+    // resolves the field offsets if the layout differs from the last message; false if x y z are not float32
+    bool resolve(const sensor_msgs::PointCloud2 &_msg)
+    {
+        if (layout_point_step_ == _msg.point_step && layout_num_fields_ == _msg.fields.size())
+            return true;
+
+        x_ = y_ = z_ = intensity_ = ring_ = time_ = Field();
+        for (const auto &field : _msg.fields)
+        {
+            if (field.name == "x")
+                x_ = Field(field);
+            else if (field.name == "y")
+                y_ = Field(field);
+            else if (field.name == "z")
+                z_ = Field(field);
+            else if (field.name == "intensity")
+                intensity_ = Field(field);
+            else if (field.name == ring_name_)
+                ring_ = Field(field);
+            else if (field.name == time_name_)
+                time_ = Field(field);
+        }
+
+        const uint8_t f32 = sensor_msgs::PointField::FLOAT32;
+        if (!x_.valid || !y_.valid || !z_.valid || x_.datatype != f32 || y_.datatype != f32 || z_.datatype != f32)
+            return false;
+
+        layout_point_step_ = _msg.point_step;
+        layout_num_fields_ = _msg.fields.size();
+        return true;
+    }
+
+    bool hasRing() const { return ring_.valid; }
+    bool hasTime() const { return time_.valid; }
+
+    // resolve() must have succeeded for this message's layout
+    void bind(const sensor_msgs::PointCloud2 &_msg)
+    {
+        data_ = _msg.data.data();
+        width_ = _msg.width;
+        height_ = _msg.height;
+        point_step_ = _msg.point_step;
+        row_step_ = _msg.row_step;
+        time_origin_ = absolute_time_ ? _msg.header.stamp.toSec() : 0.0;
+    }
+
+    size_t size() const { return size_t(width_) * height_; }
+
+    // false for a NaN point
+    bool read(size_t _idx, RawLidarPoint &_pt) const
+    {
+        const uint8_t *p = data_ + (_idx / width_) * row_step_ + (_idx % width_) * point_step_;
+        std::memcpy(&_pt.x, p + x_.offset, sizeof(float));
+        std::memcpy(&_pt.y, p + y_.offset, sizeof(float));
+        std::memcpy(&_pt.z, p + z_.offset, sizeof(float));
+        if (std::isnan(_pt.x) || std::isnan(_pt.y) || std::isnan(_pt.z))
+            return false;
+
+        _pt.intensity = intensity_.valid ? float(intensity_.read(p)) : 0.0f;
+        _pt.ring = ring_.valid ? int(ring_.read(p)) : 0;
+        _pt.time = time_.valid ? float(time_.read(p) * time_scale_ - time_origin_) : 0.0f;
+        return true;
+    }
+
+    // time of the last non-NaN point, 0 if there is none
+    float lastPointTime() const
+    {
+        RawLidarPoint pt;
+        for (size_t i = size(); i > 0; --i)
+            if (read(i - 1, pt))
+                return pt.time;
+        return 0.0f;
+    }
+
+private:
+    struct Field
+    {
+        Field() = default;
+        explicit Field(const sensor_msgs::PointField &_field)
+            : offset(_field.offset), datatype(_field.datatype), valid(true) {}
+
+        double read(const uint8_t *_point) const
+        {
+            const uint8_t *p = _point + offset;
+            switch (datatype)
+            {
+            case sensor_msgs::PointField::INT8:    return readAs<int8_t>(p);
+            case sensor_msgs::PointField::UINT8:   return readAs<uint8_t>(p);
+            case sensor_msgs::PointField::INT16:   return readAs<int16_t>(p);
+            case sensor_msgs::PointField::UINT16:  return readAs<uint16_t>(p);
+            case sensor_msgs::PointField::INT32:   return readAs<int32_t>(p);
+            case sensor_msgs::PointField::UINT32:  return readAs<uint32_t>(p);
+            case sensor_msgs::PointField::FLOAT32: return readAs<float>(p);
+            case sensor_msgs::PointField::FLOAT64: return readAs<double>(p);
+            default:                               return 0;
+            }
+        }
+
+        template <typename T>
+        static double readAs(const uint8_t *_p)
+        {
+            T value;
+            std::memcpy(&value, _p, sizeof(T)); // the buffer has no alignment guarantee
+            return double(value);
+        }
+
+        uint32_t offset = 0;
+        uint8_t datatype = 0;
+        bool valid = false;
+    };
+
+    Field x_, y_, z_, intensity_, ring_, time_;
+    std::string ring_name_ = "ring";
+    std::string time_name_ = "time";
+    double time_scale_ = 1.0;
+    bool absolute_time_ = false;
+    double time_origin_ = 0.0;
+
+    uint32_t layout_point_step_ = 0; // layout the offsets were resolved for
+    size_t layout_num_fields_ = 0;
+
+    const uint8_t *data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t point_step_ = 0;
+    uint32_t row_step_ = 0;
+}; // PointCloud2Reader
+
+// sensor_msgs::PointField datatype of a field type
+template <typename T> struct PointFieldType;
+template <> struct PointFieldType<int8_t> { static constexpr uint8_t value = sensor_msgs::PointField::INT8; };
+template <> struct PointFieldType<uint8_t> { static constexpr uint8_t value = sensor_msgs::PointField::UINT8; };
+template <> struct PointFieldType<int16_t> { static constexpr uint8_t value = sensor_msgs::PointField::INT16; };
+template <> struct PointFieldType<uint16_t> { static constexpr uint8_t value = sensor_msgs::PointField::UINT16; };
+template <> struct PointFieldType<int32_t> { static constexpr uint8_t value = sensor_msgs::PointField::INT32; };
+template <> struct PointFieldType<uint32_t> { static constexpr uint8_t value = sensor_msgs::PointField::UINT32; };
+template <> struct PointFieldType<float> { static constexpr uint8_t value = sensor_msgs::PointField::FLOAT32; };
+template <> struct PointFieldType<double> { static constexpr uint8_t value = sensor_msgs::PointField::FLOAT64; };
+
+/*
+ * PointCloud2Reader for the layout of one lidar model, see sensorTraits.h.
+ *
+ * resolve() accepts a message only if it has every field of the model with the datatype of the traits, so read()
+ * copies each field with its fixed type and converts the time with the constant Traits::timeScale(); nothing is
+ * checked per point but NaN. Any other layout is left to PointCloud2Reader.
+ */
+template <typename Traits>
+class TypedPointCloud2Reader
+{
+public:
+    using RingType = typename Traits::RingType;
+    using TimeType = typename Traits::TimeType;
+
+    // resolves the field offsets if the layout differs from the last message; false unless it is the layout of Traits
+    bool resolve(const sensor_msgs::PointCloud2 &_msg)
+    {
+        if (layout_point_step_ == _msg.point_step && layout_num_fields_ == _msg.fields.size())
+            return true;
+        layout_point_step_ = 0;
+
+        int found = 0;
+        for (const auto &field : _msg.fields)
+        {
+            if (field.name == "x")
+                found |= match<float>(field, x_offset_) << 0;
+            else if (field.name == "y")
+                found |= match<float>(field, y_offset_) << 1;
+            else if (field.name == "z")
+                found |= match<float>(field, z_offset_) << 2;
+            else if (field.name == "intensity")
+                found |= match<float>(field, intensity_offset_) << 3;
+            else if (field.name == Traits::ringField())
+                found |= match<RingType>(field, ring_offset_) << 4;
+            else if (field.name == Traits::timeField())
+                found |= match<TimeType>(field, time_offset_) << 5;
+        }
+        if (found != 0x3F)
+            return false;
+
+        layout_point_step_ = _msg.point_step;
+        layout_num_fields_ = _msg.fields.size();
+        return true;
+    }
+
+    // resolve() must have succeeded for this message's layout
+    void bind(const sensor_msgs::PointCloud2 &_msg)
+    {
+        data_ = _msg.data.data();
+        width_ = _msg.width;
+        height_ = _msg.height;
+        point_step_ = _msg.point_step;
+        row_step_ = _msg.row_step;
+        time_origin_ = Traits::absoluteTime ? _msg.header.stamp.toSec() : 0.0;
+    }
+
+    size_t size() const { return size_t(width_) * height_; }
+
+    // false for a NaN point
+    bool read(size_t _idx, RawLidarPoint &_pt) const
+    {
+        const uint8_t *p = data_ + (_idx / width_) * row_step_ + (_idx % width_) * point_step_;
+        std::memcpy(&_pt.x, p + x_offset_, sizeof(float));
+        std::memcpy(&_pt.y, p + y_offset_, sizeof(float));
+        std::memcpy(&_pt.z, p + z_offset_, sizeof(float));
+        if (std::isnan(_pt.x) || std::isnan(_pt.y) || std::isnan(_pt.z))
+            return false;
+
+        RingType ring;
+        TimeType time;
+        std::memcpy(&_pt.intensity, p + intensity_offset_, sizeof(float));
+        std::memcpy(&ring, p + ring_offset_, sizeof(RingType));
+        std::memcpy(&time, p + time_offset_, sizeof(TimeType));
+        _pt.ring = int(ring);
+        if (Traits::absoluteTime)
+            _pt.time = float(double(time) * Traits::timeScale() - time_origin_); // a stamp needs double precision
+        else
+            _pt.time = float(time) * float(Traits::timeScale());
+        return true;
+    }
+
+    // time of the last non-NaN point, 0 if there is none
+    float lastPointTime() const
+    {
+        RawLidarPoint pt;
+        for (size_t i = size(); i > 0; --i)
+            if (read(i - 1, pt))
+                return pt.time;
+        return 0.0f;
+    }
+
+private:
+    template <typename T>
+    static int match(const sensor_msgs::PointField &_field, uint32_t &_offset)
+    {
+        _offset = _field.offset;
+        return _field.datatype == PointFieldType<T>::value && _field.count == 1 ? 1 : 0;
+    }
+
+    uint32_t x_offset_ = 0, y_offset_ = 0, z_offset_ = 0, intensity_offset_ = 0, ring_offset_ = 0, time_offset_ = 0;
+    double time_origin_ = 0.0;
+
+    uint32_t layout_point_step_ = 0; // layout the offsets were resolved for
+    size_t layout_num_fields_ = 0;
+
+    const uint8_t *data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t point_step_ = 0;
+    uint32_t row_step_ = 0;
+}; // TypedPointCloud2Reader
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "utility.h"
+#include "lio_sam/cloud_info.h"
+
+struct smoothness_t{ 
+    float value;
+    size_t ind;
+};
+
+struct by_value{ 
+    bool operator()(smoothness_t const &left, smoothness_t const &right) { 
+        return left.value < right.value;
+    }
+};
+
+class FeatureExtraction : public ParamServer
+{
+
+public:
+
+    ros::Subscriber subLaserCloudInfo;
+
+    ros::Publisher pubLaserCloudInfo;
+    ros::Publisher pubCornerPoints;
+    ros::Publisher pubSurfacePoints;
+    ros::Publisher pubMetrics;
+
+    pcl::PointCloud<PointType>::Ptr extractedCloud;
+    pcl::PointCloud<PointType>::Ptr cornerCloud;
+    pcl::PointCloud<PointType>::Ptr surfaceCloud;
+
+    pcl::VoxelGrid<PointType> downSizeFilter;
+    std::vector<pcl::PointCloud<PointType>> ringCornerCloud;
+    std::vector<pcl::PointCloud<PointType>> ringSurfaceCloud;
+
+    lio_sam::cloud_info cloudInfo;
+    std_msgs::Header cloudHeader;
+
+    std::vector<smoothness_t> cloudSmoothness;
+    float *cloudCurvature;
+    int *cloudNeighborPicked;
+    int *cloudLabel;
+
+    // inProcess: scans come from ImageProjection through processCloudInfo() instead of lio_sam/deskew/cloud_info
+    explicit FeatureExtraction(bool inProcess = false)
+    {
+        if (!inProcess)
+            subLaserCloudInfo = nh.subscribe<lio_sam::cloud_info>("lio_sam/deskew/cloud_info", 1, &FeatureExtraction::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
+
+        pubLaserCloudInfo = nh.advertise<lio_sam::cloud_info> ("lio_sam/feature/cloud_info", 1);
+        pubCornerPoints = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/feature/cloud_corner", 1);
+        pubSurfacePoints = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/feature/cloud_surface", 1);
+        pubMetrics = nh.advertise<diagnostic_msgs::DiagnosticArray>("lio_sam/feature/metrics", 1);
+        
+        initializationValue();
+    }
+
+    void initializationValue()
+    {
+        cloudSmoothness.resize(N_SCAN*Horizon_SCAN);
+        ringCornerCloud.resize(N_SCAN);
+        ringSurfaceCloud.resize(N_SCAN);
+
+        downSizeFilter.setLeafSize(odometrySurfLeafSize, odometrySurfLeafSize, odometrySurfLeafSize);
+
+        extractedCloud.reset(new pcl::PointCloud<PointType>());
+        cornerCloud.reset(new pcl::PointCloud<PointType>());
+        surfaceCloud.reset(new pcl::PointCloud<PointType>());
+
+        cloudCurvature = new float[N_SCAN*Horizon_SCAN];
+        cloudNeighborPicked = new int[N_SCAN*Horizon_SCAN];
+        cloudLabel = new int[N_SCAN*Horizon_SCAN];
+    }
+
+    void laserCloudInfoHandler(const lio_sam::cloud_infoConstPtr& msgIn)
+    {
+        cloudInfo = *msgIn; // new cloud info
+        cloudHeader = msgIn->header; // new cloud header
+        pcl::fromROSMsg(msgIn->cloud_deskewed, *extractedCloud); // new cloud for extraction
+
+        extractScanFeatures();
+
+        publishFeatureCloud();
+
+        publishMetricsDiagnostics(&pubMetrics, "feature/");
+    }
+
+    // in-process front end, see ImageProjection::setCloudInfoSink()
+    void processCloudInfo(lio_sam::cloud_info &cloudInfoIn, const pcl::PointCloud<PointType>::Ptr &extractedCloudIn)
+    {
+        std::swap(cloudInfo, cloudInfoIn); // borrowed, handed back below
+        cloudHeader = cloudInfo.header;
+        extractedCloud = extractedCloudIn;
+
+        extractScanFeatures();
+
+        publishFeatureCloud();
+
+        // keep the already published features out of the next lio_sam/deskew/cloud_info
+        cloudInfo.cloud_corner = sensor_msgs::PointCloud2();
+        cloudInfo.cloud_surface = sensor_msgs::PointCloud2();
+        std::swap(cloudInfo, cloudInfoIn);
+
+        publishMetricsDiagnostics(&pubMetrics, "feature/");
+    }
+
+    void extractScanFeatures()
+    {
+        TRACE_SPAN("feature/scan_ms");
+
+        calculateSmoothness();
+
+        markOccludedPoints();
+
+        extractFeatures();
+    }
+
+    void calculateSmoothness()
+    {
+        TRACE_SPAN("feature/smoothness_ms");
+        int cloudSize = extractedCloud->points.size();
+        for (int i = 5; i < cloudSize - 5; i++)
+        {
+            float diffRange = cloudInfo.pointRange[i-5] + cloudInfo.pointRange[i-4]
+                            + cloudInfo.pointRange[i-3] + cloudInfo.pointRange[i-2]
+                            + cloudInfo.pointRange[i-1] - cloudInfo.pointRange[i] * 10
+                            + cloudInfo.pointRange[i+1] + cloudInfo.pointRange[i+2]
+                            + cloudInfo.pointRange[i+3] + cloudInfo.pointRange[i+4]
+                            + cloudInfo.pointRange[i+5];            
+
+            cloudCurvature[i] = diffRange*diffRange;//diffX * diffX + diffY * diffY + diffZ * diffZ;
+
+            cloudNeighborPicked[i] = 0;
+            cloudLabel[i] = 0;
+            // cloudSmoothness for sorting
+            cloudSmoothness[i].value = cloudCurvature[i];
+            cloudSmoothness[i].ind = i;
+        }
+    }
+
+    void markOccludedPoints()
+    {
+        TRACE_SPAN("feature/occlusion_ms");
+        int cloudSize = extractedCloud->points.size();
+        // mark occluded points and parallel beam points
+        for (int i = 5; i < cloudSize - 6; ++i)
+        {
+            // occluded points
+            float depth1 = cloudInfo.pointRange[i];
+            float depth2 = cloudInfo.pointRange[i+1];
+            int columnDiff = std::abs(int(cloudInfo.pointColInd[i+1] - cloudInfo.pointColInd[i]));
+
+            if (columnDiff < 10){
+                // 10 pixel diff in range image
+                if (depth1 - depth2 > 0.3){
+                    cloudNeighborPicked[i - 5] = 1;
+                    cloudNeighborPicked[i - 4] = 1;
+                    cloudNeighborPicked[i - 3] = 1;
+                    cloudNeighborPicked[i - 2] = 1;
+                    cloudNeighborPicked[i - 1] = 1;
+                    cloudNeighborPicked[i] = 1;
+                }else if (depth2 - depth1 > 0.3){
+                    cloudNeighborPicked[i + 1] = 1;
+                    cloudNeighborPicked[i + 2] = 1;
+                    cloudNeighborPicked[i + 3] = 1;
+                    cloudNeighborPicked[i + 4] = 1;
+                    cloudNeighborPicked[i + 5] = 1;
+                    cloudNeighborPicked[i + 6] = 1;
+                }
+            }
+            // parallel beam
+            float diff1 = std::abs(float(cloudInfo.pointRange[i-1] - cloudInfo.pointRange[i]));
+            float diff2 = std::abs(float(cloudInfo.pointRange[i+1] - cloudInfo.pointRange[i]));
+
+            if (diff1 > 0.02 * cloudInfo.pointRange[i] && diff2 > 0.02 * cloudInfo.pointRange[i])
+                cloudNeighborPicked[i] = 1;
+        }
+    }
+
+    // marks the neighbors of a selected point up to a range-image gap, into the next segment as before; flags outside
+    // [ringStart, ringEnd] are never read, so rings stay independent
+    void markNeighborsPicked(int ind, int ringStart, int ringEnd)
+    {
+        cloudNeighborPicked[ind] = 1;
+        for (int l = 1; l <= 5 && ind + l <= ringEnd; l++)
+        {
+            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l - 1]));
+            if (columnDiff > 10)
+                break;
+            cloudNeighborPicked[ind + l] = 1;
+        }
+        for (int l = -1; l >= -5 && ind + l >= ringStart; l--)
+        {
+            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l + 1]));
+            if (columnDiff > 10)
+                break;
+            cloudNeighborPicked[ind + l] = 1;
+        }
+    }
+
+    void extractRing(int i, pcl::VoxelGrid<PointType> &ringDownSizeFilter,
+                     pcl::PointCloud<PointType>::Ptr &surfaceCloudScan, pcl::PointCloud<PointType> &ringCorner,
+                     pcl::PointCloud<PointType> &ringSurface)
+    {
+        const int ringStart = cloudInfo.startRingIndex[i];
+        const int ringEnd = cloudInfo.endRingIndex[i];
+
+        ringCorner.clear();
+        ringSurface.clear();
+        surfaceCloudScan->clear();
+
+        for (int j = 0; j < 6; j++)
+        {
+
+            int sp = (ringStart * (6 - j) + ringEnd * j) / 6;
+            int ep = (ringStart * (5 - j) + ringEnd * (j + 1)) / 6 - 1;
+
+            if (sp >= ep)
+                continue;
+
+            // edge candidates go to the back of the segment and are selected largest-first, a batch at a time;
+            // usually the first batch already has the 20 edges, so the segment is never fully sorted
+            auto edgeBegin = std::partition(cloudSmoothness.begin() + sp, cloudSmoothness.begin() + ep + 1,
+                                            [this](const smoothness_t &s) { return !(s.value > edgeThreshold); });
+            auto edgeEnd = cloudSmoothness.begin() + ep + 1;
+
+            int largestPickedNum = 0;
+            while (edgeBegin != edgeEnd && largestPickedNum < 20)
+            {
+                auto batchBegin = edgeEnd - std::min<std::ptrdiff_t>(20, edgeEnd - edgeBegin);
+                std::nth_element(edgeBegin, batchBegin, edgeEnd, by_value());
+                std::sort(batchBegin, edgeEnd, by_value());
+
+                for (auto it = edgeEnd; it != batchBegin && largestPickedNum < 20; )
+                {
+                    int ind = (--it)->ind;
+                    if (cloudNeighborPicked[ind] == 0)
+                    {
+                        largestPickedNum++;
+                        cloudLabel[ind] = 1;
+                        ringCorner.push_back(extractedCloud->points[ind]);
+                        markNeighborsPicked(ind, ringStart, ringEnd);
+                    }
+                }
+                edgeEnd = batchBegin;
+            }
+
+            // surface candidates are the front of the non-edge part, marked smoothest first as with the full sort
+            auto surfEnd = std::partition(cloudSmoothness.begin() + sp, edgeBegin,
+                                          [this](const smoothness_t &s) { return s.value < surfThreshold; });
+            std::sort(cloudSmoothness.begin() + sp, surfEnd, by_value());
+            for (auto it = cloudSmoothness.begin() + sp; it != surfEnd; ++it)
+            {
+                int ind = it->ind;
+                if (cloudNeighborPicked[ind] == 0)
+                {
+                    cloudLabel[ind] = -1;
+                    markNeighborsPicked(ind, ringStart, ringEnd);
+                }
+            }
+
+            for (int k = sp; k <= ep; k++)
+            {
+                if (cloudLabel[k] <= 0){
+                    surfaceCloudScan->push_back(extractedCloud->points[k]);
+                }
+            }
+        }
+
+        ringDownSizeFilter.setInputCloud(surfaceCloudScan);
+        ringDownSizeFilter.filter(ringSurface);
+    }
+
+    void extractFeatures()
+    {
+        TRACE_SPAN("feature/extraction_ms");
+        cornerCloud->clear();
+        surfaceCloud->clear();
+
+        // rings only touch their own index range, so they are extracted in parallel into per-ring buffers
+        #pragma omp parallel num_threads(numberOfCores)
+        {
+            pcl::VoxelGrid<PointType> ringDownSizeFilter = downSizeFilter;
+            pcl::PointCloud<PointType>::Ptr surfaceCloudScan(new pcl::PointCloud<PointType>());
+
+            #pragma omp for schedule(dynamic)
+            for (int i = 0; i < N_SCAN; i++)
+                extractRing(i, ringDownSizeFilter, surfaceCloudScan, ringCornerCloud[i], ringSurfaceCloud[i]);
+        }
+
+        // merged in ring order, same order as a serial pass
+        for (int i = 0; i < N_SCAN; i++)
+        {
+            *cornerCloud += ringCornerCloud[i];
+            *surfaceCloud += ringSurfaceCloud[i];
+        }
+    }
+
+    void freeCloudInfoMemory()
+    {
+        cloudInfo.startRingIndex.clear();
+        cloudInfo.endRingIndex.clear();
+        cloudInfo.pointColInd.clear();
+        cloudInfo.pointRange.clear();
+    }
+
+    void publishFeatureCloud()
+    {
+        // free cloud info memory
+        freeCloudInfoMemory();
+        // save newly extracted features
+        cloudInfo.cloud_corner  = publishCloud(&pubCornerPoints,  cornerCloud,  cloudHeader.stamp, lidarFrame);
+        cloudInfo.cloud_surface = publishCloud(&pubSurfacePoints, surfaceCloud, cloudHeader.stamp, lidarFrame);
+        // publish to mapOptimization
+        pubLaserCloudInfo.publish(cloudInfo);
+    }
+};
@@ -0,0 +1,797 @@
+#pragma once
+
+#include "utility.h"
+#include "lio_sam/cloud_info.h"
+#include "cloudReader.h"
+#include "sensorTraits.h"
+#include "imuRingBuffer.h"
+
+#include <functional>
+#include <tuple>
+
+// IMU数据队列长度
+const int queueLength = 2000;
+
+// receives the cloud info and deskewed cloud of a scan; both are only borrowed for the duration of the call
+using CloudInfoSink = std::function<void(lio_sam::cloud_info &, const pcl::PointCloud<PointType>::Ptr &)>;
+
+class ImageProjection : public ParamServer
+{
+private:
+	// odom队列互斥锁（imu数据在无锁环形缓冲区中）
+	std::mutex odoLock;
+	// 发布当前帧校正后点云，有效点
+	ros::Subscriber subLaserCloud;
+	ros::Publisher pubLaserCloud;
+	// imu数据队列(原始数据，转lidar系下)
+	ros::Publisher pubExtractedCloud;
+	ros::Publisher pubLaserCloudInfo;
+	// deskew/* 各阶段耗时（trace.h）
+	ros::Publisher pubMetrics;
+	// imu数据队列(原始数据，转lidar系下)
+	ros::Subscriber subImu;
+	ImuRingBuffer imuRing;
+	uint64_t imuRingCursor = 0; // 尚未丢弃的最早imu数据序号
+	// imu里程计队列
+	ros::Subscriber subOdom;
+	std::deque<nav_msgs::Odometry> odomQueue;
+	// 队列front帧，作为当前处理帧点云
+	std::deque<sensor_msgs::PointCloud2ConstPtr> cloudQueue;
+	sensor_msgs::PointCloud2ConstPtr currentCloudMsg;
+	// 直接按字段偏移读取currentCloudMsg中的点，不转换成pcl点云；字段类型与雷达型号的traits一致时用对应的typedReaders，否则用通用的cloudReader
+	PointCloud2Reader cloudReader;
+	std::tuple<TypedPointCloud2Reader<VelodyneTraits>, TypedPointCloud2Reader<OusterTraits>, TypedPointCloud2Reader<MulranTraits>,
+						 TypedPointCloud2Reader<LivoxTraits>, TypedPointCloud2Reader<HesaiTraits>>
+			typedReaders;
+	bool typedLayout = false;
+	// 当前激光帧起止时刻间对应的imu数据，计算相对于起始时刻的旋转增量，以及时间戳；用于插值计算当前激光帧起止时间范围内，每一时刻的旋转姿态
+	double *imuTime = new double[queueLength];
+	double *imuRotX = new double[queueLength];
+	double *imuRotY = new double[queueLength];
+	double *imuRotZ = new double[queueLength];
+
+	int imuPointerCur;
+	Eigen::Affine3f transStartInverse;
+	// 每个imu时刻相对于第一个点的变换（旋转、平移），每帧计算一次，逐点在相邻两个imu时刻之间插值
+	std::vector<Eigen::Quaternionf, Eigen::aligned_allocator<Eigen::Quaternionf>> deskewRotation;
+	std::vector<Eigen::Vector3f> deskewTranslation;
+	// 当前帧运动畸变校正之后的激光点云
+	pcl::PointCloud<PointType>::Ptr fullCloud;
+	// 从fullcloud中提取的有效点
+	pcl::PointCloud<PointType>::Ptr extractedCloud;
+
+	int deskewFlag;
+	cv::Mat rangeMat;
+	// 当前帧逐点投影结果（行号-1表示丢弃），以及按行分桶的点序号
+	std::vector<int> pointRowIdn;
+	std::vector<int> pointColumnIdn;
+	std::vector<float> pointRangeIn;
+	std::vector<int> rowPointStart;
+	std::vector<int> rowPointFill;
+	std::vector<int> rowPointIdx;
+
+	bool odomDeskewFlag;
+	// 当前激光帧起止时刻对应imu里程计位姿变换，该变换对应的平移增量；用于插值计算当前激光帧起止时间范围内，每一时刻的位置
+	float odomIncreX;
+	float odomIncreY;
+	float odomIncreZ;
+	// 当前帧激光点云运动畸变校正之后的数据，包括点云数据、初始位姿、姿态角等，发布给featureExatruction进行特征提取
+	lio_sam::cloud_info cloudInfo;
+	// 当前帧起始时刻
+	double timeScanCur;
+	// 当前帧结束时刻
+	double timeScanEnd;
+	// 当前帧header，包含时间戳信息
+	std_msgs::Header cloudHeader;
+	// 进程内前端：当前帧直接交给特征提取，不经过序列化（见frontEnd.cpp）
+	CloudInfoSink cloudInfoSink;
+
+public:
+	// 构造函数
+	ImageProjection() : deskewFlag(0)
+	{
+		// 订阅原始IMU数据
+		subImu = nh.subscribe<sensor_msgs::Imu>(imuTopic, 2000, &ImageProjection::imuHandler, this, ros::TransportHints().tcpNoDelay());
+		// 订阅IMU里程计，由imuPreintegration积分计算得到的每时刻IMU位姿
+		subOdom = nh.subscribe<nav_msgs::Odometry>(odomTopic + "_incremental", 2000, &ImageProjection::odometryHandler, this, ros::TransportHints().tcpNoDelay());
+		// 订阅原始lidar数据
+		subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>(pointCloudTopic, 5, &ImageProjection::cloudHandler, this, ros::TransportHints().tcpNoDelay());
+		// 发布当前激光帧运动畸变校正后的点云，有效点
+		pubExtractedCloud = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/deskew/cloud_deskewed", 1);
+		// 发布当前激光帧运动畸变校正后的点云信息
+		pubLaserCloudInfo = nh.advertise<lio_sam::cloud_info>("lio_sam/deskew/cloud_info", 1);
+		pubMetrics = nh.advertise<diagnostic_msgs::DiagnosticArray>("lio_sam/deskew/metrics", 1);
+		// 为变量申请内存
+		allocateMemory();
+		// 重置参数
+		resetParameters();
+		// pcl日志级别，只打开ERROR日志
+		pcl::console::setVerbosityLevel(pcl::console::L_ERROR);
+	}
+	// 初始化，为变量申请内存
+	void allocateMemory()
+	{
+		// ring and time fields and time unit per sensor, see sensorTraits.h
+		dispatchSensor([this](auto traits) { cloudReader.setFields<decltype(traits)>(); });
+
+		fullCloud.reset(new pcl::PointCloud<PointType>());
+		extractedCloud.reset(new pcl::PointCloud<PointType>());
+
+		fullCloud->points.resize(N_SCAN * Horizon_SCAN);
+
+		cloudInfo.startRingIndex.assign(N_SCAN, 0);
+		cloudInfo.endRingIndex.assign(N_SCAN, 0);
+
+		cloudInfo.pointColInd.assign(N_SCAN * Horizon_SCAN, 0);
+		cloudInfo.pointRange.assign(N_SCAN * Horizon_SCAN, 0);
+
+		resetParameters();
+	}
+	// 重置参数，接收每帧lidar数据都要重置这些参数
+	void resetParameters()
+	{
+		extractedCloud->clear();
+		// reset range matrix for range image projection
+		rangeMat = cv::Mat(N_SCAN, Horizon_SCAN, CV_32F, cv::Scalar::all(FLT_MAX));
+		// the sink may hand these back emptied; resize() keeps their capacity
+		cloudInfo.startRingIndex.resize(N_SCAN);
+		cloudInfo.endRingIndex.resize(N_SCAN);
+		cloudInfo.pointColInd.resize(N_SCAN * Horizon_SCAN);
+		cloudInfo.pointRange.resize(N_SCAN * Horizon_SCAN);
+
+		imuPointerCur = 0;
+		odomDeskewFlag = false;
+
+		for (int i = 0; i < queueLength; ++i)
+		{
+			imuTime[i] = 0;
+			imuRotX[i] = 0;
+			imuRotY[i] = 0;
+			imuRotZ[i] = 0;
+		}
+	}
+
+	~ImageProjection() {}
+
+	// in-process front end: hand every scan to sink instead of publishing lio_sam/deskew/cloud_info,
+	// which is then only published while something subscribes to it
+	void setCloudInfoSink(CloudInfoSink sink)
+	{
+		cloudInfoSink = std::move(sink);
+	}
+	/* IMU原始数据回调函数
+			IMU原始测量数据转换到lidar系下，加速度、角速度、RPY姿态 */
+	void imuHandler(const sensor_msgs::Imu::ConstPtr &imuMsg)
+	{
+		sensor_msgs::Imu thisImu = imuConverter(*imuMsg);
+
+		imuRing.push(ImuSample::fromMsg(thisImu));
+
+		// debug IMU data
+		// cout << std::setprecision(6);
+		// cout << "IMU acc: " << endl;
+		// cout << "x: " << thisImu.linear_acceleration.x <<
+		//       ", y: " << thisImu.linear_acceleration.y <<
+		//       ", z: " << thisImu.linear_acceleration.z << endl;
+		// cout << "IMU gyro: " << endl;
+		// cout << "x: " << thisImu.angular_velocity.x <<
+		//       ", y: " << thisImu.angular_velocity.y <<
+		//       ", z: " << thisImu.angular_velocity.z << endl;
+		// double imuRoll, imuPitch, imuYaw;
+		// tf::Quaternion orientation;
+		// tf::quaternionMsgToTF(thisImu.orientation, orientation);
+		// tf::Matrix3x3(orientation).getRPY(imuRoll, imuPitch, imuYaw);
+		// cout << "IMU roll pitch yaw: " << endl;
+		// cout << "roll: " << imuRoll << ", pitch: " << imuPitch << ", yaw: " << imuYaw << endl << endl;
+	}
+	// 订阅IMU里程计，由imuPreintegration积分计算得到的每时刻imu位姿
+	void odometryHandler(const nav_msgs::Odometry::ConstPtr &odometryMsg)
+	{
+		std::lock_guard<std::mutex> lock2(odoLock);
+		odomQueue.push_back(*odometryMsg);
+	}
+	/**
+	 * 订阅原始lidar数据
+	 * 1、添加一帧激光点云到队列，取出最早一帧作为当前帧，计算起止时间戳，检查数据有效性
+	 * 2、当前帧起止时刻对应的imu数据、imu里程计数据处理
+	 *   imu数据：
+	 *   1) 遍历当前激光帧起止时刻之间的imu数据，初始时刻对应imu的姿态角RPY设为当前帧的初始姿态角
+	 *   2) 用角速度、时间积分，计算每一时刻相对于初始时刻的旋转量，初始时刻旋转设为0
+	 *   imu里程计数据：
+	 *   1) 遍历当前激光帧起止时刻之间的imu里程计数据，初始时刻对应imu里程计设为当前帧的初始位姿
+	 *   2) 用起始、终止时刻对应imu里程计，计算相对位姿变换，保存平移增量
+	 * 3、当前帧激光点云运动畸变校正
+	 *   1) 检查激光点距离、扫描线是否合规
+	 *   2) 激光运动畸变校正，保存激光点
+	 * 4、提取有效激光点，存extractedCloud
+	 * 5、发布当前帧校正后点云，有效点
+	 * 6、重置参数，接收每帧lidar数据都要重置这些参数
+	 */
+	void cloudHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
+	{
+		if (!dispatchSensor([&](auto traits) { this->processCloud<decltype(traits)>(laserCloudMsg); }))
+		{
+			ROS_ERROR_STREAM("Unknown sensor type: " << int(sensor));
+			ros::shutdown();
+		}
+	}
+	// 按雷达型号调用visitor(Traits())，每帧只分派一次，读取与投影代码按型号实例化；false表示未知型号
+	template <typename Visitor>
+	bool dispatchSensor(Visitor &&visitor)
+	{
+		switch (sensor)
+		{
+		case SensorType::VELODYNE:
+			visitor(VelodyneTraits());
+			return true;
+		case SensorType::OUSTER:
+			visitor(OusterTraits());
+			return true;
+		case SensorType::MULRAN:
+			visitor(MulranTraits());
+			return true;
+		case SensorType::LIVOX:
+			visitor(LivoxTraits());
+			return true;
+		case SensorType::HESAI:
+			visitor(HesaiTraits());
+			return true;
+		}
+		return false;
+	}
+
+	template <typename Traits>
+	void processCloud(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
+	{
+		// 添加一帧激光点云到点云队列，取出最早一帧作为当前帧，计算起止时间戳，检查数据有效性
+		if (!cachePointCloud<Traits>(laserCloudMsg))
+			return;
+		// 当前帧起止时刻对应的imu数据、imu里程计数据处理
+		if (!deskewInfo())
+			return;
+		// frontEnd中包含特征提取（cloudInfoSink在publishClouds中调用）
+		TRACE_SPAN("deskew/scan_ms");
+		// 当前帧激光点云运动畸变校正
+		// 1.检查激光点距离、扫描线是否合规
+		// 2.激光运动畸变校正，保存激光点
+		if (typedLayout)
+			projectPointCloud(std::get<TypedPointCloud2Reader<Traits>>(typedReaders));
+		else
+			projectPointCloud(cloudReader);
+		// 提取有效激光点，存extractedCloud
+		cloudExtraction();
+		// 发布当前帧校正后点云，有效点
+		publishClouds();
+		// 重置参数，接收每帧lidar数据都要重置这些参数
+		resetParameters();
+
+		publishMetricsDiagnostics(&pubMetrics, "deskew/");
+	}
+	// 添加一帧激光点云到点云队列，取出最早一帧作为当前帧，计算起止时间戳，检查数据有效性
+	template <typename Traits>
+	bool cachePointCloud(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
+	{
+		// cache point cloud
+		cloudQueue.push_back(laserCloudMsg);
+		if (cloudQueue.size() <= 2)
+			return false;
+
+		// 取出激光点云队列最早的一帧
+		currentCloudMsg = std::move(cloudQueue.front());
+		// get timestamp
+		cloudHeader = currentCloudMsg->header;
+		// 当前帧起始时刻
+		timeScanCur = cloudHeader.stamp.toSec();
+		cloudQueue.pop_front();
+
+		// 按字段偏移直接读取消息缓冲区，NaN点在读取时跳过
+		// 当前帧结束时刻，注：点云中激光点的time记录相对于当前帧第一个激光点的时差，第一个点time=0
+		auto &typedReader = std::get<TypedPointCloud2Reader<Traits>>(typedReaders);
+		typedLayout = typedReader.resolve(*currentCloudMsg);
+		if (typedLayout)
+		{
+			typedReader.bind(*currentCloudMsg);
+			timeScanEnd = timeScanCur + typedReader.lastPointTime();
+		}
+		else
+		{
+			if (!cloudReader.resolve(*currentCloudMsg))
+			{
+				ROS_ERROR("Point cloud x y z fields must be float32, please configure your point cloud data!");
+				ros::shutdown();
+				return false;
+			}
+			ROS_WARN_ONCE("Point cloud fields differ from the layout of the sensor type, reading them with per-point conversion");
+			cloudReader.bind(*currentCloudMsg);
+			timeScanEnd = timeScanCur + cloudReader.lastPointTime();
+		}
+
+		// check ring channel 检查是否存在ring通道，注意static，只检查一次
+		static int ringFlag = 0;
+		if (ringFlag == 0)
+		{
+			ringFlag = -1;
+			for (int i = 0; i < (int)currentCloudMsg->fields.size(); ++i)
+			{
+				if (currentCloudMsg->fields[i].name == Traits::ringField())
+				{
+					ringFlag = 1;
+					break;
+				}
+			}
+			if (ringFlag == -1)
+			{
+				ROS_ERROR("Point cloud ring channel not available, please configure your point cloud data!");
+				ros::shutdown();
+			}
+		}
+
+		// check point time 检查是否存在time通道
+		if (deskewFlag == 0)
+		{
+			deskewFlag = -1;
+			for (auto &field : currentCloudMsg->fields)
+			{
+				if (field.name == Traits::timeField())
+				{
+					deskewFlag = 1;
+					break;
+				}
+			}
+			if (deskewFlag == -1)
+				ROS_WARN("Point cloud timestamp not available, deskew function disabled, system will drift significantly!");
+		}
+
+		return true;
+	}
+	// 当前帧起止时刻对应的imu数据、imu里程计数据处理
+	bool deskewInfo()
+	{
+		std::lock_guard<std::mutex> lock2(odoLock);
+
+		// make sure IMU data available for the scan
+		uint64_t imuEnd = imuRing.end();
+		imuRingCursor = std::max(imuRingCursor, imuRing.begin());
+		ImuSample imuFront, imuBack;
+		if (imuRingCursor >= imuEnd || !imuRing.read(imuRingCursor, imuFront) || imuFront.time > timeScanCur ||
+				!imuRing.read(imuEnd - 1, imuBack) || imuBack.time < timeScanEnd)
+		{
+			ROS_DEBUG("Waiting for IMU data ...");
+			return false;
+		}
+		/* 当前帧对应imu数据处理
+		1、遍历当前激光帧起止时刻之间的imu数据，初始时刻对应imu的姿态角RPY设为当前帧的初始姿态角
+		2、用角速度、时间积分，计算每一时刻相对于初始时刻的旋转量，初始时刻旋转设为0
+		注：imu数据都已经转换到lidar系下了 */
+		imuDeskewInfo();
+		/* 当前帧对应imu里程计处理
+		1、遍历当前激光帧起止时刻之间的imu里程计数据，初始时刻对应imu里程计设为当前帧的初始位姿
+		2、用起始、终止时刻对应imu里程计，计算相对位姿变换，保存平移增量
+		注：imu数据都已经转换到lidar系下了 */
+		odomDeskewInfo();
+
+		return true;
+	}
+
+	void imuDeskewInfo()
+	{
+		TRACE_SPAN("deskew/imu_ms");
+		cloudInfo.imuAvailable = false;
+
+		// drop the samples older than the scan
+		imuRingCursor = imuRing.lowerBound(timeScanCur - 0.01, imuRingCursor);
+
+		uint64_t imuEnd = imuRing.end();
+		if (imuRingCursor >= imuEnd)
+			return;
+
+		imuPointerCur = 0;
+
+		for (uint64_t i = imuRingCursor; i < imuEnd; ++i)
+		{
+			ImuSample thisImu;
+			if (!imuRing.read(i, thisImu))
+				continue; // overwritten while this scan waited
+			double currentImuTime = thisImu.time;
+
+			// get roll, pitch, and yaw estimation for this scan
+			if (currentImuTime <= timeScanCur)
+			{
+				double imuRoll, imuPitch, imuYaw;
+				tf::Matrix3x3(tf::Quaternion(thisImu.quat[0], thisImu.quat[1], thisImu.quat[2], thisImu.quat[3])).getRPY(imuRoll, imuPitch, imuYaw);
+				cloudInfo.imuRollInit = imuRoll;
+				cloudInfo.imuPitchInit = imuPitch;
+				cloudInfo.imuYawInit = imuYaw;
+			}
+
+			if (currentImuTime > timeScanEnd + 0.01)
+				break;
+
+			if (imuPointerCur == 0)
+			{
+				imuRotX[0] = 0;
+				imuRotY[0] = 0;
+				imuRotZ[0] = 0;
+				imuTime[0] = currentImuTime;
+				++imuPointerCur;
+				continue;
+			}
+
+			// get angular velocity
+			double angular_x = thisImu.gyr[0];
+			double angular_y = thisImu.gyr[1];
+			double angular_z = thisImu.gyr[2];
+
+			// integrate rotation
+			double timeDiff = currentImuTime - imuTime[imuPointerCur - 1];
+			imuRotX[imuPointerCur] = imuRotX[imuPointerCur - 1] + angular_x * timeDiff;
+			imuRotY[imuPointerCur] = imuRotY[imuPointerCur - 1] + angular_y * timeDiff;
+			imuRotZ[imuPointerCur] = imuRotZ[imuPointerCur - 1] + angular_z * timeDiff;
+			imuTime[imuPointerCur] = currentImuTime;
+			++imuPointerCur;
+		}
+
+		--imuPointerCur;
+
+		if (imuPointerCur <= 0)
+			return;
+
+		cloudInfo.imuAvailable = true;
+	}
+
+	void odomDeskewInfo()
+	{
+		cloudInfo.odomAvailable = false;
+
+		while (!odomQueue.empty())
+		{
+			if (odomQueue.front().header.stamp.toSec() < timeScanCur - 0.01)
+				odomQueue.pop_front();
+			else
+				break;
+		}
+
+		if (odomQueue.empty())
+			return;
+
+		if (odomQueue.front().header.stamp.toSec() > timeScanCur)
+			return;
+
+		// get start odometry at the beinning of the scan
+		nav_msgs::Odometry startOdomMsg;
+
+		for (int i = 0; i < (int)odomQueue.size(); ++i)
+		{
+			startOdomMsg = odomQueue[i];
+
+			if (ROS_TIME(&startOdomMsg) < timeScanCur)
+				continue;
+			else
+				break;
+		}
+
+		tf::Quaternion orientation;
+		tf::quaternionMsgToTF(startOdomMsg.pose.pose.orientation, orientation);
+
+		double roll, pitch, yaw;
+		tf::Matrix3x3(orientation).getRPY(roll, pitch, yaw);
+
+		// Initial guess used in mapOptimization
+		cloudInfo.initialGuessX = startOdomMsg.pose.pose.position.x;
+		cloudInfo.initialGuessY = startOdomMsg.pose.pose.position.y;
+		cloudInfo.initialGuessZ = startOdomMsg.pose.pose.position.z;
+		cloudInfo.initialGuessRoll = roll;
+		cloudInfo.initialGuessPitch = pitch;
+		cloudInfo.initialGuessYaw = yaw;
+
+		cloudInfo.odomAvailable = true;
+
+		// get end odometry at the end of the scan
+		odomDeskewFlag = false;
+
+		if (odomQueue.back().header.stamp.toSec() < timeScanEnd)
+			return;
+
+		nav_msgs::Odometry endOdomMsg;
+
+		for (int i = 0; i < (int)odomQueue.size(); ++i)
+		{
+			endOdomMsg = odomQueue[i];
+
+			if (ROS_TIME(&endOdomMsg) < timeScanEnd)
+				continue;
+			else
+				break;
+		}
+
+		if (int(round(startOdomMsg.pose.covariance[0])) != int(round(endOdomMsg.pose.covariance[0])))
+			return;
+
+		Eigen::Affine3f transBegin = pcl::getTransformation(startOdomMsg.pose.pose.position.x, startOdomMsg.pose.pose.position.y, startOdomMsg.pose.pose.position.z, roll, pitch, yaw);
+
+		tf::quaternionMsgToTF(endOdomMsg.pose.pose.orientation, orientation);
+		tf::Matrix3x3(orientation).getRPY(roll, pitch, yaw);
+		Eigen::Affine3f transEnd = pcl::getTransformation(endOdomMsg.pose.pose.position.x, endOdomMsg.pose.pose.position.y, endOdomMsg.pose.pose.position.z, roll, pitch, yaw);
+
+		Eigen::Affine3f transBt = transBegin.inverse() * transEnd;
+
+		float rollIncre, pitchIncre, yawIncre;
+		pcl::getTranslationAndEulerAngles(transBt, odomIncreX, odomIncreY, odomIncreZ, rollIncre, pitchIncre, yawIncre);
+
+		odomDeskewFlag = true;
+	}
+
+	void findRotation(double pointTime, float *rotXCur, float *rotYCur, float *rotZCur) const
+	{
+		*rotXCur = 0;
+		*rotYCur = 0;
+		*rotZCur = 0;
+
+		// first IMU sample after pointTime (imuPointerCur if there is none); imuTime is increasing
+		int imuPointerFront = std::upper_bound(imuTime, imuTime + imuPointerCur, pointTime) - imuTime;
+
+		if (pointTime > imuTime[imuPointerFront] || imuPointerFront == 0)
+		{
+			*rotXCur = imuRotX[imuPointerFront];
+			*rotYCur = imuRotY[imuPointerFront];
+			*rotZCur = imuRotZ[imuPointerFront];
+		}
+		else
+		{
+			int imuPointerBack = imuPointerFront - 1;
+			double ratioFront = (pointTime - imuTime[imuPointerBack]) / (imuTime[imuPointerFront] - imuTime[imuPointerBack]);
+			double ratioBack = (imuTime[imuPointerFront] - pointTime) / (imuTime[imuPointerFront] - imuTime[imuPointerBack]);
+			*rotXCur = imuRotX[imuPointerFront] * ratioFront + imuRotX[imuPointerBack] * ratioBack;
+			*rotYCur = imuRotY[imuPointerFront] * ratioFront + imuRotY[imuPointerBack] * ratioBack;
+			*rotZCur = imuRotZ[imuPointerFront] * ratioFront + imuRotZ[imuPointerBack] * ratioBack;
+		}
+	}
+
+	void findPosition(double relTime, float *posXCur, float *posYCur, float *posZCur) const
+	{
+		*posXCur = 0;
+		*posYCur = 0;
+		*posZCur = 0;
+
+		// If the sensor moves relatively slow, like walking speed, positional deskew seems to have little benefits. Thus code below is commented.
+
+		// if (cloudInfo.odomAvailable == false || odomDeskewFlag == false)
+		//     return;
+
+		// float ratio = relTime / (timeScanEnd - timeScanCur);
+
+		// *posXCur = ratio * odomIncreX;
+		// *posYCur = ratio * odomIncreY;
+		// *posZCur = ratio * odomIncreZ;
+	}
+
+	bool deskewEnabled() const
+	{
+		return deskewFlag != -1 && cloudInfo.imuAvailable == true;
+	}
+
+	// the first projected point of the scan is the deskew reference; the transforms from each IMU sample to it are tabulated
+	void setDeskewStart(double relTime)
+	{
+		if (!deskewEnabled())
+			return;
+
+		double pointTime = timeScanCur + relTime;
+
+		float rotXCur, rotYCur, rotZCur;
+		findRotation(pointTime, &rotXCur, &rotYCur, &rotZCur);
+
+		float posXCur, posYCur, posZCur;
+		findPosition(relTime, &posXCur, &posYCur, &posZCur);
+
+		transStartInverse = (pcl::getTransformation(posXCur, posYCur, posZCur, rotXCur, rotYCur, rotZCur)).inverse();
+
+		// imuPointerCur is the last sample, findRotation() clamps to it
+		deskewRotation.resize(imuPointerCur + 1);
+		deskewTranslation.resize(imuPointerCur + 1);
+		for (int k = 0; k <= imuPointerCur; ++k)
+		{
+			findPosition(imuTime[k] - timeScanCur, &posXCur, &posYCur, &posZCur);
+			Eigen::Affine3f transBt = transStartInverse * pcl::getTransformation(posXCur, posYCur, posZCur, imuRotX[k], imuRotY[k], imuRotZ[k]);
+			deskewRotation[k] = Eigen::Quaternionf(transBt.linear());
+			deskewTranslation[k] = transBt.translation();
+		}
+	}
+
+	// transform to the first point at a point time, interpolated in the table of setDeskewStart() like findRotation() does in
+	// the Euler angles (normalized linear quaternion interpolation, the rotation between two IMU samples is small)
+	PointType deskewPoint(PointType *point, double relTime) const
+	{
+		if (!deskewEnabled())
+			return *point;
+
+		double pointTime = timeScanCur + relTime;
+		int imuPointerFront = std::upper_bound(imuTime, imuTime + imuPointerCur, pointTime) - imuTime;
+
+		Eigen::Quaternionf rotation;
+		Eigen::Vector3f translation;
+		if (pointTime > imuTime[imuPointerFront] || imuPointerFront == 0)
+		{
+			rotation = deskewRotation[imuPointerFront];
+			translation = deskewTranslation[imuPointerFront];
+		}
+		else
+		{
+			int imuPointerBack = imuPointerFront - 1;
+			float ratioFront = (pointTime - imuTime[imuPointerBack]) / (imuTime[imuPointerFront] - imuTime[imuPointerBack]);
+			const Eigen::Quaternionf &qBack = deskewRotation[imuPointerBack];
+			const Eigen::Quaternionf &qFront = deskewRotation[imuPointerFront];
+			float sign = qBack.dot(qFront) < 0 ? -1.0f : 1.0f;
+			rotation.coeffs() = qBack.coeffs() * (1 - ratioFront) + qFront.coeffs() * (sign * ratioFront);
+			rotation.normalize();
+			translation = deskewTranslation[imuPointerBack] * (1 - ratioFront) + deskewTranslation[imuPointerFront] * ratioFront;
+		}
+
+		Eigen::Vector3f p = rotation * Eigen::Vector3f(point->x, point->y, point->z) + translation;
+		PointType newPoint;
+		newPoint.x = p.x();
+		newPoint.y = p.y();
+		newPoint.z = p.z();
+		newPoint.intensity = point->intensity;
+
+		return newPoint;
+	}
+
+	/**
+	 * 距离图像投影：rangeMat的像素归属和fullCloud的点序与逐点串行投影一致；去畸变坐标由deskewPoint插值，与逐点计算相差约1mm（30m处）
+	 * 1、逐点并行计算距离、行号、列号，不合规的点标记为-1
+	 * 2、按行分桶，行内保持原始点序（同一像素保留最先到达的点）；第一个有效点作为去畸变参考
+	 * 3、各行在rangeMat、fullCloud中互不重叠，按行并行去畸变并写入
+	 * reader为当前帧的TypedPointCloud2Reader<Traits>或通用的PointCloud2Reader
+	 */
+	template <typename Reader>
+	void projectPointCloud(const Reader &reader)
+	{
+		TRACE_SPAN("deskew/project_ms");
+		int cloudSize = reader.size();
+		float ang_res_x = 360.0 / float(Horizon_SCAN);
+
+		pointRowIdn.resize(cloudSize);
+		pointColumnIdn.resize(cloudSize);
+		pointRangeIn.resize(cloudSize);
+
+		// range image projection
+		#pragma omp parallel for num_threads(numberOfCores)
+		for (int i = 0; i < cloudSize; ++i)
+		{
+			pointRowIdn[i] = -1;
+
+			RawLidarPoint rawPoint;
+			if (!reader.read(i, rawPoint))
+				continue;
+
+			PointType thisPoint;
+			thisPoint.x = rawPoint.x;
+			thisPoint.y = rawPoint.y;
+			thisPoint.z = rawPoint.z;
+			thisPoint.intensity = rawPoint.intensity;
+
+			float range = pointDistance(thisPoint);
+			if (range < lidarMinRange || range > lidarMaxRange)
+				continue;
+
+			int rowIdn = rawPoint.ring;
+
+			if (rowIdn < 0 || rowIdn >= N_SCAN)
+				continue;
+
+			if (rowIdn % downsampleRate != 0)
+				continue;
+
+			float horizonAngle = atan2(thisPoint.x, thisPoint.y) * 180 / M_PI;
+
+			int columnIdn = -round((horizonAngle - 90.0) / ang_res_x) + Horizon_SCAN / 2;
+			if (columnIdn >= Horizon_SCAN)
+				columnIdn -= Horizon_SCAN;
+
+			if (columnIdn < 0 || columnIdn >= Horizon_SCAN)
+				continue;
+
+			pointRowIdn[i] = rowIdn;
+			pointColumnIdn[i] = columnIdn;
+			pointRangeIn[i] = range;
+		}
+
+		// bucket the points by row (counting sort, stable)
+		rowPointStart.assign(N_SCAN + 1, 0);
+		int firstPointIdx = -1;
+		for (int i = 0; i < cloudSize; ++i)
+		{
+			if (pointRowIdn[i] < 0)
+				continue;
+			++rowPointStart[pointRowIdn[i] + 1];
+			if (firstPointIdx < 0)
+				firstPointIdx = i;
+		}
+		for (int rowIdn = 0; rowIdn < N_SCAN; ++rowIdn)
+			rowPointStart[rowIdn + 1] += rowPointStart[rowIdn];
+
+		rowPointIdx.resize(rowPointStart[N_SCAN]);
+		rowPointFill.assign(rowPointStart.begin(), rowPointStart.end() - 1);
+		for (int i = 0; i < cloudSize; ++i)
+			if (pointRowIdn[i] >= 0)
+				rowPointIdx[rowPointFill[pointRowIdn[i]]++] = i;
+
+		if (firstPointIdx >= 0)
+		{
+			RawLidarPoint rawPoint;
+			reader.read(firstPointIdx, rawPoint);
+			setDeskewStart(rawPoint.time);
+		}
+
+		#pragma omp parallel for num_threads(numberOfCores) schedule(dynamic)
+		for (int rowIdn = 0; rowIdn < N_SCAN; ++rowIdn)
+		{
+			for (int k = rowPointStart[rowIdn]; k < rowPointStart[rowIdn + 1]; ++k)
+			{
+				int i = rowPointIdx[k];
+				int columnIdn = pointColumnIdn[i];
+
+				if (rangeMat.at<float>(rowIdn, columnIdn) != FLT_MAX)
+					continue;
+
+				RawLidarPoint rawPoint;
+				reader.read(i, rawPoint);
+
+				PointType thisPoint;
+				thisPoint.x = rawPoint.x;
+				thisPoint.y = rawPoint.y;
+				thisPoint.z = rawPoint.z;
+				thisPoint.intensity = rawPoint.intensity;
+
+				thisPoint = deskewPoint(&thisPoint, rawPoint.time);
+
+				rangeMat.at<float>(rowIdn, columnIdn) = pointRangeIn[i];
+
+				int index = columnIdn + rowIdn * Horizon_SCAN;
+				fullCloud->points[index] = thisPoint;
+			}
+		}
+	}
+
+	void cloudExtraction()
+	{
+		int count = 0;
+		// extract segmented cloud for lidar odometry
+		for (int i = 0; i < N_SCAN; ++i)
+		{
+			cloudInfo.startRingIndex[i] = count - 1 + 5;
+
+			for (int j = 0; j < Horizon_SCAN; ++j)
+			{
+				if (rangeMat.at<float>(i, j) != FLT_MAX)
+				{
+					// mark the points' column index for marking occlusion later
+					cloudInfo.pointColInd[count] = j;
+					// save range info
+					cloudInfo.pointRange[count] = rangeMat.at<float>(i, j);
+					// save extracted cloud
+					extractedCloud->push_back(fullCloud->points[j + i * Horizon_SCAN]);
+					// size of extracted cloud
+					++count;
+				}
+			}
+			cloudInfo.endRingIndex[i] = count - 1 - 5;
+		}
+	}
+
+	void publishClouds()
+	{
+		cloudInfo.header = cloudHeader;
+		cloudInfo.cloud_deskewed = publishCloud(&pubExtractedCloud, extractedCloud, cloudHeader.stamp, lidarFrame);
+		if (!cloudInfoSink)
+		{
+			pubLaserCloudInfo.publish(cloudInfo);
+			return;
+		}
+
+		if (pubLaserCloudInfo.getNumSubscribers() != 0)
+			pubLaserCloudInfo.publish(cloudInfo);
+		cloudInfoSink(cloudInfo, extractedCloud);
+	}
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <sensor_msgs/Imu.h>
+
+/*
+ * IMU samples shared between the IMU callback and the nodes' lidar/odometry callbacks without a mutex.
+ *
+ * One producer pushes; any number of consumers read by absolute sample index (0, 1, 2, ... since
+ * construction), each with its own cursor. The buffer keeps the last `capacity` samples. A slot is
+ * guarded by a sequence number, so a reader never returns a sample that was overwritten while it was
+ * copying; read() just fails for indices that are gone (older than begin()) or not pushed yet.
+ */
+struct ImuSample
+{
+    double time = 0;
+    double acc[3] = {0, 0, 0};
+    double gyr[3] = {0, 0, 0};
+    double quat[4] = {0, 0, 0, 1}; // x y z w
+
+    static ImuSample fromMsg(const sensor_msgs::Imu &_msg)
+    {
+        ImuSample sample;
+        sample.time = _msg.header.stamp.toSec();
+        sample.acc[0] = _msg.linear_acceleration.x;
+        sample.acc[1] = _msg.linear_acceleration.y;
+        sample.acc[2] = _msg.linear_acceleration.z;
+        sample.gyr[0] = _msg.angular_velocity.x;
+        sample.gyr[1] = _msg.angular_velocity.y;
+        sample.gyr[2] = _msg.angular_velocity.z;
+        sample.quat[0] = _msg.orientation.x;
+        sample.quat[1] = _msg.orientation.y;
+        sample.quat[2] = _msg.orientation.z;
+        sample.quat[3] = _msg.orientation.w;
+        return sample;
+    }
+};
+
+class ImuRingBuffer
+{
+public:
+    // _capacity is rounded up to a power of two
+    explicit ImuRingBuffer(size_t _capacity = 1 << 14)
+    {
+        size_t capacity = 1;
+        while (capacity < _capacity)
+            capacity <<= 1;
+        mask_ = capacity - 1;
+        slots_.reset(new Slot[capacity]);
+    }
+
+    ImuRingBuffer(const ImuRingBuffer &) = delete;
+    ImuRingBuffer &operator=(const ImuRingBuffer &) = delete;
+
+    // producer only
+    void push(const ImuSample &_sample)
+    {
+        const uint64_t idx = end_.load(std::memory_order_relaxed);
+        Slot &slot = slots_[idx & mask_];
+        slot.seq.store(2 * idx + 1, std::memory_order_relaxed); // odd: being written
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.sample = _sample;
+        slot.seq.store(2 * idx + 2, std::memory_order_release);
+        end_.store(idx + 1, std::memory_order_release);
+    }
+
+    // one past the newest sample
+    uint64_t end() const { return end_.load(std::memory_order_acquire); }
+
+    // oldest sample not overwritten yet (it may be overwritten by the time it is read)
+    uint64_t begin() const
+    {
+        const uint64_t end_idx = end();
+        return end_idx > capacity() ? end_idx - capacity() : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    bool read(uint64_t _idx, ImuSample &_sample) const
+    {
+        const Slot &slot = slots_[_idx & mask_];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * _idx + 2)
+            return false;
+        _sample = slot.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == seq;
+    }
+
+    // first index in [_from, end()) whose sample is not older than _time (end() if none); samples are in time order
+    uint64_t lowerBound(double _time, uint64_t _from = 0) const
+    {
+        uint64_t lo = std::max(_from, begin());
+        uint64_t hi = end();
+        ImuSample sample;
+        while (lo < hi)
+        {
+            const uint64_t mid = lo + (hi - lo) / 2;
+            if (!read(mid, sample) || sample.time < _time) // overwritten samples are the oldest ones
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        ImuSample sample;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    std::atomic<uint64_t> end_{0};
+}; // ImuRingBuffer
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "sessionFile.h"
+
+/*
+ * Corner and surf feature clouds of every keyframe, with a RAM ceiling.
+ *
+ * Clouds are resident (shared pointers) until the resident bytes exceed the budget; then enforceBudget() spills keyframes to
+ * an append-only file, farthest from the latest key pose first and never one of the most recent ones, so the keyframes the
+ * scan-to-map matching needs (within surroundingKeyframeSearchRadius) are the last to go. A keyframe cloud never changes, so
+ * it is written once and only dropped from RAM afterwards. get() pages a spilled keyframe back in from the memory-mapped file
+ * as fresh clouds owned by the caller; they do not count against the budget and are not made resident again.
+ * All members are thread-safe.
+ */
+template <typename PointT>
+class KeyFrameStore
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudPtr = typename Cloud::Ptr;
+
+    struct KeyFrame
+    {
+        CloudPtr corner;
+        CloudPtr surf;
+    };
+
+    KeyFrameStore() = default;
+    KeyFrameStore(const KeyFrameStore &) = delete;
+    KeyFrameStore &operator=(const KeyFrameStore &) = delete;
+
+    ~KeyFrameStore()
+    {
+        if (map_ != nullptr)
+            munmap(map_, map_bytes_);
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            unlink(spill_file_.c_str());
+        }
+    }
+
+    // _budget_bytes == 0: everything stays resident; _spill_file is created on the first spill and removed on destruction
+    void setBudget(size_t _budget_bytes, size_t _num_recent, const std::string &_spill_file)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        budget_bytes_ = _budget_bytes;
+        num_recent_ = _num_recent;
+        spill_file_ = _spill_file;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return entries_.size();
+    }
+
+    void push_back(const CloudPtr &_corner, const CloudPtr &_surf)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        Entry entry;
+        entry.clouds = KeyFrame{_corner, _surf};
+        entry.bytes = (_corner->size() + _surf->size()) * sizeof(PointT);
+        resident_bytes_ += entry.bytes;
+        entries_.push_back(entry);
+    }
+
+    // the resident clouds of keyframe _idx, or a copy paged in from the spill file
+    KeyFrame get(size_t _idx)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        const Entry &entry = entries_[_idx];
+        if (entry.clouds.corner)
+            return entry.clouds;
+
+        KeyFrame clouds{CloudPtr(new Cloud()), CloudPtr(new Cloud())};
+        if (!mapSpillFile(entry.offset + (entry.num_corner + entry.num_surf) * POINT_BYTES))
+            return clouds; // the spill file is gone, the keyframe is lost
+        decodeSessionCloud(map_ + entry.offset, entry.num_corner * POINT_BYTES, *clouds.corner);
+        decodeSessionCloud(map_ + entry.offset + entry.num_corner * POINT_BYTES, entry.num_surf * POINT_BYTES, *clouds.surf);
+        ++page_ins_;
+        return clouds;
+    }
+
+    // spills keyframes until the resident bytes are back under the budget; _key_poses[i] is the position of keyframe i
+    template <typename PoseCloud>
+    void enforceBudget(const PoseCloud &_key_poses)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (budget_bytes_ == 0 || resident_bytes_ <= budget_bytes_ || _key_poses.points.empty())
+            return;
+
+        const auto &latest = _key_poses.points.back();
+        const size_t last = entries_.size() > num_recent_ ? entries_.size() - num_recent_ : 0;
+        std::vector<std::pair<float, size_t>> candidates; // (squared distance to the latest key pose, index)
+        for (size_t i = 0; i < last && i < _key_poses.points.size(); ++i)
+        {
+            if (!entries_[i].clouds.corner)
+                continue;
+            const auto &pose = _key_poses.points[i];
+            float dx = pose.x - latest.x, dy = pose.y - latest.y, dz = pose.z - latest.z;
+            candidates.emplace_back(dx * dx + dy * dy + dz * dz, i);
+        }
+        std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<float, size_t>>());
+
+        // down to 90% of the budget, so that not every new keyframe spills one
+        const size_t target = budget_bytes_ / 10 * 9;
+        for (const auto &candidate : candidates)
+        {
+            if (resident_bytes_ <= target)
+                break;
+            if (!spill(entries_[candidate.second]))
+                break;
+        }
+    }
+
+    size_t residentBytes() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return resident_bytes_;
+    }
+
+    size_t spilledCount() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return spilled_;
+    }
+
+    size_t pageIns() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return page_ins_;
+    }
+
+private:
+    static constexpr size_t POINT_BYTES = 4 * sizeof(float); // x y z intensity, as SESSION_CLOUD
+
+    struct Entry
+    {
+        KeyFrame clouds; // null once spilled
+        size_t bytes = 0;
+        uint64_t offset = 0; // in the spill file
+        uint64_t num_corner = 0;
+        uint64_t num_surf = 0;
+    };
+
+    bool spill(Entry &_entry)
+    {
+        if (fd_ < 0)
+        {
+            fd_ = ::open(spill_file_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0)
+                return false;
+        }
+
+        std::vector<float> corner, surf;
+        encodeSessionCloud(*_entry.clouds.corner, corner);
+        encodeSessionCloud(*_entry.clouds.surf, surf);
+        const size_t corner_bytes = corner.size() * sizeof(float);
+        const size_t surf_bytes = surf.size() * sizeof(float);
+        if (!writeAll(corner.data(), corner_bytes, file_bytes_) || !writeAll(surf.data(), surf_bytes, file_bytes_ + corner_bytes))
+            return false;
+
+        _entry.offset = file_bytes_;
+        _entry.num_corner = _entry.clouds.corner->size();
+        _entry.num_surf = _entry.clouds.surf->size();
+        file_bytes_ += corner_bytes + surf_bytes;
+        _entry.clouds = KeyFrame();
+        resident_bytes_ -= _entry.bytes;
+        ++spilled_;
+        return true;
+    }
+
+    bool writeAll(const void *_data, size_t _bytes, uint64_t _offset)
+    {
+        const char *data = static_cast<const char *>(_data);
+        while (_bytes > 0)
+        {
+            ssize_t written = pwrite(fd_, data, _bytes, _offset);
+            if (written <= 0)
+                return false;
+            data += written;
+            _bytes -= written;
+            _offset += written;
+        }
+        return true;
+    }
+
+    // (re)maps the spill file if it grew past the current mapping
+    bool mapSpillFile(uint64_t _end)
+    {
+        if (_end <= map_bytes_)
+            return true;
+        if (map_ != nullptr)
+            munmap(map_, map_bytes_);
+        map_ = nullptr;
+        map_bytes_ = 0;
+
+        void *map = mmap(nullptr, file_bytes_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED)
+            return false;
+        map_ = static_cast<char *>(map);
+        map_bytes_ = file_bytes_;
+        return _end <= map_bytes_;
+    }
+
+    mutable std::mutex mtx_;
+    std::vector<Entry> entries_;
+    size_t budget_bytes_ = 0;
+    size_t num_recent_ = 0;
+    size_t resident_bytes_ = 0;
+    size_t spilled_ = 0;
+    size_t page_ins_ = 0;
+
+    std::string spill_file_;
+    int fd_ = -1;
+    uint64_t file_bytes_ = 0;
+    char *map_ = nullptr;
+    size_t map_bytes_ = 0;
+}; // KeyFrameStore
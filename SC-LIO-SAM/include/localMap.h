@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Voxel-hashed local map for scan-to-map optimization.
+ *
+ * The map keeps, per voxel, the running sum of every point that fell in it, so the exported
+ * cloud is the same centroid-per-voxel result pcl::VoxelGrid gives over the union of the
+ * inserted keyframe clouds. Keyframes can be inserted and evicted in place, so the local map
+ * no longer has to be concatenated and re-voxelized from scratch every scan.
+ * The keyframe clouds are held by shared pointer; they are needed again when evicting.
+ */
+template <typename PointT>
+class VoxelLocalMap
+{
+public:
+    using CloudConstPtr = typename pcl::PointCloud<PointT>::ConstPtr;
+
+    void setLeafSize(float _leaf_size)
+    {
+        inverse_leaf_size_ = 1.0f / _leaf_size;
+        clear();
+    }
+
+    bool contains(int _key) const
+    {
+        return members_.find(_key) != members_.end();
+    }
+
+    void insert(int _key, const CloudConstPtr &_cloud)
+    {
+        if (contains(_key))
+            return;
+
+        members_[_key] = _cloud;
+        for (const auto &pt : _cloud->points)
+            accumulate(pt, 1);
+    }
+
+    void erase(int _key)
+    {
+        auto it = members_.find(_key);
+        if (it == members_.end())
+            return;
+
+        for (const auto &pt : it->second->points)
+            accumulate(pt, -1);
+        members_.erase(it);
+    }
+
+    void clear()
+    {
+        members_.clear();
+        voxels_.clear();
+    }
+
+    // into _keys_out, so that a caller can keep its capacity between calls
+    void keys(std::vector<int> &_keys_out) const
+    {
+        _keys_out.clear();
+        for (const auto &member : members_)
+            _keys_out.push_back(member.first);
+    }
+
+    // voxel centroids of all inserted keyframes, i.e., the downsampled local map
+    void getCloud(pcl::PointCloud<PointT> &_cloud_out) const
+    {
+        _cloud_out.clear();
+        _cloud_out.reserve(voxels_.size());
+        for (const auto &voxel : voxels_)
+        {
+            const Voxel &v = voxel.second;
+            PointT pt;
+            pt.x = v.x / v.count;
+            pt.y = v.y / v.count;
+            pt.z = v.z / v.count;
+            pt.intensity = v.intensity / v.count;
+            _cloud_out.push_back(pt);
+        }
+    }
+
+    size_t numKeyframes() const { return members_.size(); }
+    size_t numVoxels() const { return voxels_.size(); }
+
+private:
+    struct Voxel
+    {
+        double x = 0;
+        double y = 0;
+        double z = 0;
+        double intensity = 0;
+        int count = 0;
+    };
+
+    // same grid as pcl::VoxelGrid: floor(p / leaf), 21 bits per axis (+-1M voxels)
+    int64_t voxelKey(const PointT &_pt) const
+    {
+        const int64_t ix = static_cast<int64_t>(std::floor(_pt.x * inverse_leaf_size_));
+        const int64_t iy = static_cast<int64_t>(std::floor(_pt.y * inverse_leaf_size_));
+        const int64_t iz = static_cast<int64_t>(std::floor(_pt.z * inverse_leaf_size_));
+        return ((ix & 0x1FFFFF) << 42) | ((iy & 0x1FFFFF) << 21) | (iz & 0x1FFFFF);
+    }
+
+    void accumulate(const PointT &_pt, int _sign)
+    {
+        if (!std::isfinite(_pt.x) || !std::isfinite(_pt.y) || !std::isfinite(_pt.z))
+            return;
+
+        const int64_t key = voxelKey(_pt);
+        Voxel &v = voxels_[key];
+        v.x += _sign * _pt.x;
+        v.y += _sign * _pt.y;
+        v.z += _sign * _pt.z;
+        v.intensity += _sign * _pt.intensity;
+        v.count += _sign;
+        if (v.count <= 0)
+            voxels_.erase(key);
+    }
+
+    float inverse_leaf_size_ = 1.0f;
+    std::unordered_map<int, CloudConstPtr> members_;
+    std::unordered_map<int64_t, Voxel> voxels_;
+}; // VoxelLocalMap
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <Eigen/Core>
+
+#include <pcl/point_cloud.h>
+#include <pcl/registration/icp.h>
+#include <pcl/registration/gicp.h>
+#include <pcl/registration/ndt.h>
+
+#include "lruCache.h"
+
+/*
+ * Registration backend that verifies loop closure candidates: aligns a candidate's source cloud to its target cloud.
+ *
+ * align() may be called from several threads at once (one candidate each), so every call runs its own pcl registration
+ * object. Per-target data (the target kd-tree, GICP's target covariances) is kept in an LRU keyed by the caller's target
+ * key; the caller is responsible for giving a different key to a different target cloud.
+ */
+template <typename PointT>
+class LoopRegistration
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudPtr = typename Cloud::Ptr;
+
+    struct Result
+    {
+        bool converged = false;
+        double fitness = std::numeric_limits<double>::max(); // mean squared distance of the aligned source points to the target
+        Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    };
+
+    explicit LoopRegistration(size_t _cache_budget_bytes) : cache_(_cache_budget_bytes) {}
+    virtual ~LoopRegistration() = default;
+
+    // _target_key < 0: the target is not cached
+    virtual Result align(const CloudPtr &_source, const CloudPtr &_target, int64_t _target_key, const Eigen::Matrix4f &_guess) = 0;
+
+    // drops the per-target data, e.g. when the targets were rebuilt from corrected poses
+    void clearTargets()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        cache_.clear();
+    }
+
+    // _method: "ICP" (default), "GICP" or "NDT"; _cache_budget_bytes bounds the per-target data
+    static std::unique_ptr<LoopRegistration> create(const std::string &_method, float _max_correspondence_distance,
+                                                    int _max_iterations, size_t _cache_budget_bytes);
+
+protected:
+    using KdTreePtr = typename pcl::Registration<PointT, PointT>::KdTreePtr;
+    using CovariancesPtr = typename pcl::GeneralizedIterativeClosestPoint<PointT, PointT>::MatricesVectorPtr;
+
+    struct TargetData
+    {
+        KdTreePtr tree;             // built on the target
+        CovariancesPtr covariances; // GICP only
+    };
+
+    bool lookupTarget(int64_t _target_key, TargetData &_data)
+    {
+        if (_target_key < 0)
+            return false;
+        std::lock_guard<std::mutex> lock(mtx_);
+        const TargetData *data = cache_.get(_target_key);
+        if (data == nullptr)
+            return false;
+        _data = *data;
+        return true;
+    }
+
+    void storeTarget(int64_t _target_key, const TargetData &_data, size_t _num_points)
+    {
+        if (_target_key < 0)
+            return;
+        size_t bytes = _num_points * (2 * sizeof(int) + sizeof(float) * 4 + (_data.covariances ? sizeof(Eigen::Matrix3d) : 0)); // kd-tree index and its copy of the points
+        std::lock_guard<std::mutex> lock(mtx_);
+        cache_.put(_target_key, _data, bytes);
+    }
+
+    template <typename Registration>
+    static void setCriteria(Registration &_reg, float _max_correspondence_distance, int _max_iterations)
+    {
+        _reg.setMaxCorrespondenceDistance(_max_correspondence_distance);
+        _reg.setMaximumIterations(_max_iterations);
+        _reg.setTransformationEpsilon(1e-6);
+        _reg.setEuclideanFitnessEpsilon(1e-6);
+        _reg.setRANSACIterations(0);
+    }
+
+    template <typename Registration>
+    static Result run(Registration &_reg, const Eigen::Matrix4f &_guess)
+    {
+        Cloud aligned;
+        _reg.align(aligned, _guess);
+
+        Result result;
+        result.converged = _reg.hasConverged();
+        result.fitness = _reg.getFitnessScore();
+        result.transform = _reg.getFinalTransformation();
+        return result;
+    }
+
+private:
+    std::mutex mtx_; // guards cache_
+    LRUCache<int64_t, TargetData> cache_;
+}; // LoopRegistration
+
+
+// point-to-point ICP, as the loop closure used so far; the target kd-tree is built once per target key
+template <typename PointT>
+class ICPLoopRegistration : public LoopRegistration<PointT>
+{
+public:
+    using Base = LoopRegistration<PointT>;
+
+    ICPLoopRegistration(float _max_correspondence_distance, int _max_iterations, size_t _cache_budget_bytes)
+        : Base(_cache_budget_bytes), max_correspondence_distance_(_max_correspondence_distance), max_iterations_(_max_iterations) {}
+
+    typename Base::Result align(const typename Base::CloudPtr &_source, const typename Base::CloudPtr &_target,
+                                int64_t _target_key, const Eigen::Matrix4f &_guess) override
+    {
+        pcl::IterativeClosestPoint<PointT, PointT> icp;
+        Base::setCriteria(icp, max_correspondence_distance_, max_iterations_);
+        icp.setInputSource(_source);
+        icp.setInputTarget(_target);
+
+        typename Base::TargetData cached;
+        bool hit = this->lookupTarget(_target_key, cached);
+        if (hit)
+            icp.setSearchMethodTarget(cached.tree, true /* already built on this target */);
+
+        typename Base::Result result = Base::run(icp, _guess);
+
+        if (!hit)
+            this->storeTarget(_target_key, typename Base::TargetData{icp.getSearchMethodTarget(), nullptr}, _target->size());
+        return result;
+    }
+
+private:
+    float max_correspondence_distance_;
+    int max_iterations_;
+}; // ICPLoopRegistration
+
+
+// generalized ICP; the target kd-tree and per-point covariances are computed once per target key
+template <typename PointT>
+class GICPLoopRegistration : public LoopRegistration<PointT>
+{
+public:
+    using Base = LoopRegistration<PointT>;
+
+    GICPLoopRegistration(float _max_correspondence_distance, int _max_iterations, size_t _cache_budget_bytes)
+        : Base(_cache_budget_bytes), max_correspondence_distance_(_max_correspondence_distance), max_iterations_(_max_iterations) {}
+
+    typename Base::Result align(const typename Base::CloudPtr &_source, const typename Base::CloudPtr &_target,
+                                int64_t _target_key, const Eigen::Matrix4f &_guess) override
+    {
+        GICP gicp;
+        Base::setCriteria(gicp, max_correspondence_distance_, max_iterations_);
+        gicp.setInputSource(_source);
+        gicp.setInputTarget(_target); // resets the target covariances, so the cached ones are set after it
+
+        typename Base::TargetData cached;
+        bool hit = this->lookupTarget(_target_key, cached);
+        if (hit)
+        {
+            gicp.setSearchMethodTarget(cached.tree, true /* already built on this target */);
+            gicp.setTargetCovariances(cached.covariances);
+        }
+
+        typename Base::Result result = Base::run(gicp, _guess);
+
+        if (!hit && gicp.targetCovariances())
+            this->storeTarget(_target_key, typename Base::TargetData{gicp.getSearchMethodTarget(), gicp.targetCovariances()}, _target->size());
+        return result;
+    }
+
+private:
+    // exposes the covariances computed by the last align()
+    class GICP : public pcl::GeneralizedIterativeClosestPoint<PointT, PointT>
+    {
+    public:
+        typename Base::CovariancesPtr targetCovariances() const { return this->target_covariances_; }
+    };
+
+    float max_correspondence_distance_;
+    int max_iterations_;
+}; // GICPLoopRegistration
+
+
+// normal distributions transform on a 1 m voxel grid of the target (there is no correspondence distance)
+template <typename PointT>
+class NDTLoopRegistration : public LoopRegistration<PointT>
+{
+public:
+    using Base = LoopRegistration<PointT>;
+
+    explicit NDTLoopRegistration(int _max_iterations) : Base(0), max_iterations_(_max_iterations) {}
+
+    typename Base::Result align(const typename Base::CloudPtr &_source, const typename Base::CloudPtr &_target,
+                                int64_t /*_target_key*/, const Eigen::Matrix4f &_guess) override
+    {
+        pcl::NormalDistributionsTransform<PointT, PointT> ndt;
+        ndt.setMaximumIterations(max_iterations_);
+        ndt.setTransformationEpsilon(1e-6);
+        ndt.setStepSize(0.1);
+        ndt.setResolution(1.0);
+        ndt.setInputSource(_source);
+        ndt.setInputTarget(_target);
+        return Base::run(ndt, _guess);
+    }
+
+private:
+    int max_iterations_;
+}; // NDTLoopRegistration
+
+
+template <typename PointT>
+std::unique_ptr<LoopRegistration<PointT>> LoopRegistration<PointT>::create(const std::string &_method, float _max_correspondence_distance,
+                                                                           int _max_iterations, size_t _cache_budget_bytes)
+{
+    if (_method == "GICP")
+        return std::unique_ptr<LoopRegistration>(new GICPLoopRegistration<PointT>(_max_correspondence_distance, _max_iterations, _cache_budget_bytes));
+    if (_method == "NDT")
+        return std::unique_ptr<LoopRegistration>(new NDTLoopRegistration<PointT>(_max_iterations));
+    return std::unique_ptr<LoopRegistration>(new ICPLoopRegistration<PointT>(_max_correspondence_distance, _max_iterations, _cache_budget_bytes));
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/*
+ * Least-recently-used cache bounded by a memory budget in bytes.
+ *
+ * The caller tells the cache how many bytes each value accounts for when inserting it.
+ * Values are meant to be cheap handles (e.g., shared pointers to point clouds), so a hit hands
+ * out shared ownership instead of copying the payload. Not thread-safe by itself.
+ */
+template <typename Key, typename Value>
+class LRUCache
+{
+public:
+    explicit LRUCache(size_t _budget_bytes = 0) : budget_bytes_(_budget_bytes) {}
+
+    void setBudget(size_t _budget_bytes)
+    {
+        budget_bytes_ = _budget_bytes;
+        evict();
+    }
+
+    // returns nullptr on miss; a hit becomes the most recently used entry
+    const Value *get(const Key &_key)
+    {
+        auto it = index_.find(_key);
+        if (it == index_.end())
+        {
+            ++misses_;
+            return nullptr;
+        }
+
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return &it->second->value;
+    }
+
+    void put(const Key &_key, Value _value, size_t _bytes)
+    {
+        erase(_key);
+        entries_.push_front(Entry{_key, std::move(_value), _bytes});
+        index_[_key] = entries_.begin();
+        used_bytes_ += _bytes;
+        evict();
+    }
+
+    void erase(const Key &_key)
+    {
+        auto it = index_.find(_key);
+        if (it == index_.end())
+            return;
+
+        used_bytes_ -= it->second->bytes;
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+
+    // drops every entry for which _pred(key, value) holds, returns the number of dropped entries
+    template <typename Predicate>
+    size_t eraseIf(Predicate _pred)
+    {
+        size_t num_erased = 0;
+        for (auto it = entries_.begin(); it != entries_.end();)
+        {
+            if (_pred(it->key, it->value))
+            {
+                used_bytes_ -= it->bytes;
+                index_.erase(it->key);
+                it = entries_.erase(it);
+                ++num_erased;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return num_erased;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        index_.clear();
+        used_bytes_ = 0;
+    }
+
+    size_t size() const { return entries_.size(); }
+    size_t bytes() const { return used_bytes_; }
+    size_t budget() const { return budget_bytes_; }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+private:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        size_t bytes;
+    };
+
+    // the most recently inserted entry is always kept, even if it alone exceeds the budget
+    void evict()
+    {
+        while (used_bytes_ > budget_bytes_ && entries_.size() > 1)
+        {
+            const Entry &lru = entries_.back();
+            used_bytes_ -= lru.bytes;
+            index_.erase(lru.key);
+            entries_.pop_back();
+        }
+    }
+
+    size_t budget_bytes_;
+    size_t used_bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    std::list<Entry> entries_; // front: most recently used
+    std::unordered_map<Key, typename std::list<Entry>::iterator> index_;
+}; // LRUCache
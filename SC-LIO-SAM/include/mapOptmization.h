@@ -0,0 +1,3282 @@
+#pragma once
+
+#include "utility.h"
+
+#include "lio_sam/cloud_info.h"
+
+#include <gtsam/geometry/Rot3.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/slam/dataset.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/navigation/GPSFactor.h>
+#include <gtsam/navigation/ImuFactor.h>
+#include <gtsam/navigation/CombinedImuFactor.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/nonlinear/Marginals.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/inference/Symbol.h>
+
+#include <gtsam/nonlinear/ISAM2.h>
+
+#include "Scancontext.h"
+#include "localMap.h"
+#include "lruCache.h"
+#include "metrics.h"
+#include "asyncWriter.h"
+#include "pcdStreamWriter.h"
+#include "voxelChunkMap.h"
+#include "loopRegistration.h"
+#include "priorSession.h"
+#include "sessionFile.h"
+#include "keyframeStore.h"
+#include "tileSpill.h"
+#include "tiledMap.h"
+#include "cloudKdTree.h"
+#include "voxelFilter.h"
+#include "allocationCounter.h"
+#include "overloadScheduler.h"
+
+#include <omp.h>
+#include <climits>
+#include <cstdlib>
+
+using namespace gtsam;
+
+using symbol_shorthand::B; // Bias  (ax,ay,az,gx,gy,gz)
+using symbol_shorthand::G; // GPS pose
+using symbol_shorthand::V; // Vel   (xdot,ydot,zdot)
+using symbol_shorthand::X; // Pose3 (x,y,z,r,p,y)
+
+void saveOptimizedVerticesKITTIformat(gtsam::Values _estimates, std::string _filename)
+{
+	using namespace gtsam;
+
+	// ref from gtsam's original code "dataset.cpp"
+	std::fstream stream(_filename.c_str(), fstream::out);
+
+	for (const auto &key_value : _estimates)
+	{
+		auto p = dynamic_cast<const GenericValue<Pose3> *>(&key_value.value);
+		if (!p)
+			continue;
+
+		const Pose3 &pose = p->value();
+
+		Point3 t = pose.translation();
+		Rot3 R = pose.rotation();
+		auto col1 = R.column(1); // Point3
+		auto col2 = R.column(2); // Point3
+		auto col3 = R.column(3); // Point3
+
+		stream << col1.x() << " " << col2.x() << " " << col3.x() << " " << t.x() << " "
+					 << col1.y() << " " << col2.y() << " " << col3.y() << " " << t.y() << " "
+					 << col1.z() << " " << col2.z() << " " << col3.z() << " " << t.z() << std::endl;
+	}
+}
+
+/*
+ * A point cloud type that has 6D pose info ([x,y,z,roll,pitch,yaw] intensity is time stamp)
+ */
+struct PointXYZIRPYT
+{
+	PCL_ADD_POINT4D
+	PCL_ADD_INTENSITY; // preferred way of adding a XYZ+padding
+	float roll;
+	float pitch;
+	float yaw;
+	double time;
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW // make sure our new allocators are aligned
+} EIGEN_ALIGN16;									// enforce SSE padding for correct memory alignment
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(PointXYZIRPYT,
+																	(float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(float, roll, roll)(float, pitch, pitch)(float, yaw, yaw)(double, time, time))
+
+typedef PointXYZIRPYT PointTypePose;
+
+/*
+ * Keyframe feature clouds transformed into the map frame, shared between the cache and the local map
+ */
+struct TransformedKeyFrame
+{
+	pcl::PointCloud<PointType>::ConstPtr corner;
+	pcl::PointCloud<PointType>::ConstPtr surf;
+	PointTypePose pose; // key pose the clouds were transformed with
+};
+
+/*
+ * Normal equations (AtA, AtB) of the scan-to-map problem, accumulated residual by residual.
+ * Each Jacobian row is formed at the linearization point and folded in right away, so the N x 6 matrix is never stored.
+ * Rows follow the camera-frame convention of the original loam_velodyne derivation (see LMOptimization).
+ */
+struct LMNormalEquations
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	Eigen::Matrix<double, 6, 6> AtA = Eigen::Matrix<double, 6, 6>::Zero();
+	Eigen::Matrix<double, 6, 1> AtB = Eigen::Matrix<double, 6, 1>::Zero();
+	int numResiduals = 0;
+
+	// linearization point (lidar -> camera)
+	float srx = 0, crx = 1, sry = 0, cry = 1, srz = 0, crz = 1;
+
+	LMNormalEquations() = default;
+
+	explicit LMNormalEquations(const float transform[6])
+		: srx(sin(transform[1])), crx(cos(transform[1])), sry(sin(transform[2])), cry(cos(transform[2])), srz(sin(transform[0])), crz(cos(transform[0]))
+	{
+	}
+
+	// same linearization point, no residuals (per-thread partial sums)
+	static LMNormalEquations emptyLike(const LMNormalEquations &other)
+	{
+		LMNormalEquations empty = other;
+		empty.AtA.setZero();
+		empty.AtB.setZero();
+		empty.numResiduals = 0;
+		return empty;
+	}
+
+	// pointLidar: feature point in the lidar frame, coeffLidar: residual direction (xyz) and weighted residual (intensity)
+	void add(const PointType &pointLidar, const PointType &coeffLidar)
+	{
+		PointType pointOri, coeff;
+		// lidar -> camera
+		pointOri.x = pointLidar.y;
+		pointOri.y = pointLidar.z;
+		pointOri.z = pointLidar.x;
+		// lidar -> camera
+		coeff.x = coeffLidar.y;
+		coeff.y = coeffLidar.z;
+		coeff.z = coeffLidar.x;
+		coeff.intensity = coeffLidar.intensity;
+		// in camera
+		float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y - srx * sry * pointOri.z) * coeff.x + (-srx * srz * pointOri.x - crz * srx * pointOri.y - crx * pointOri.z) * coeff.y + (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y - cry * srx * pointOri.z) * coeff.z;
+
+		float ary = ((cry * srx * srz - crz * sry) * pointOri.x + (sry * srz + cry * crz * srx) * pointOri.y + crx * cry * pointOri.z) * coeff.x + ((-cry * crz - srx * sry * srz) * pointOri.x + (cry * srz - crz * srx * sry) * pointOri.y - crx * sry * pointOri.z) * coeff.z;
+
+		float arz = ((crz * srx * sry - cry * srz) * pointOri.x + (-cry * crz - srx * sry * srz) * pointOri.y) * coeff.x + (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y + ((sry * srz + cry * crz * srx) * pointOri.x + (crz * sry - cry * srx * srz) * pointOri.y) * coeff.z;
+		// lidar -> camera
+		Eigen::Matrix<double, 6, 1> row;
+		row << arz, arx, ary, coeff.z, coeff.x, coeff.y;
+
+		AtA.noalias() += row * row.transpose();
+		AtB.noalias() += row * double(-coeff.intensity);
+		++numResiduals;
+	}
+
+	LMNormalEquations &operator+=(const LMNormalEquations &other)
+	{
+		AtA += other.AtA;
+		AtB += other.AtB;
+		numResiduals += other.numResiduals;
+		return *this;
+	}
+};
+
+#pragma omp declare reduction(+ : LMNormalEquations : omp_out += omp_in) initializer(omp_priv = LMNormalEquations::emptyLike(omp_orig))
+
+// giseop
+enum class SCInputType
+{
+	SINGLE_SCAN_FULL,
+	SINGLE_SCAN_FEAT,
+	MULTI_SCAN_FEAT
+};
+
+class mapOptimization : public ParamServer
+{
+
+public:
+	// gtsam
+	NonlinearFactorGraph gtSAMgraph;
+	Values initialEstimate;
+	Values optimizedEstimate;
+	ISAM2 *isam;
+	Values isamCurrentEstimate; // with isamBatchedUpdates or isamBackEndThread, only refreshed when a loop is closed (and at shutdown); with isamWindowSize, the window only
+	int isamWindowStart = 0;	  // isamWindowSize: the keys before it are marginalized out of isam
+	Values isamMarginalizedPoses; // and fixed at these poses
+	Eigen::MatrixXd poseCovariance;
+	bool poseCovarianceStale = true; // poseCovariance is computed when asked for, see latestPoseCovariance
+
+	ros::Publisher pubLaserCloudSurround;
+	ros::Publisher pubGlobalMapUpdates;
+	ros::Publisher pubLaserOdometryGlobal;
+	ros::Publisher pubLaserOdometryIncremental;
+	ros::Publisher pubKeyPoses;
+	ros::Publisher pubPath;
+
+	ros::Publisher pubHistoryKeyFrames;
+	ros::Publisher pubIcpKeyFrames;
+	ros::Publisher pubRecentKeyFrames;
+	ros::Publisher pubRecentKeyFrame;
+	ros::Publisher pubCloudRegisteredRaw;
+	ros::Publisher pubLoopConstraintEdge;
+	ros::Publisher pubMetrics;
+
+	ros::Subscriber subCloud;
+	ros::Subscriber subGPS;
+	ros::Subscriber subLoop;
+
+	std::deque<nav_msgs::Odometry> gpsQueue;
+	lio_sam::cloud_info cloudInfo;
+
+	KeyFrameStore<PointType> keyFrameStore; // corner and surf clouds of every keyframe, bounded by keyframeMemoryBudget
+
+	pcl::PointCloud<PointType>::Ptr cloudKeyPoses3D;
+	pcl::PointCloud<PointTypePose>::Ptr cloudKeyPoses6D;
+	pcl::PointCloud<PointType>::Ptr copy_cloudKeyPoses3D;
+	pcl::PointCloud<PointType>::Ptr copy_cloudKeyPoses2D; // giseop
+	pcl::PointCloud<PointTypePose>::Ptr copy_cloudKeyPoses6D;
+
+	pcl::PointCloud<PointType>::Ptr laserCloudRaw;	 // giseop
+	pcl::PointCloud<PointType>::Ptr laserCloudRawDS; // giseop
+	double laserCloudRawTime;
+
+	pcl::PointCloud<PointType>::Ptr laserCloudCornerLast;		// corner feature set from odoOptimization
+	pcl::PointCloud<PointType>::Ptr laserCloudSurfLast;			// surf feature set from odoOptimization
+	pcl::PointCloud<PointType>::Ptr laserCloudCornerLastDS; // downsampled corner featuer set from odoOptimization
+	pcl::PointCloud<PointType>::Ptr laserCloudSurfLastDS;		// downsampled surf featuer set from odoOptimization
+
+
+	LRUCache<int, TransformedKeyFrame> laserCloudMapContainer; // bounded by keyframeCacheBudget
+	pcl::PointCloud<PointType>::Ptr laserCloudCornerFromMapDS;
+	pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS;
+
+	VoxelLocalMap<PointType> localCornerMap; // incrementally maintained surrounding map, replaces re-voxelizing every scan
+	VoxelLocalMap<PointType> localSurfMap;
+	bool localMapChanged = false;			 // local map differs from the one the map kd-trees were built on
+	bool localMapNeedsRebuild = false; // key poses were corrected, every keyframe has to be re-projected
+	int kdtreeSurroundingKeyPosesSize = 0;
+
+	VoxelChunkMap<PointType> globalVizMap;			 // global map visualization, see publishGlobalMap
+	std::unordered_set<int64_t> globalVizPoseVoxels; // key pose voxels that already have a keyframe in globalVizMap
+	std::vector<int64_t> globalVizVisibleChunks;		 // chunks of the last published map_global
+	int globalVizMapKeyFrames = 0;									 // keyframes handled by globalVizMap so far
+	bool globalVizMapNeedsRebuild = false;					 // set by correctPoses, guarded by mtx
+
+	// the per-scan path searches and filters without allocating, see CloudKdTree and VoxelFilter
+	CloudKdTree<PointType> kdtreeCornerFromMap;
+	CloudKdTree<PointType> kdtreeSurfFromMap;
+
+	CloudKdTree<PointType> kdtreeSurroundingKeyPoses;
+	pcl::KdTreeFLANN<PointType>::Ptr kdtreeHistoryKeyPoses;
+
+	VoxelFilter<PointType> downSizeFilterSC; // giseop
+	VoxelFilter<PointType> downSizeFilterCorner;
+	VoxelFilter<PointType> downSizeFilterSurf;
+	pcl::VoxelGrid<PointType> downSizeFilterICP;
+	VoxelFilter<PointType> downSizeFilterSurroundingKeyPoses; // for surrounding key poses of scan-to-map optimization
+
+	// scratch of extractNearby / extractCloud / publishFrames, reused so that their capacity is kept between scans
+	pcl::PointCloud<PointType>::Ptr surroundingKeyPoses;
+	pcl::PointCloud<PointType>::Ptr surroundingKeyPosesDS;
+	std::vector<std::pair<int, float>> surroundingKeyPosesSearch;
+	std::vector<int> keysToExtract;
+	std::vector<int> localMapKeys;
+	pcl::PointCloud<PointType>::Ptr registeredScan;
+
+	ros::Time timeLaserInfoStamp;
+	double timeLaserInfoCur;
+
+	float transformTobeMapped[6];
+
+	std::mutex mtx;
+	std::mutex mtxLoopInfo;
+
+	bool isDegenerate = false;
+	Eigen::Matrix<float, 6, 6> matP;
+
+	int laserCloudCornerFromMapDSNum = 0;
+	int laserCloudSurfFromMapDSNum = 0;
+	int laserCloudCornerLastDSNum = 0;
+	int laserCloudSurfLastDSNum = 0;
+
+	bool aLoopIsClosed = false;
+	// map<int, int> loopIndexContainer; // from new to old
+	multimap<int, int> loopIndexContainer; // from new to old // giseop
+
+	vector<pair<int, int>> loopIndexQueue;
+	vector<gtsam::Pose3> loopPoseQueue;
+	// vector<gtsam::noiseModel::Diagonal::shared_ptr> loopNoiseQueue; // Diagonal <- Gausssian <- Base
+	vector<gtsam::SharedNoiseModel> loopNoiseQueue; // giseop for polymorhpisam (Diagonal <- Gausssian <- Base)
+	// prior-session loops: keyframe and its pose in the prior session's map frame, added as prior factors
+	vector<pair<int, gtsam::Pose3>> priorLoopQueue;
+	vector<gtsam::SharedNoiseModel> priorLoopNoiseQueue;
+
+	deque<std_msgs::Float64MultiArray> loopInfoVec;
+
+	nav_msgs::Path globalPath;
+
+	Eigen::Affine3f transPointAssociateToMap;
+	Eigen::Affine3f incrementalOdometryAffineFront;
+	Eigen::Affine3f incrementalOdometryAffineBack;
+
+	// loop detector
+	SCManager scManager;
+	// loop candidate verification (ICP, GICP or NDT, see loopRegistrationMethod)
+	std::unique_ptr<LoopRegistration<PointType>> loopRegistration;
+	uint64_t poseGeneration = 0; // incremented whenever correctPoses moves the key poses, guarded by mtx
+	// downsampled loop target submaps by loopTargetKey, bounded by loopSubmapCacheBudget; loop thread only
+	LRUCache<int64_t, pcl::PointCloud<PointType>::Ptr> loopSubmapCache;
+	uint64_t loopCacheGeneration = 0; // poseGeneration the cached submaps were built with
+
+	// data saver
+	std::fstream pgSaveStream;		 // pg: pose-graph
+	std::fstream pgTimeSaveStream; // pg: pose-graph
+	std::vector<std::string> edges_str;
+	std::vector<std::string> vertices_str;
+	// std::fstream pgVertexSaveStream;
+	// std::fstream pgEdgeSaveStream;
+
+	std::string saveSCDDirectory;
+	std::string saveNodePCDDirectory;
+	std::unique_ptr<AsyncWriter> keyframeWriter; // SCD and node PCD files, written off the mapping thread
+	std::unique_ptr<SessionFileWriter> sessionFile; // saveSessionFile: replaces the SCD, node PCD and g2o outputs; written by keyframeWriter only
+	uint64_t sessionEdgeCount = 0;
+
+	// isamBackEndThread: the mapping thread queues each keyframe's new factors, the back-end thread commits them to isam
+	struct BackEndJob
+	{
+		NonlinearFactorGraph graph;
+		Values values;
+		bool loopClosed = false; // loop or GPS factors among them
+		int key = 0;			 // the keyframe they were added for
+	};
+	struct BackEndResult
+	{
+		int key = 0;
+		bool loopClosed = false;
+		Pose3 latest;			  // estimate of key
+		Values estimate;		  // the full trajectory, only if loopClosed (or not isamBatchedUpdates)
+		bool hasCovariance = false;
+		Eigen::MatrixXd covariance; // marginal covariance of key, if requested
+	};
+	std::mutex backEndMtx; // guards backEndJobs, backEndResults and backEndStop
+	std::condition_variable backEndCondition;
+	std::deque<BackEndJob> backEndJobs;
+	std::deque<BackEndResult> backEndResults; // applied by the mapping thread, see applyBackEndResults
+	bool backEndStop = false;
+	std::atomic<bool> backEndCovarianceRequested{false};
+	std::thread backEndWorker;
+
+	// loadSessionDirectory: the session the first keyframe is relocalized in (warm start), see relocalizeInPriorSession,
+	// and later keyframes are closed against (performPriorSessionLoopClosure)
+	std::unique_ptr<PriorSession<PointType>> priorSession;
+	int relocalizationFailures = 0;
+	int priorLoopLastKey = -1; // the last keyframe queried in the prior session; loop thread only
+
+	// overloadScheduling: decimation and coarser matching of the scans while the mapping cannot keep up, see applyOverloadLevel
+	OverloadScheduler overloadScheduler;
+
+	// localizationMode: the pre-built map scans are matched against, and whether the current pose is in its frame yet
+	TiledMap<PointType> localizationCornerMap;
+	TiledMap<PointType> localizationSurfMap;
+	bool localizationTracking = false;
+
+	uint64_t scanAllocations = 0; // heap allocations of the omp workers in the scan-to-map path of the current scan
+
+public:
+	mapOptimization()
+	{
+		ISAM2Params parameters;
+		parameters.relinearizeThreshold = 0.1;
+		parameters.relinearizeSkip = 1;
+		isam = new ISAM2(parameters);
+
+		pubKeyPoses = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/trajectory", 1);					 // 关键帧位姿点云
+		pubLaserCloudSurround = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/map_global", 1, true); // 发布优化后的全局地图 (latched, only published when it changed)
+		pubGlobalMapUpdates = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/map_global_updates", 10); // changed chunks of map_global only
+		pubLaserOdometryGlobal = nh.advertise<nav_msgs::Odometry>("lio_sam/mapping/odometry", 1);				 // 发布激光里程计
+		pubLaserOdometryIncremental = nh.advertise<nav_msgs::Odometry>("lio_sam/mapping/odometry_incremental", 1);
+		pubPath = nh.advertise<nav_msgs::Path>("lio_sam/mapping/path", 1); // 发布优化后的全局轨迹
+
+		subCloud = nh.subscribe<lio_sam::cloud_info>("lio_sam/feature/cloud_info", 1, &mapOptimization::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
+		subGPS = nh.subscribe<nav_msgs::Odometry>(gpsTopic, 200, &mapOptimization::gpsHandler, this, ros::TransportHints().tcpNoDelay());
+		subLoop = nh.subscribe<std_msgs::Float64MultiArray>("lio_loop/loop_closure_detection", 1, &mapOptimization::loopInfoHandler, this, ros::TransportHints().tcpNoDelay());
+
+		pubHistoryKeyFrames = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/icp_loop_closure_history_cloud", 1);
+		pubIcpKeyFrames = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/icp_loop_closure_corrected_cloud", 1);
+		pubLoopConstraintEdge = nh.advertise<visualization_msgs::MarkerArray>("/lio_sam/mapping/loop_closure_constraints", 1);
+
+		pubRecentKeyFrames = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/map_local", 1);
+		pubRecentKeyFrame = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/cloud_registered", 1);
+		pubCloudRegisteredRaw = nh.advertise<sensor_msgs::PointCloud2>("lio_sam/mapping/cloud_registered_raw", 1);
+		pubMetrics = nh.advertise<diagnostic_msgs::DiagnosticArray>("lio_sam/mapping/metrics", 1);
+
+		const float kSCFilterSize = 0.5;																					 // giseop
+		downSizeFilterSC.setLeafSize(kSCFilterSize, kSCFilterSize, kSCFilterSize); // giseop
+
+		downSizeFilterCorner.setLeafSize(mappingCornerLeafSize, mappingCornerLeafSize, mappingCornerLeafSize);
+		downSizeFilterSurf.setLeafSize(mappingSurfLeafSize, mappingSurfLeafSize, mappingSurfLeafSize);
+		downSizeFilterICP.setLeafSize(mappingSurfLeafSize, mappingSurfLeafSize, mappingSurfLeafSize);
+		overloadScheduler.configure(overloadScheduling, overloadLatencyBudget, overloadMaxScanAge, overloadMaxLevel);
+		downSizeFilterSurroundingKeyPoses.setLeafSize(surroundingKeyframeDensity, surroundingKeyframeDensity, surroundingKeyframeDensity); // for surrounding key poses of scan-to-map optimization
+		laserCloudMapContainer.setBudget(size_t(keyframeCacheBudget * 1024 * 1024));
+		keyFrameStore.setBudget(size_t(keyframeMemoryBudget * 1024 * 1024), keyframeResidentRecent, savePCDDirectory + "keyframes.spill");
+		loopSubmapCache.setBudget(size_t(loopSubmapCacheBudget * 1024 * 1024));
+		loopRegistration = LoopRegistration<PointType>::create(loopRegistrationMethod, loopRegistrationMaxCorrespondenceDistance, 100,
+																													 size_t(loopRegistrationCacheBudget * 1024 * 1024));
+		if (localizationMode)
+			loadLocalizationMap();
+		if (!loadSessionDirectory.empty())
+			loadPriorSession();
+		localCornerMap.setLeafSize(mappingCornerLeafSize);
+		localSurfMap.setLeafSize(mappingSurfLeafSize);
+		globalVizMap.setLeafSize(globalMapVisualizationLeafSize);
+		globalVizMap.setChunkSize(globalMapVisualizationChunkSize);
+
+		allocateMemory();
+
+		pcl::console::setVerbosityLevel(pcl::console::L_ERROR);
+
+		// giseop
+		// create directory and remove old files;
+		// savePCDDirectory = std::getenv("HOME") + savePCDDirectory; // rather use global path
+		// localizationMode saves nothing, and savePCDDirectory may well be the map it localizes in, so it is left alone
+		if (localizationMode == false)
+		{
+			int unused = system((std::string("exec rm -r ") + savePCDDirectory).c_str());
+			unused = system((std::string("mkdir ") + savePCDDirectory).c_str());
+
+			saveSCDDirectory = savePCDDirectory + "SCDs/"; // SCD: scan context descriptor
+			unused = system((std::string("exec rm -r ") + saveSCDDirectory).c_str());
+			unused = system((std::string("mkdir -p ") + saveSCDDirectory).c_str());
+
+			saveNodePCDDirectory = savePCDDirectory + "Scans/";
+			unused = system((std::string("exec rm -r ") + saveNodePCDDirectory).c_str());
+			unused = system((std::string("mkdir -p ") + saveNodePCDDirectory).c_str());
+
+			pgSaveStream = std::fstream(savePCDDirectory + "singlesession_posegraph.g2o", std::fstream::out);
+			pgTimeSaveStream = std::fstream(savePCDDirectory + "times.txt", std::fstream::out);
+			pgTimeSaveStream.precision(dbl::max_digits10);
+		}
+		// pgVertexSaveStream = std::fstream(savePCDDirectory + "singlesession_vertex.g2o", std::fstream::out);
+		// pgEdgeSaveStream = std::fstream(savePCDDirectory + "singlesession_edge.g2o", std::fstream::out);
+
+		keyframeWriter.reset(new AsyncWriter(keyframeWriterQueueSize));
+
+		if (saveSessionFile && localizationMode == false)
+		{
+			sessionFile.reset(new SessionFileWriter());
+			if (sessionFile->open(savePCDDirectory + "session.bin", sessionFileCompression) == false)
+			{
+				ROS_ERROR("Can not write %ssession.bin, saving SCDs and node PCDs instead.", savePCDDirectory.c_str());
+				sessionFile.reset();
+			}
+		}
+
+		if (isamBackEndThread && localizationMode == false)
+			backEndWorker = std::thread(&mapOptimization::backEndThread, this);
+	}
+
+	~mapOptimization()
+	{
+		stopBackEnd();
+
+		// pending jobs read descriptors owned by scManager, so write them out before any member is destroyed
+		size_t pending = keyframeWriter->pending();
+		if (pending > 0)
+			cout << "Flushing " << pending << " pending keyframe writes ..." << endl;
+		keyframeWriter->stop();
+		if (sessionFile)
+		{
+			cout << "Session file: " << sessionFile->bytesWritten() << " bytes" << endl;
+			sessionFile->close();
+		}
+
+		AsyncWriter::Stats stats = keyframeWriter->stats();
+		cout << "Keyframe writer: " << stats.written << " files, max queue depth " << stats.max_depth
+			 << ", " << stats.blocked_pushes << " blocked pushes (" << stats.blocked_ms << " ms)" << endl;
+	}
+
+	void allocateMemory()
+	{
+		cloudKeyPoses3D.reset(new pcl::PointCloud<PointType>());
+		cloudKeyPoses6D.reset(new pcl::PointCloud<PointTypePose>());
+		copy_cloudKeyPoses3D.reset(new pcl::PointCloud<PointType>());
+		copy_cloudKeyPoses2D.reset(new pcl::PointCloud<PointType>());
+		copy_cloudKeyPoses6D.reset(new pcl::PointCloud<PointTypePose>());
+
+		kdtreeHistoryKeyPoses.reset(new pcl::KdTreeFLANN<PointType>());
+
+		laserCloudRaw.reset(new pcl::PointCloud<PointType>());	 // giseop
+		laserCloudRawDS.reset(new pcl::PointCloud<PointType>()); // giseop
+
+		laserCloudCornerLast.reset(new pcl::PointCloud<PointType>());		// corner feature set from odoOptimization
+		laserCloudSurfLast.reset(new pcl::PointCloud<PointType>());			// surf feature set from odoOptimization
+		laserCloudCornerLastDS.reset(new pcl::PointCloud<PointType>()); // downsampled corner featuer set from odoOptimization
+		laserCloudSurfLastDS.reset(new pcl::PointCloud<PointType>());		// downsampled surf featuer set from odoOptimization
+
+		laserCloudCornerFromMapDS.reset(new pcl::PointCloud<PointType>());
+		laserCloudSurfFromMapDS.reset(new pcl::PointCloud<PointType>());
+
+		surroundingKeyPoses.reset(new pcl::PointCloud<PointType>());
+		surroundingKeyPosesDS.reset(new pcl::PointCloud<PointType>());
+		registeredScan.reset(new pcl::PointCloud<PointType>());
+
+		for (int i = 0; i < 6; ++i)
+		{
+			transformTobeMapped[i] = 0;
+		}
+
+		matP.setZero();
+	}
+
+	static SessionPose toSessionPose(const gtsam::Pose3 &_pose)
+	{
+		gtsam::Point3 t = _pose.translation();
+		gtsam::Quaternion q = _pose.rotation().toQuaternion();
+		return SessionPose{t.x(), t.y(), t.z(), q.x(), q.y(), q.z(), q.w()};
+	}
+
+	void writeVertex(const int _node_idx, const gtsam::Pose3 &_initPose)
+	{
+		if (sessionFile)
+		{
+			SessionPose pose = toSessionPose(_initPose);
+			pushKeyframeWrite([this, _node_idx, pose]() { sessionFile->append(SESSION_VERTEX, _node_idx, &pose, sizeof(pose)); });
+			return;
+		}
+
+		gtsam::Point3 t = _initPose.translation();
+		gtsam::Rot3 R = _initPose.rotation();
+
+		std::string curVertexInfo{
+				"VERTEX_SE3:QUAT " + std::to_string(_node_idx) + " " + std::to_string(t.x()) + " " + std::to_string(t.y()) + " " + std::to_string(t.z()) + " " + std::to_string(R.toQuaternion().x()) + " " + std::to_string(R.toQuaternion().y()) + " " + std::to_string(R.toQuaternion().z()) + " " + std::to_string(R.toQuaternion().w())};
+
+		// pgVertexSaveStream << curVertexInfo << std::endl;
+		vertices_str.emplace_back(curVertexInfo);
+	}
+
+	void writeEdge(const std::pair<int, int> _node_idx_pair, const gtsam::Pose3 &_relPose)
+	{
+		if (sessionFile)
+		{
+			SessionEdge edge{_node_idx_pair.first, _node_idx_pair.second, toSessionPose(_relPose)};
+			uint64_t key = sessionEdgeCount++;
+			pushKeyframeWrite([this, key, edge]() { sessionFile->append(SESSION_EDGE, key, &edge, sizeof(edge)); });
+			return;
+		}
+
+		gtsam::Point3 t = _relPose.translation();
+		gtsam::Rot3 R = _relPose.rotation();
+
+		std::string curEdgeInfo{
+				"EDGE_SE3:QUAT " + std::to_string(_node_idx_pair.first) + " " + std::to_string(_node_idx_pair.second) + " " + std::to_string(t.x()) + " " + std::to_string(t.y()) + " " + std::to_string(t.z()) + " " + std::to_string(R.toQuaternion().x()) + " " + std::to_string(R.toQuaternion().y()) + " " + std::to_string(R.toQuaternion().z()) + " " + std::to_string(R.toQuaternion().w())};
+
+		// pgEdgeSaveStream << curEdgeInfo << std::endl;
+		edges_str.emplace_back(curEdgeInfo);
+	}
+
+	// void writeEdgeStr(const std::pair<int, int> _node_idx_pair, const gtsam::Pose3& _relPose, const gtsam::SharedNoiseModel _noise)
+	// {
+	//     gtsam::Point3 t = _relPose.translation();
+	//     gtsam::Rot3 R = _relPose.rotation();
+
+	//     std::string curEdgeSaveStream;
+	//     curEdgeSaveStream << "EDGE_SE3:QUAT " << _node_idx_pair.first << " " << _node_idx_pair.second << " "
+	//         << t.x() << " "  << t.y() << " " << t.z()  << " "
+	//         << R.toQuaternion().x() << " " << R.toQuaternion().y() << " " << R.toQuaternion().z()  << " " << R.toQuaternion().w() << std::endl;
+
+	//     edges_str.emplace_back(curEdgeSaveStream);
+	// }
+	/**
+	 * 订阅当前激光帧点云信息，来自featureExtraction
+	 * 1、当前帧位姿初始化
+	 *   1) 如果是第一帧，用原始imu数据的RPY初始化当前帧位姿（旋转部分）
+	 *   2) 后续帧，用imu里程计计算两帧之间的增量位姿变换，作用于前一帧的激光位姿，得到当前帧激光位姿
+	 * 2、提取局部角点、平面点云集合，加入局部map
+	 *   1) 对最近的一帧关键帧，搜索时空维度上相邻的关键帧集合，降采样一下
+	 *   2) 对关键帧集合中的每一帧，提取对应的角点、平面点，加入局部map中
+	 * 3、当前激光帧角点、平面点集合降采样
+	 * 4、scan-to-map优化当前帧位姿
+	 *   (1) 要求当前帧特征点数量足够多，且匹配的点数够多，才执行优化
+	 *   (2) 迭代30次（上限）优化
+	 *      1) 当前激光帧角点寻找局部map匹配点
+	 *          a.更新当前帧位姿，将当前帧角点坐标变换到map系下，在局部map中查找5个最近点，距离小于1m，且5个点构成直线（用距离中心点的协方差矩阵，特征值进行判断），则认为匹配上了
+	 *          b.计算当前帧角点到直线的距离、垂线的单位向量，存储为角点参数
+	 *      2) 当前激光帧平面点寻找局部map匹配点
+	 *          a.更新当前帧位姿，将当前帧平面点坐标变换到map系下，在局部map中查找5个最近点，距离小于1m，且5个点构成平面（最小二乘拟合平面），则认为匹配上了
+	 *          b.计算当前帧平面点到平面的距离、垂线的单位向量，存储为平面点参数
+	 *      3) 提取当前帧中与局部map匹配上了的角点、平面点，加入同一集合
+	 *      4) 对匹配特征点计算Jacobian矩阵，观测值为特征点到直线、平面的距离，构建高斯牛顿方程，迭代优化当前位姿，存latestPose6D
+	 *   (3)用imu原始RPY数据与scan-to-map优化后的位姿进行加权融合，更新当前帧位姿的roll、pitch，约束z坐标
+	 * 5、设置当前帧为关键帧并执行因子图优化
+	 *   1) 计算当前帧与前一帧位姿变换，如果变化太小，不设为关键帧，反之设为关键帧
+	 *   2) 添加激光里程计因子、GPS因子、闭环因子
+	 *   3) 执行因子图优化
+	 *   4) 得到当前帧优化后位姿，位姿协方差
+	 *   5) 添加keyPoses3D，keyPoses6D，更新latestPose6D，添加当前关键帧的角点、平面点集合
+	 * 6、更新因子图中所有变量节点的位姿，也就是所有历史关键帧的位姿，更新里程计轨迹
+	 * 7、发布激光里程计
+	 * 8、发布里程计、点云、轨迹
+	 */
+	void laserCloudInfoHandler(const lio_sam::cloud_infoConstPtr &msgIn)
+	{
+		// overloadScheduling: a stale scan is dropped, the newest one is waiting behind it
+		const double scanAge = (ros::Time::now() - msgIn->header.stamp).toSec();
+		if (overloadScheduler.accept(scanAge) == false)
+		{
+			Metrics::instance().record("mapping/dropped_scan_age_ms", scanAge * 1000.0);
+			return;
+		}
+
+		// extract time stamp
+		timeLaserInfoStamp = msgIn->header.stamp;
+		timeLaserInfoCur = msgIn->header.stamp.toSec();
+
+		// extract info and feature cloud
+		cloudInfo = *msgIn;
+		pcl::fromROSMsg(msgIn->cloud_corner, *laserCloudCornerLast);
+		pcl::fromROSMsg(msgIn->cloud_surface, *laserCloudSurfLast);
+		pcl::fromROSMsg(msgIn->cloud_deskewed, *laserCloudRaw); // giseop
+		laserCloudRawTime = cloudInfo.header.stamp.toSec();			// giseop save node time
+
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (isamBackEndThread)
+			applyBackEndResults();
+
+		static double timeLastProcessing = -1;
+		if (timeLaserInfoCur - timeLastProcessing >= mappingProcessInterval * overloadScheduler.intervalScale())
+		{
+			TRACE_SPAN("mapping/scan_ms");
+			timeLastProcessing = timeLaserInfoCur;
+			const auto processingBegin = std::chrono::steady_clock::now();
+
+			updateInitialGuess();
+
+			// warm start: the first keyframe is placed in the prior session's map frame if it can be relocalized there
+			if (priorSession && poseInitialized() == false && relocalizeInPriorSession() == false)
+			{
+				if (++relocalizationFailures < relocalizationAttempts)
+					return;
+				ROS_WARN("Relocalization in %s failed %d times, mapping in a new map frame.", priorSession->directory().c_str(), relocalizationFailures);
+				priorSession.reset();
+			}
+
+			const uint64_t allocationsBefore = threadAllocationCount();
+			scanAllocations = 0;
+
+			// localization only: no keyframes, descriptors, loop closures or factor graph, the scan is matched against the pre-built map
+			if (localizationMode)
+			{
+				localizationTracking = true;
+
+				downsampleCurrentScan();
+
+				scan2MapOptimization();
+
+				recordScanAllocations(allocationsBefore);
+
+				publishOdometry();
+				recordScanLatency();
+				updateOverloadLevel(processingBegin);
+
+				publishFrames();
+				return;
+			}
+
+			extractSurroundingKeyFrames();
+
+			downsampleCurrentScan();
+
+			scan2MapOptimization();
+
+			recordScanAllocations(allocationsBefore);
+
+			saveKeyFramesAndFactor();
+
+			correctPoses();
+
+			publishOdometry();
+			recordScanLatency();
+			updateOverloadLevel(processingBegin);
+
+			publishFrames();
+		}
+	}
+
+	void gpsHandler(const nav_msgs::Odometry::ConstPtr &gpsMsg)
+	{
+		gpsQueue.push_back(*gpsMsg);
+	}
+
+	// heap allocations of this scan from extracting the local map to the end of scan2MapOptimization, on the mapping thread and
+	// the omp workers; 0 in steady state, i.e., while no keyframe enters or leaves the local map (COUNT_ALLOCATIONS builds only)
+	void recordScanAllocations(uint64_t mappingThreadBefore)
+	{
+#ifdef LIO_SAM_COUNT_ALLOCATIONS
+		Metrics::instance().record("mapping/scan_allocations", double(threadAllocationCount() - mappingThreadBefore + scanAllocations));
+#endif
+	}
+
+	// end-to-end latency of the scan, from its time stamp (the lidar driver) to the odometry being published
+	void recordScanLatency()
+	{
+		Metrics::instance().record("mapping/scan_latency_ms", (ros::Time::now() - timeLaserInfoStamp).toSec() * 1000.0);
+	}
+
+	// overloadScheduling: feeds the scan's processing time (up to its odometry) and latency to the scheduler
+	void updateOverloadLevel(std::chrono::steady_clock::time_point processingBegin)
+	{
+		if (overloadScheduler.enabled() == false)
+			return;
+
+		const double processingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - processingBegin).count();
+		const double latency = (ros::Time::now() - timeLaserInfoStamp).toSec();
+		if (overloadScheduler.update(processingTime, latency, mappingProcessInterval))
+			applyOverloadLevel();
+		Metrics::instance().record("mapping/overload_level", overloadScheduler.level());
+	}
+
+	// the scan voxel leaves of the level; the process interval, LM iterations and keyframe thresholds are read where they are used
+	void applyOverloadLevel()
+	{
+		const float cornerLeaf = mappingCornerLeafSize * overloadScheduler.leafScale();
+		const float surfLeaf = mappingSurfLeafSize * overloadScheduler.leafScale();
+		downSizeFilterCorner.setLeafSize(cornerLeaf, cornerLeaf, cornerLeaf);
+		downSizeFilterSurf.setLeafSize(surfLeaf, surfLeaf, surfLeaf);
+		ROS_WARN("Mapping overload level %d: every %.2f s, leaves %.2f / %.2f m, %d LM iterations.", overloadScheduler.level(),
+						 mappingProcessInterval * overloadScheduler.intervalScale(), cornerLeaf, surfLeaf, overloadScheduler.maxIterations(30));
+	}
+
+	// the current pose is in the map frame: there is a keyframe, or in localizationMode a scan was matched
+	bool poseInitialized()
+	{
+		if (localizationMode)
+			return localizationTracking;
+		return !cloudKeyPoses3D->points.empty();
+	}
+
+	void pointAssociateToMap(PointType const *const pi, PointType *const po)
+	{
+		po->x = transPointAssociateToMap(0, 0) * pi->x + transPointAssociateToMap(0, 1) * pi->y + transPointAssociateToMap(0, 2) * pi->z + transPointAssociateToMap(0, 3);
+		po->y = transPointAssociateToMap(1, 0) * pi->x + transPointAssociateToMap(1, 1) * pi->y + transPointAssociateToMap(1, 2) * pi->z + transPointAssociateToMap(1, 3);
+		po->z = transPointAssociateToMap(2, 0) * pi->x + transPointAssociateToMap(2, 1) * pi->y + transPointAssociateToMap(2, 2) * pi->z + transPointAssociateToMap(2, 3);
+		po->intensity = pi->intensity;
+	}
+
+	pcl::PointCloud<PointType>::Ptr transformPointCloud(pcl::PointCloud<PointType>::Ptr cloudIn, PointTypePose *transformIn)
+	{
+		pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
+		transformPointCloud(*cloudIn, transformIn, *cloudOut);
+		return cloudOut;
+	}
+
+	// into cloudOut (resized to cloudIn, so a reused cloud keeps its capacity); cloudIn and cloudOut may be the same cloud
+	void transformPointCloud(const pcl::PointCloud<PointType> &cloudIn, PointTypePose *transformIn, pcl::PointCloud<PointType> &cloudOut)
+	{
+		int cloudSize = cloudIn.size();
+		cloudOut.resize(cloudSize);
+
+		Eigen::Affine3f transCur = pcl::getTransformation(transformIn->x, transformIn->y, transformIn->z, transformIn->roll, transformIn->pitch, transformIn->yaw);
+
+#pragma omp parallel for num_threads(numberOfCores)
+		for (int i = 0; i < cloudSize; ++i)
+		{
+			const PointType pointFrom = cloudIn.points[i];
+			cloudOut.points[i].x = transCur(0, 0) * pointFrom.x + transCur(0, 1) * pointFrom.y + transCur(0, 2) * pointFrom.z + transCur(0, 3);
+			cloudOut.points[i].y = transCur(1, 0) * pointFrom.x + transCur(1, 1) * pointFrom.y + transCur(1, 2) * pointFrom.z + transCur(1, 3);
+			cloudOut.points[i].z = transCur(2, 0) * pointFrom.x + transCur(2, 1) * pointFrom.y + transCur(2, 2) * pointFrom.z + transCur(2, 3);
+			cloudOut.points[i].intensity = pointFrom.intensity;
+		}
+	}
+
+	gtsam::Pose3 pclPointTogtsamPose3(PointTypePose thisPoint)
+	{
+		return gtsam::Pose3(gtsam::Rot3::RzRyRx(double(thisPoint.roll), double(thisPoint.pitch), double(thisPoint.yaw)),
+												gtsam::Point3(double(thisPoint.x), double(thisPoint.y), double(thisPoint.z)));
+	}
+
+	gtsam::Pose3 trans2gtsamPose(float transformIn[])
+	{
+		return gtsam::Pose3(gtsam::Rot3::RzRyRx(transformIn[0], transformIn[1], transformIn[2]),
+												gtsam::Point3(transformIn[3], transformIn[4], transformIn[5]));
+	}
+
+	Eigen::Affine3f pclPointToAffine3f(PointTypePose thisPoint)
+	{
+		return pcl::getTransformation(thisPoint.x, thisPoint.y, thisPoint.z, thisPoint.roll, thisPoint.pitch, thisPoint.yaw);
+	}
+
+	Eigen::Affine3f trans2Affine3f(float transformIn[])
+	{
+		return pcl::getTransformation(transformIn[3], transformIn[4], transformIn[5], transformIn[0], transformIn[1], transformIn[2]);
+	}
+
+	PointTypePose trans2PointTypePose(float transformIn[])
+	{
+		PointTypePose thisPose6D;
+		thisPose6D.x = transformIn[3];
+		thisPose6D.y = transformIn[4];
+		thisPose6D.z = transformIn[5];
+		thisPose6D.roll = transformIn[0];
+		thisPose6D.pitch = transformIn[1];
+		thisPose6D.yaw = transformIn[2];
+		return thisPose6D;
+	}
+
+	void visualizeGlobalMapThread()
+	{
+		//
+		ros::Rate rate(0.2);
+		while (ros::ok())
+		{
+			rate.sleep();
+			publishGlobalMap();
+		}
+
+		// localizationMode inserts no keyframes, there is nothing to save
+		if (savePCD == false || localizationMode)
+			return;
+
+		flushBackEnd(); // the saved key poses, map tiles and optimized_poses.txt are all the final estimate
+
+		// save pose graph (runs when programe is closing)
+		cout << "****************************************************" << endl;
+		cout << "Saving the posegraph ..." << endl; // giseop
+
+		for (auto &_line : vertices_str)
+			pgSaveStream << _line << std::endl;
+		for (auto &_line : edges_str)
+			pgSaveStream << _line << std::endl;
+
+		pgSaveStream.close();
+		// pgVertexSaveStream.close();
+		// pgEdgeSaveStream.close();
+
+		const std::string kitti_format_pg_filename{savePCDDirectory + "optimized_poses.txt"};
+		saveOptimizedVerticesKITTIformat(isamCurrentEstimate, kitti_format_pg_filename);
+		if (sessionFile)
+		{
+			for (const auto &key_value : isamCurrentEstimate)
+			{
+				auto p = dynamic_cast<const GenericValue<Pose3> *>(&key_value.value);
+				if (!p)
+					continue;
+				SessionPose pose = toSessionPose(p->value());
+				uint64_t key = key_value.key;
+				pushKeyframeWrite([this, key, pose]() { sessionFile->append(SESSION_OPTIMIZED_POSE, key, &pose, sizeof(pose)); });
+			}
+		}
+
+		// save map
+		cout << "****************************************************" << endl;
+		cout << "Saving map to pcd files ..." << endl;
+		// save key frame transformations
+		pcl::io::savePCDFileBinary(savePCDDirectory + "trajectory.pcd", *cloudKeyPoses3D);
+		pcl::io::savePCDFileBinary(savePCDDirectory + "transformations.pcd", *cloudKeyPoses6D);
+		// extract, down-sample and save the global point cloud map, tile by tile
+		exportGlobalMapTiles();
+		cout << "****************************************************" << endl;
+		cout << "Saving map to pcd files completed" << endl;
+	}
+
+	/*
+	 * Streams the global map to cloudCorner.pcd / cloudSurf.pcd (down-sampled) and cloudGlobal.pcd (all feature points).
+	 * The map is split into globalMapExportTileSize x globalMapExportTileSize cells on the xy plane. Each keyframe is read
+	 * and transformed once (a batch of keyframes in parallel) and its points are binned by tile into a spill file; then
+	 * each tile is gathered, voxelized on its own and appended to the output files, so only one tile is in memory at a time.
+	 */
+	void exportGlobalMapTiles()
+	{
+		// the configured leaves, not the ones of the last overload level
+		downSizeFilterCorner.setLeafSize(mappingCornerLeafSize, mappingCornerLeafSize, mappingCornerLeafSize);
+		downSizeFilterSurf.setLeafSize(mappingSurfLeafSize, mappingSurfLeafSize, mappingSurfLeafSize);
+
+		const int numKeyFrames = cloudKeyPoses6D->size();
+		const float tileSize = globalMapExportTileSize;
+		auto tileIndex = [tileSize](const PointType &pt) { return std::make_pair(int(std::floor(pt.x / tileSize)), int(std::floor(pt.y / tileSize))); };
+
+		TileSpill<PointType> tileSpill;
+		if (tileSpill.open(savePCDDirectory + "mapTiles.spill") == false)
+			ROS_WARN("Cannot create %smapTiles.spill, keeping the map tiles in memory.", savePCDDirectory.c_str());
+
+		// a batch of keyframes binned in parallel, then appended in keyframe order (the tiles keep the keyframe order)
+		using TileBins = std::map<std::pair<int, int>, std::pair<pcl::PointCloud<PointType>, pcl::PointCloud<PointType>>>; // tile -> corner, surf
+		const int batchSize = 4 * numberOfCores;
+		std::vector<TileBins> bins(batchSize);
+		for (int batchStart = 0; batchStart < numKeyFrames; batchStart += batchSize)
+		{
+			const int batchEnd = std::min(numKeyFrames, batchStart + batchSize);
+#pragma omp parallel for num_threads(numberOfCores) schedule(dynamic)
+			for (int key = batchStart; key < batchEnd; ++key)
+			{
+				TileBins &keyBins = bins[key - batchStart];
+				keyBins.clear();
+				KeyFrameStore<PointType>::KeyFrame keyFrame = keyFrameStore.get(key);
+				pcl::PointCloud<PointType> transformed;
+				transformPointCloud(*keyFrame.corner, &cloudKeyPoses6D->points[key], transformed);
+				for (const auto &pt : transformed.points)
+					keyBins[tileIndex(pt)].first.push_back(pt);
+				transformPointCloud(*keyFrame.surf, &cloudKeyPoses6D->points[key], transformed);
+				for (const auto &pt : transformed.points)
+					keyBins[tileIndex(pt)].second.push_back(pt);
+			}
+
+			for (int key = batchStart; key < batchEnd; ++key)
+			{
+				for (const auto &bin : bins[key - batchStart])
+					tileSpill.append(bin.first, bin.second.first, bin.second.second);
+				bins[key - batchStart].clear();
+			}
+			cout << "\r" << std::flush << "Binning keyframe " << batchEnd << " of " << numKeyFrames << " ...";
+		}
+		cout << endl;
+
+		PCDStreamWriter cornerWriter, surfWriter, globalWriter;
+		cornerWriter.open(savePCDDirectory + "cloudCorner.pcd");
+		surfWriter.open(savePCDDirectory + "cloudSurf.pcd");
+		globalWriter.open(savePCDDirectory + "cloudGlobal.pcd");
+
+		int tileCount = 0;
+		const size_t numTiles = tileSpill.numTiles();
+		auto exportTile = [&](const std::pair<int, int> &, const pcl::PointCloud<PointType>::Ptr &tileCorner, const pcl::PointCloud<PointType>::Ptr &tileSurf)
+		{
+			globalWriter.append(*tileCorner);
+			globalWriter.append(*tileSurf);
+
+			// down-sample and save this tile of the corner and surf clouds
+			pcl::PointCloud<PointType> tileCornerDS, tileSurfDS;
+			downSizeFilterCorner.setInputCloud(tileCorner);
+			downSizeFilterCorner.filter(tileCornerDS);
+			cornerWriter.append(tileCornerDS);
+			downSizeFilterSurf.setInputCloud(tileSurf);
+			downSizeFilterSurf.filter(tileSurfDS);
+			surfWriter.append(tileSurfDS);
+
+			cout << "\r" << std::flush << "Processing map tile " << ++tileCount << " of " << numTiles << " ...";
+		};
+		tileSpill.forEachTile(exportTile);
+		cout << endl;
+
+		cornerWriter.close();
+		surfWriter.close();
+		globalWriter.close();
+	}
+
+	/*
+	 * Global map visualization, kept as a persistent chunked voxel map (visualization thread only).
+	 * New keyframes are inserted as they appear, the map is rebuilt only after correctPoses moved the key poses,
+	 * and nothing is published while no chunk changed. Changed chunks go out on map_global_updates; map_global
+	 * (latched) is the concatenation of the cached chunk clouds within globalMapVisualizationSearchRadius.
+	 */
+	void publishGlobalMap()
+	{
+		if (pubLaserCloudSurround.getNumSubscribers() == 0 && pubGlobalMapUpdates.getNumSubscribers() == 0)
+			return;
+
+		// snapshot the keyframes not inserted yet; the clouds themselves are never modified, so they are only referenced
+		std::vector<PointTypePose> newPoses;
+		std::vector<pcl::PointCloud<PointType>::Ptr> newCorner, newSurf;
+		PointType currentPose;
+		mtx.lock();
+		if (cloudKeyPoses3D->points.empty())
+		{
+			mtx.unlock();
+			return;
+		}
+		if (globalVizMapNeedsRebuild)
+		{
+			globalVizMap.clear();
+			globalVizPoseVoxels.clear();
+			globalVizMapKeyFrames = 0;
+			globalVizMapNeedsRebuild = false;
+		}
+		for (int i = globalVizMapKeyFrames; i < (int)cloudKeyPoses6D->size(); ++i)
+		{
+			KeyFrameStore<PointType>::KeyFrame keyFrame = keyFrameStore.get(i);
+			newPoses.push_back(cloudKeyPoses6D->points[i]);
+			newCorner.push_back(keyFrame.corner);
+			newSurf.push_back(keyFrame.surf);
+		}
+		globalVizMapKeyFrames = cloudKeyPoses6D->size();
+		currentPose = cloudKeyPoses3D->back();
+		mtx.unlock();
+
+		// insert at most one keyframe per globalMapVisualizationPoseDensity voxel of key poses
+		for (size_t i = 0; i < newPoses.size(); ++i)
+		{
+			const float inverseDensity = 1.0f / globalMapVisualizationPoseDensity;
+			const int64_t px = int64_t(std::floor(newPoses[i].x * inverseDensity));
+			const int64_t py = int64_t(std::floor(newPoses[i].y * inverseDensity));
+			const int64_t pz = int64_t(std::floor(newPoses[i].z * inverseDensity));
+			if (!globalVizPoseVoxels.insert(((px & 0x1FFFFF) << 42) | ((py & 0x1FFFFF) << 21) | (pz & 0x1FFFFF)).second)
+				continue;
+
+			globalVizMap.insert(*transformPointCloud(newCorner[i], &newPoses[i]));
+			globalVizMap.insert(*transformPointCloud(newSurf[i], &newPoses[i]));
+		}
+
+		// chunks within the visualization radius of the current key pose
+		const float reach = globalMapVisualizationSearchRadius + globalVizMap.chunkSize() * 0.7072f; // + half diagonal
+		std::vector<int64_t> visibleChunks;
+		for (int64_t key : globalVizMap.chunkKeys())
+		{
+			float cx, cy;
+			globalVizMap.chunkCenter(key, cx, cy);
+			if ((cx - currentPose.x) * (cx - currentPose.x) + (cy - currentPose.y) * (cy - currentPose.y) <= reach * reach)
+				visibleChunks.push_back(key);
+		}
+		std::sort(visibleChunks.begin(), visibleChunks.end());
+
+		std::vector<int64_t> dirtyChunks = globalVizMap.takeDirtyChunks();
+		if (dirtyChunks.empty() && visibleChunks == globalVizVisibleChunks)
+			return; // nothing changed since the last publish
+
+		for (int64_t key : dirtyChunks)
+			if (std::binary_search(visibleChunks.begin(), visibleChunks.end(), key))
+				publishCloud(&pubGlobalMapUpdates, globalVizMap.chunkCloud(key), timeLaserInfoStamp, odometryFrame);
+
+		if (pubLaserCloudSurround.getNumSubscribers() != 0)
+		{
+			pcl::PointCloud<PointType>::Ptr globalMapKeyFramesDS(new pcl::PointCloud<PointType>());
+			for (int64_t key : visibleChunks)
+				*globalMapKeyFramesDS += *globalVizMap.chunkCloud(key);
+			publishCloud(&pubLaserCloudSurround, globalMapKeyFramesDS, timeLaserInfoStamp, odometryFrame);
+		}
+		globalVizVisibleChunks.swap(visibleChunks);
+	}
+	/**
+	 * 闭环线程
+	 * 1、闭环scan-to-map，icp优化位姿
+	 *   1) 在历史关键帧中查找与当前关键帧距离最近的关键帧集合，选择时间相隔较远的一帧作为候选闭环帧
+	 *   2) 提取当前关键帧特征点集合，降采样；提取闭环匹配关键帧前后相邻若干帧的关键帧特征点集合，降采样
+	 *   3) 执行scan-to-map优化，调用icp方法，得到优化后位姿，构造闭环因子需要的数据，在因子图优化中一并加入更新位姿
+	 * 2、rviz展示闭环边
+	 */
+	void loopClosureThread()
+	{
+		if (loopClosureEnableFlag == false)
+			return;
+
+		ros::Rate rate(loopClosureFrequency);
+		while (ros::ok())
+		{
+			rate.sleep();
+			// 闭环scan-to-map，配准优化位姿
+			// 1、在历史关键帧中查找候选闭环帧(RS与SC)，各取若干帧
+			// 2、提取当前关键帧特征点集合，降采样；提取闭环匹配关键帧前后相邻若干帧的关键帧特征点集合，降采样
+			// 3、并行配准所有候选，得到优化后位姿，构造闭环因子需要的数据，在因子图优化中一并加入更新位姿
+			// 注：闭环的时候没有立即更新当前帧的位姿，而是添加闭环因子，让图优化去更新位姿
+			performLoopClosure();
+			// rviz展示闭环边
+			visualizeLoopClosure();
+			publishMetrics();
+		}
+	}
+
+	// one DiagnosticStatus per metric (see metrics.h), e.g., the Scan Context tree build/search timings
+	void publishMetrics()
+	{
+		publishMetricsDiagnostics(&pubMetrics);
+	}
+
+	void loopInfoHandler(const std_msgs::Float64MultiArray::ConstPtr &loopMsg)
+	{
+		std::lock_guard<std::mutex> lock(mtxLoopInfo);
+		if (loopMsg->data.size() != 2)
+			return;
+
+		loopInfoVec.push_back(*loopMsg);
+
+		while (loopInfoVec.size() > 5)
+			loopInfoVec.pop_front();
+	}
+	// a loop candidate, verified by loopRegistration
+	struct LoopCandidate
+	{
+		bool isSC;																	 // from Scan Context (else from the radius search, RS)
+		int keyCur;																	 // 当前关键帧索引
+		int keyPre;																	 // 候选闭环匹配帧索引
+		int64_t targetKey;													 // identifies the target cloud for the backend's per-target cache
+		pcl::PointCloud<PointType>::Ptr source;			 // 当前关键帧点云
+		pcl::PointCloud<PointType>::Ptr target;			 // 闭环匹配关键帧局部map
+		Eigen::Matrix4f guess;											 // initial guess of the alignment
+		LoopRegistration<PointType>::Result result;
+	};
+	using LoopCandidates = std::vector<LoopCandidate, Eigen::aligned_allocator<LoopCandidate>>; // fixed-size Eigen members
+
+	/**
+	 * 闭环scan-to-map，配准优化位姿
+	 * 1、在历史关键帧中查找候选闭环帧：RS为距离最近且时间相隔较远的帧，SC为描述子最相似的帧，各取最多loopClosureCandidates个
+	 * 2、提取当前关键帧和候选帧前后相邻若干帧的点云集合，降采样
+	 * 3、所有候选在numberOfCores个线程上并行配准（SC候选以SC估计的yaw作为初值），RS、SC各取通过检验且得分最好的一个，构造闭环因子需要的数据
+	 * 注：闭环的时候没有立即更新当前帧的位姿，而是添加闭环因子，让图优化去更新位姿
+	 */
+	void performLoopClosure()
+	{
+		// 如果关键帧集合为空，则返回
+		if (cloudKeyPoses3D->points.empty() == true)
+			return;
+		// 复制关键帧信息
+		mtx.lock();
+		*copy_cloudKeyPoses3D = *cloudKeyPoses3D;
+		copy_cloudKeyPoses2D->clear();						// giseop
+		*copy_cloudKeyPoses2D = *cloudKeyPoses3D; // giseop
+		*copy_cloudKeyPoses6D = *cloudKeyPoses6D;
+		uint64_t copyPoseGeneration = poseGeneration;
+		mtx.unlock();
+
+		// the key poses were corrected since the cached targets were built
+		if (copyPoseGeneration != loopCacheGeneration)
+		{
+			loopSubmapCache.clear();
+			loopRegistration->clearTargets();
+			loopCacheGeneration = copyPoseGeneration;
+		}
+
+		performPriorSessionLoopClosure();
+
+		LoopCandidates candidates;
+		findRSLoopCandidates(candidates, copyPoseGeneration);
+		findSCLoopCandidates(candidates, copyPoseGeneration); // giseop
+		if (candidates.empty())
+			return;
+
+		// verify concurrently, one registration per candidate
+		{
+			TRACE_SPAN("loop/verify_ms");
+#pragma omp parallel for num_threads(numberOfCores) schedule(dynamic)
+			for (int i = 0; i < (int)candidates.size(); ++i)
+			{
+				LoopCandidate &candidate = candidates[i];
+				candidate.result = loopRegistration->align(candidate.source, candidate.target, candidate.targetKey, candidate.guess);
+			}
+		}
+		Metrics::instance().record("loop/candidates", candidates.size());
+
+		// 未收敛，或者匹配不够好的候选被拒绝
+		const LoopCandidate *bestRS = nullptr;
+		const LoopCandidate *bestSC = nullptr;
+		for (const LoopCandidate &candidate : candidates)
+		{
+			const char *source = candidate.isSC ? "SC" : "RS";
+			if (candidate.result.converged == false || candidate.result.fitness > historyKeyframeFitnessScore)
+			{
+				std::cout << "ICP fitness test failed (" << candidate.result.fitness << " > " << historyKeyframeFitnessScore << "). Reject this " << source << " loop ("
+									<< candidate.keyCur << " and " << candidate.keyPre << ")." << std::endl;
+				continue;
+			}
+			std::cout << "ICP fitness test passed (" << candidate.result.fitness << " < " << historyKeyframeFitnessScore << "). " << source << " loop candidate ("
+								<< candidate.keyCur << " and " << candidate.keyPre << ")." << std::endl;
+
+			const LoopCandidate *&best = candidate.isSC ? bestSC : bestRS;
+			if (best == nullptr || candidate.result.fitness < best->result.fitness)
+				best = &candidate;
+		}
+
+		if (bestRS != nullptr)
+		{
+			std::cout << "Add this RS loop (" << bestRS->keyCur << " and " << bestRS->keyPre << ")." << std::endl;
+			addRSLoop(*bestRS);
+		}
+		if (bestSC != nullptr)
+		{
+			std::cout << "Add this SC loop (" << bestSC->keyCur << " and " << bestSC->keyPre << ")." << std::endl;
+			addSCLoop(*bestSC);
+		}
+	}
+
+	/**
+	 * 先验地图(loadSessionDirectory)闭环：重定位成功后地图坐标系即先验地图的坐标系
+	 * 1、最新关键帧的Scan Context在先验地图的描述子中查询候选关键帧，每个关键帧只查询一次
+	 * 2、当前关键帧点云（地图坐标系）配准到候选关键帧前后historyKeyframeSearchNum帧的先验地图点云
+	 * 3、通过检验且得分最好的配准给出当前关键帧在先验地图中的位姿，作为先验因子加入因子图
+	 * 注：先验地图的关键帧不加入本次的关键帧集合和局部地图，重访先验地图的区域时轨迹通过先验因子与先验地图保持一致
+	 */
+	void performPriorSessionLoopClosure()
+	{
+		if (!priorSession)
+			return;
+		std::shared_ptr<const SCSnapshot> scSnapshot = scManager.snapshot();
+		int keyCur = int(std::min(scSnapshot->size(), copy_cloudKeyPoses3D->size())) - 1;
+		if (keyCur < 0 || keyCur == priorLoopLastKey)
+			return;
+		priorLoopLastKey = keyCur;
+
+		TRACE_SPAN("loop/prior_session_ms");
+		std::vector<SCLoopCandidate> scCandidates = priorSession->scManager().detectRelocalizationCandidates(*scSnapshot, keyCur); // nearest first
+		if (scCandidates.empty())
+			return;
+		if ((int)scCandidates.size() > loopClosureCandidates)
+			scCandidates.resize(loopClosureCandidates);
+
+		pcl::PointCloud<PointType>::Ptr cureKeyframeCloud(new pcl::PointCloud<PointType>());
+		loopFindNearKeyframes(cureKeyframeCloud, keyCur, 0);
+		if (cureKeyframeCloud->size() < 300)
+			return;
+
+		// the source is in the map frame: p_pre = Rz(-yaw) T_cur^-1 p_map in the candidate's frame, unless the current pose is
+		// already close to the candidate (the map frames coincide after the relocalization, so the key poses are the guess)
+		Eigen::Affine3f tCur = pclPointToAffine3f(copy_cloudKeyPoses6D->points[keyCur]);
+		LoopCandidates candidates;
+		for (const SCLoopCandidate &scCandidate : scCandidates)
+		{
+			pcl::PointCloud<PointType>::Ptr target = priorSessionSubmap(scCandidate.index);
+			if (target->size() < 1000)
+				continue;
+
+			Eigen::Affine3f tPre(priorSession->pose(scCandidate.index));
+			LoopCandidate candidate;
+			candidate.isSC = true;
+			candidate.keyCur = keyCur;
+			candidate.keyPre = scCandidate.index;
+			candidate.targetKey = -1; // not in this session's key space
+			candidate.source = cureKeyframeCloud;
+			candidate.target = target;
+			if ((tPre.translation() - tCur.translation()).norm() < historyKeyframeSearchRadius)
+				candidate.guess = Eigen::Matrix4f::Identity();
+			else
+				candidate.guess = (tPre * Eigen::AngleAxisf(-scCandidate.yaw_diff_rad, Eigen::Vector3f::UnitZ()) * tCur.inverse()).matrix();
+			candidates.push_back(candidate);
+		}
+
+#pragma omp parallel for num_threads(numberOfCores) schedule(dynamic)
+		for (int i = 0; i < (int)candidates.size(); ++i)
+		{
+			LoopCandidate &candidate = candidates[i];
+			candidate.result = loopRegistration->align(candidate.source, candidate.target, candidate.targetKey, candidate.guess);
+		}
+
+		const LoopCandidate *best = nullptr;
+		for (const LoopCandidate &candidate : candidates)
+		{
+			if (candidate.result.converged == false || candidate.result.fitness > historyKeyframeFitnessScore)
+				continue;
+			if (best == nullptr || candidate.result.fitness < best->result.fitness)
+				best = &candidate;
+		}
+		if (best == nullptr)
+			return;
+		std::cout << "Add this prior session loop (" << best->keyCur << " and " << best->keyPre << " of the prior session, fitness "
+							<< best->result.fitness << ")." << std::endl;
+
+		// transform from world origin to corrected pose, in the prior session's map frame
+		float x, y, z, roll, pitch, yaw;
+		Eigen::Affine3f tCorrect = Eigen::Affine3f(best->result.transform) * tCur;
+		pcl::getTranslationAndEulerAngles(tCorrect, x, y, z, roll, pitch, yaw);
+		gtsam::Vector Vector6(6);
+		float noiseScore = best->result.fitness;
+		Vector6 << noiseScore, noiseScore, noiseScore, noiseScore, noiseScore, noiseScore;
+
+		mtx.lock();
+		priorLoopQueue.push_back(make_pair(keyCur, Pose3(Rot3::RzRyRx(roll, pitch, yaw), Point3(x, y, z))));
+		priorLoopNoiseQueue.push_back(noiseModel::Diagonal::Variances(Vector6));
+		mtx.unlock();
+	}
+
+	// a target cloud changes with its key, its kind and the key poses it was built from
+	int64_t loopTargetKey(uint64_t generation, int keyPre, bool isSC)
+	{
+		return int64_t(((generation & 0x7fffffff) << 31 | uint64_t(keyPre)) << 1 | (isSC ? 1 : 0)); // non-negative
+	}
+
+	/**
+	 * 闭环匹配关键帧局部map：key前后historyKeyframeSearchNum帧的点云，降采样
+	 * wrtKey < 0 时每帧用自己的位姿变换（RS），否则都用wrtKey的位姿（SC）
+	 * 邻帧都已存在时按targetKey缓存，之后同一候选（位姿未被校正）直接复用；否则targetKey置为-1（配准也不缓存）
+	 */
+	pcl::PointCloud<PointType>::Ptr loopTargetSubmap(int64_t &targetKey, int key, int wrtKey)
+	{
+		if (const pcl::PointCloud<PointType>::Ptr *cached = loopSubmapCache.get(targetKey))
+			return *cached;
+
+		TicToc t_submap;
+		pcl::PointCloud<PointType>::Ptr submap(new pcl::PointCloud<PointType>());
+		if (wrtKey < 0)
+			loopFindNearKeyframes(submap, key, historyKeyframeSearchNum);
+		else
+			loopFindNearKeyframesWithRespectTo(submap, key, historyKeyframeSearchNum, wrtKey);
+		Metrics::instance().record("loop/submap_build_ms", t_submap.toc("Loop submap"));
+
+		if (key + historyKeyframeSearchNum < (int)copy_cloudKeyPoses6D->size())
+			loopSubmapCache.put(targetKey, submap, submap->size() * sizeof(PointType));
+		else
+			targetKey = -1; // a submap missing later neighbors is not final yet
+		return submap;
+	}
+
+	void findRSLoopCandidates(LoopCandidates &candidates, uint64_t generation)
+	{
+		// find keys
+		int loopKeyCur;							 // 当前关键帧索引
+		std::vector<int> loopKeysPre; // 候选闭环匹配帧索引
+		int loopKeyPre;
+		if (detectLoopClosureExternal(&loopKeyCur, &loopKeyPre) == true)
+			loopKeysPre.push_back(loopKeyPre);
+		else
+			// 在历史关键帧中查找与当前关键帧距离最近的关键帧集合，选择时间相隔较远的若干帧作为候选闭环帧
+			if (detectLoopClosureDistance(&loopKeyCur, &loopKeysPre) == false)
+				return;
+
+		// 提取当前关键帧点云集合，降采样
+		pcl::PointCloud<PointType>::Ptr cureKeyframeCloud(new pcl::PointCloud<PointType>());
+		loopFindNearKeyframes(cureKeyframeCloud, loopKeyCur, 0);
+		// 如果特征点较少，则返回
+		if (cureKeyframeCloud->size() < 300)
+			return;
+
+		for (int keyPre : loopKeysPre)
+		{
+			std::cout << "RS loop found! between " << loopKeyCur << " and " << keyPre << "." << std::endl; // giseop
+
+			// 提取闭环匹配关键帧前后相邻若干帧的关键帧点云集合，降采样
+			int64_t targetKey = loopTargetKey(generation, keyPre, false);
+			pcl::PointCloud<PointType>::Ptr prevKeyframeCloud = loopTargetSubmap(targetKey, keyPre, -1);
+			if (prevKeyframeCloud->size() < 1000)
+				continue;
+			// 发布闭环匹配关键帧局部map
+			if (pubHistoryKeyFrames.getNumSubscribers() != 0)
+				publishCloud(&pubHistoryKeyFrames, prevKeyframeCloud, timeLaserInfoStamp, odometryFrame);
+
+			// both clouds are in the map frame, so the key poses are the initial guess
+			LoopCandidate candidate;
+			candidate.isSC = false;
+			candidate.keyCur = loopKeyCur;
+			candidate.keyPre = keyPre;
+			candidate.targetKey = targetKey;
+			candidate.source = cureKeyframeCloud;
+			candidate.target = prevKeyframeCloud;
+			candidate.guess = Eigen::Matrix4f::Identity();
+			candidates.push_back(candidate);
+		}
+	}
+
+	void addRSLoop(const LoopCandidate &candidate)
+	{
+		// publish corrected cloud 发布当前关键帧经过闭环优化后的特征点云
+		if (pubIcpKeyFrames.getNumSubscribers() != 0)
+		{
+			pcl::PointCloud<PointType>::Ptr closed_cloud(new pcl::PointCloud<PointType>());
+			pcl::transformPointCloud(*candidate.source, *closed_cloud, candidate.result.transform);
+			publishCloud(&pubIcpKeyFrames, closed_cloud, timeLaserInfoStamp, odometryFrame);
+		}
+
+		// Get pose transformation
+		float x, y, z, roll, pitch, yaw;
+		Eigen::Affine3f correctionLidarFrame;
+		correctionLidarFrame = candidate.result.transform;
+		// transform from world origin to wrong pose
+		Eigen::Affine3f tWrong = pclPointToAffine3f(copy_cloudKeyPoses6D->points[candidate.keyCur]);
+		// transform from world origin to corrected pose
+		Eigen::Affine3f tCorrect = correctionLidarFrame * tWrong; // pre-multiplying -> successive rotation about a fixed frame
+		pcl::getTranslationAndEulerAngles(tCorrect, x, y, z, roll, pitch, yaw);
+		gtsam::Pose3 poseFrom = Pose3(Rot3::RzRyRx(roll, pitch, yaw), Point3(x, y, z));
+		gtsam::Pose3 poseTo = pclPointTogtsamPose3(copy_cloudKeyPoses6D->points[candidate.keyPre]);
+		gtsam::Vector Vector6(6);
+		float noiseScore = candidate.result.fitness;
+		Vector6 << noiseScore, noiseScore, noiseScore, noiseScore, noiseScore, noiseScore;
+		noiseModel::Diagonal::shared_ptr constraintNoise = noiseModel::Diagonal::Variances(Vector6);
+
+		// Add pose constraint 添加闭环因子需要的数据
+		mtx.lock();
+		loopIndexQueue.push_back(make_pair(candidate.keyCur, candidate.keyPre));
+		loopPoseQueue.push_back(poseFrom.between(poseTo));
+		loopNoiseQueue.push_back(constraintNoise);
+		mtx.unlock();
+
+		// add loop constriant
+		// loopIndexContainer[loopKeyCur] = loopKeyPre;
+		loopIndexContainer.insert(std::pair<int, int>(candidate.keyCur, candidate.keyPre)); // giseop for multimap
+	}																																											// addRSLoop
+
+	void findSCLoopCandidates(LoopCandidates &candidates, uint64_t generation)
+	{
+		// find keys, on a snapshot the mapping thread keeps appending behind (no lock); the query is the newest keyframe in both copies
+		std::shared_ptr<const SCSnapshot> scSnapshot = scManager.snapshot();
+		size_t numKeys = std::min(scSnapshot->size(), copy_cloudKeyPoses3D->size());
+		if (numKeys == 0)
+			return;
+		std::vector<SCLoopCandidate> scCandidates = scManager.detectLoopClosureCandidates(*scSnapshot, numKeys - 1); // nearest first
+		if (scCandidates.empty() /* No loop found */)
+			return;
+		if ((int)scCandidates.size() > loopClosureCandidates)
+			scCandidates.resize(loopClosureCandidates);
+		int loopKeyCur = numKeys - 1;
+
+		// extract cloud
+		// loopFindNearKeyframesWithRespectTo(cureKeyframeCloud, loopKeyCur, 0, loopKeyPre); // giseop
+		// loopFindNearKeyframes(prevKeyframeCloud, loopKeyPre, historyKeyframeSearchNum);
+		int base_key = 0;
+		pcl::PointCloud<PointType>::Ptr cureKeyframeCloud(new pcl::PointCloud<PointType>());
+		loopFindNearKeyframesWithRespectTo(cureKeyframeCloud, loopKeyCur, 0, base_key); // giseop
+		if (cureKeyframeCloud->size() < 300)
+			return;
+
+		// both clouds are the keyframes' local clouds moved by the base key pose, so in the base frame a point of the current
+		// scan is mapped to the candidate's scan by the yaw the descriptors were aligned with: p_pre = Rz(-yaw) p_cur
+		Eigen::Affine3f tBase = pclPointToAffine3f(copy_cloudKeyPoses6D->points[base_key]);
+		for (const SCLoopCandidate &scCandidate : scCandidates)
+		{
+			int loopKeyPre = scCandidate.index;
+			std::cout << "SC loop found! between " << loopKeyCur << " and " << loopKeyPre << "." << std::endl; // giseop
+
+			int64_t targetKey = loopTargetKey(generation, loopKeyPre, true);
+			pcl::PointCloud<PointType>::Ptr prevKeyframeCloud = loopTargetSubmap(targetKey, loopKeyPre, base_key); // giseop
+			if (prevKeyframeCloud->size() < 1000)
+				continue;
+			if (pubHistoryKeyFrames.getNumSubscribers() != 0)
+				publishCloud(&pubHistoryKeyFrames, prevKeyframeCloud, timeLaserInfoStamp, odometryFrame);
+
+			Eigen::Affine3f yawGuess(Eigen::AngleAxisf(-scCandidate.yaw_diff_rad, Eigen::Vector3f::UnitZ()));
+			LoopCandidate candidate;
+			candidate.isSC = true;
+			candidate.keyCur = loopKeyCur;
+			candidate.keyPre = loopKeyPre;
+			candidate.targetKey = targetKey;
+			candidate.source = cureKeyframeCloud;
+			candidate.target = prevKeyframeCloud;
+			candidate.guess = (tBase * yawGuess * tBase.inverse()).matrix();
+			candidates.push_back(candidate);
+		}
+	}
+
+	void addSCLoop(const LoopCandidate &candidate)
+	{
+		// publish corrected cloud
+		if (pubIcpKeyFrames.getNumSubscribers() != 0)
+		{
+			pcl::PointCloud<PointType>::Ptr closed_cloud(new pcl::PointCloud<PointType>());
+			pcl::transformPointCloud(*candidate.source, *closed_cloud, candidate.result.transform);
+			publishCloud(&pubIcpKeyFrames, closed_cloud, timeLaserInfoStamp, odometryFrame);
+		}
+
+		// Get pose transformation
+		float x, y, z, roll, pitch, yaw;
+		Eigen::Affine3f correctionLidarFrame;
+		correctionLidarFrame = candidate.result.transform;
+
+		// giseop
+		pcl::getTranslationAndEulerAngles(correctionLidarFrame, x, y, z, roll, pitch, yaw);
+		gtsam::Pose3 poseFrom = Pose3(Rot3::RzRyRx(roll, pitch, yaw), Point3(x, y, z));
+		gtsam::Pose3 poseTo = Pose3(Rot3::RzRyRx(0.0, 0.0, 0.0), Point3(0.0, 0.0, 0.0));
+
+		// giseop, robust kernel for a SC loop
+		float robustNoiseScore = 0.5; // constant is ok...
+		gtsam::Vector robustNoiseVector6(6);
+		robustNoiseVector6 << robustNoiseScore, robustNoiseScore, robustNoiseScore, robustNoiseScore, robustNoiseScore, robustNoiseScore;
+		noiseModel::Base::shared_ptr robustConstraintNoise;
+		robustConstraintNoise = gtsam::noiseModel::Robust::Create(
+				gtsam::noiseModel::mEstimator::Cauchy::Create(1),						 // optional: replacing Cauchy by DCS or GemanMcClure, but with a good front-end loop detector, Cauchy is empirically enough.
+				gtsam::noiseModel::Diagonal::Variances(robustNoiseVector6)); // - checked it works. but with robust kernel, map modification may be delayed (i.e,. requires more true-positive loop factors)
+
+		// Add pose constraint
+		mtx.lock();
+		loopIndexQueue.push_back(make_pair(candidate.keyCur, candidate.keyPre));
+		loopPoseQueue.push_back(poseFrom.between(poseTo));
+		loopNoiseQueue.push_back(robustConstraintNoise);
+		mtx.unlock();
+
+		// add loop constriant
+		// loopIndexContainer[loopKeyCur] = loopKeyPre;
+		loopIndexContainer.insert(std::pair<int, int>(candidate.keyCur, candidate.keyPre)); // giseop for multimap
+	}																																											// addSCLoop
+
+	/**
+	 * 在历史关键帧中查找与当前关键帧距离最近的关键帧集合，选择时间相隔较远的最多loopClosureCandidates帧作为候选闭环帧（由近到远）
+	 * 一个候选前后historyKeyframeSearchNum帧内的帧不再作为候选，它们的局部map与该候选的几乎相同
+	 */
+	bool detectLoopClosureDistance(int *latestID, std::vector<int> *closestIDs)
+	{
+		int loopKeyCur = copy_cloudKeyPoses3D->size() - 1;
+		std::vector<int> loopKeysPre;
+
+		// check loop constraint added before
+		auto it = loopIndexContainer.find(loopKeyCur);
+		// 当前关键帧已经添加过闭环对应关系，不再继续添加
+		if (it != loopIndexContainer.end())
+			return false;
+
+		// find the closest history key frame 在历史关键帧中寻找与当前关键帧距离最近的关键帧集合
+		std::vector<int> pointSearchIndLoop;
+		std::vector<float> pointSearchSqDisLoop; // unused
+		// kdtreeHistoryKeyPoses->setInputCloud(copy_cloudKeyPoses3D);
+		// kdtreeHistoryKeyPoses->radiusSearch(copy_cloudKeyPoses3D->back(), historyKeyframeSearchRadius, pointSearchIndLoop, pointSearchSqDisLoop, 0);
+		// 在候选关键帧集合中，找到与当前关键帧时间相隔较远的帧，设为候选匹配帧
+		for (int i = 0; i < (int)copy_cloudKeyPoses2D->size(); i++) // giseop
+			copy_cloudKeyPoses2D->points[i].z = 1.1;									// to relieve the z-axis drift, 1.1 is just foo val
+
+		kdtreeHistoryKeyPoses->setInputCloud(copy_cloudKeyPoses2D);																																									 // giseop
+		kdtreeHistoryKeyPoses->radiusSearch(copy_cloudKeyPoses2D->back(), historyKeyframeSearchRadius, pointSearchIndLoop, pointSearchSqDisLoop, 0); // giseop
+
+		// std::cout << "the number of RS-loop candidates  " << pointSearchIndLoop.size() << "." << std::endl; // giseop
+		for (int i = 0; i < (int)pointSearchIndLoop.size() && (int)loopKeysPre.size() < loopClosureCandidates; ++i)
+		{
+			int id = pointSearchIndLoop[i];
+			if (id == loopKeyCur || abs(copy_cloudKeyPoses6D->points[id].time - timeLaserInfoCur) <= historyKeyframeSearchTimeDiff)
+				continue;
+			bool nearChosen = false;
+			for (int chosen : loopKeysPre)
+				nearChosen = nearChosen || abs(id - chosen) <= historyKeyframeSearchNum;
+			if (!nearChosen)
+				loopKeysPre.push_back(id);
+		}
+
+		if (loopKeysPre.empty())
+			return false;
+
+		*latestID = loopKeyCur;
+		*closestIDs = loopKeysPre;
+
+		return true;
+	}
+
+	bool detectLoopClosureExternal(int *latestID, int *closestID)
+	{
+		// this function is not used yet, please ignore it
+		int loopKeyCur = -1;
+		int loopKeyPre = -1;
+
+		std::lock_guard<std::mutex> lock(mtxLoopInfo);
+		if (loopInfoVec.empty())
+			return false;
+
+		double loopTimeCur = loopInfoVec.front().data[0];
+		double loopTimePre = loopInfoVec.front().data[1];
+		loopInfoVec.pop_front();
+
+		if (abs(loopTimeCur - loopTimePre) < historyKeyframeSearchTimeDiff)
+			return false;
+
+		int cloudSize = copy_cloudKeyPoses6D->size();
+		if (cloudSize < 2)
+			return false;
+
+		// latest key
+		loopKeyCur = cloudSize - 1;
+		for (int i = cloudSize - 1; i >= 0; --i)
+		{
+			if (copy_cloudKeyPoses6D->points[i].time >= loopTimeCur)
+				loopKeyCur = round(copy_cloudKeyPoses6D->points[i].intensity);
+			else
+				break;
+		}
+
+		// previous key
+		loopKeyPre = 0;
+		for (int i = 0; i < cloudSize; ++i)
+		{
+			if (copy_cloudKeyPoses6D->points[i].time <= loopTimePre)
+				loopKeyPre = round(copy_cloudKeyPoses6D->points[i].intensity);
+			else
+				break;
+		}
+
+		if (loopKeyCur == loopKeyPre)
+			return false;
+
+		auto it = loopIndexContainer.find(loopKeyCur);
+		if (it != loopIndexContainer.end())
+			return false;
+
+		*latestID = loopKeyCur;
+		*closestID = loopKeyPre;
+
+		return true;
+	}
+
+	void loopFindNearKeyframes(pcl::PointCloud<PointType>::Ptr &nearKeyframes, const int &key, const int &searchNum)
+	{
+		// extract near keyframes
+		nearKeyframes->clear();
+		int cloudSize = copy_cloudKeyPoses6D->size();
+		for (int i = -searchNum; i <= searchNum; ++i)
+		{
+			int keyNear = key + i;
+			if (keyNear < 0 || keyNear >= cloudSize)
+				continue;
+			KeyFrameStore<PointType>::KeyFrame keyFrame = keyFrameStore.get(keyNear);
+			*nearKeyframes += *transformPointCloud(keyFrame.corner, &copy_cloudKeyPoses6D->points[keyNear]);
+			*nearKeyframes += *transformPointCloud(keyFrame.surf, &copy_cloudKeyPoses6D->points[keyNear]);
+		}
+
+		if (nearKeyframes->empty())
+			return;
+
+		// downsample near keyframes
+		pcl::PointCloud<PointType>::Ptr cloud_temp(new pcl::PointCloud<PointType>());
+		downSizeFilterICP.setInputCloud(nearKeyframes);
+		downSizeFilterICP.filter(*cloud_temp);
+		*nearKeyframes = *cloud_temp;
+	}
+
+	void loopFindNearKeyframesWithRespectTo(pcl::PointCloud<PointType>::Ptr &nearKeyframes, const int &key, const int &searchNum, const int _wrt_key)
+	{
+		// extract near keyframes
+		nearKeyframes->clear();
+		int cloudSize = copy_cloudKeyPoses6D->size();
+		for (int i = -searchNum; i <= searchNum; ++i)
+		{
+			int keyNear = key + i;
+			if (keyNear < 0 || keyNear >= cloudSize)
+				continue;
+			KeyFrameStore<PointType>::KeyFrame keyFrame = keyFrameStore.get(keyNear);
+			*nearKeyframes += *transformPointCloud(keyFrame.corner, &copy_cloudKeyPoses6D->points[_wrt_key]);
+			*nearKeyframes += *transformPointCloud(keyFrame.surf, &copy_cloudKeyPoses6D->points[_wrt_key]);
+		}
+
+		if (nearKeyframes->empty())
+			return;
+
+		// downsample near keyframes
+		pcl::PointCloud<PointType>::Ptr cloud_temp(new pcl::PointCloud<PointType>());
+		downSizeFilterICP.setInputCloud(nearKeyframes);
+		downSizeFilterICP.filter(*cloud_temp);
+		*nearKeyframes = *cloud_temp;
+	}
+
+	void visualizeLoopClosure()
+	{
+		visualization_msgs::MarkerArray markerArray;
+		// loop nodes
+		visualization_msgs::Marker markerNode;
+		markerNode.header.frame_id = odometryFrame;
+		markerNode.header.stamp = timeLaserInfoStamp;
+		markerNode.action = visualization_msgs::Marker::ADD;
+		markerNode.type = visualization_msgs::Marker::SPHERE_LIST;
+		markerNode.ns = "loop_nodes";
+		markerNode.id = 0;
+		markerNode.pose.orientation.w = 1;
+		markerNode.scale.x = 0.3;
+		markerNode.scale.y = 0.3;
+		markerNode.scale.z = 0.3;
+		markerNode.color.r = 0;
+		markerNode.color.g = 0.8;
+		markerNode.color.b = 1;
+		markerNode.color.a = 1;
+		// loop edges
+		visualization_msgs::Marker markerEdge;
+		markerEdge.header.frame_id = odometryFrame;
+		markerEdge.header.stamp = timeLaserInfoStamp;
+		markerEdge.action = visualization_msgs::Marker::ADD;
+		markerEdge.type = visualization_msgs::Marker::LINE_LIST;
+		markerEdge.ns = "loop_edges";
+		markerEdge.id = 1;
+		markerEdge.pose.orientation.w = 1;
+		markerEdge.scale.x = 0.1;
+		markerEdge.scale.y = 0.1;
+		markerEdge.scale.z = 0.1;
+		markerEdge.color.r = 0.9;
+		markerEdge.color.g = 0.9;
+		markerEdge.color.b = 0;
+		markerEdge.color.a = 1;
+
+		for (auto it = loopIndexContainer.begin(); it != loopIndexContainer.end(); ++it)
+		{
+			int key_cur = it->first;
+			int key_pre = it->second;
+			geometry_msgs::Point p;
+			p.x = copy_cloudKeyPoses6D->points[key_cur].x;
+			p.y = copy_cloudKeyPoses6D->points[key_cur].y;
+			p.z = copy_cloudKeyPoses6D->points[key_cur].z;
+			markerNode.points.push_back(p);
+			markerEdge.points.push_back(p);
+			p.x = copy_cloudKeyPoses6D->points[key_pre].x;
+			p.y = copy_cloudKeyPoses6D->points[key_pre].y;
+			p.z = copy_cloudKeyPoses6D->points[key_pre].z;
+			markerNode.points.push_back(p);
+			markerEdge.points.push_back(p);
+		}
+
+		markerArray.markers.push_back(markerNode);
+		markerArray.markers.push_back(markerEdge);
+		pubLoopConstraintEdge.publish(markerArray);
+	}
+
+	/**
+	 * localizationMode的先验地图：读取localizationMapDirectory中导出的cloudCorner.pcd与cloudSurf.pcd（已按建图分辨率降采样），
+	 * 按localizationTileSize分块，每块只建一次kd-tree，之后scan-to-map只在当前点所在的块中搜索
+	 * 块的边界向外扩1m（角点、面点近邻的距离阈值），边界附近的近邻与整张地图上搜索的结果相同
+	 * 读取失败则退回建图模式
+	 */
+	void loadLocalizationMap()
+	{
+		TicToc t_load;
+		std::string directory = localizationMapDirectory;
+		if (!directory.empty() && directory.back() != '/')
+			directory += '/';
+
+		pcl::PointCloud<PointType>::Ptr mapCorner(new pcl::PointCloud<PointType>());
+		pcl::PointCloud<PointType>::Ptr mapSurf(new pcl::PointCloud<PointType>());
+		if (pcl::io::loadPCDFile<PointType>(directory + "cloudCorner.pcd", *mapCorner) < 0 ||
+				pcl::io::loadPCDFile<PointType>(directory + "cloudSurf.pcd", *mapSurf) < 0 ||
+				mapCorner->empty() || mapSurf->empty())
+		{
+			ROS_ERROR("Can not read cloudCorner.pcd and cloudSurf.pcd in %s, mapping instead of localizing.", directory.c_str());
+			localizationMode = false;
+			return;
+		}
+
+		const float neighborMargin = 1.0; // sqrt of the 1.0 squared distance the 5th neighbor must be within
+		localizationCornerMap.build(*mapCorner, localizationTileSize, neighborMargin);
+		localizationSurfMap.build(*mapSurf, localizationTileSize, neighborMargin);
+		ROS_INFO("Localizing in %s: %zu corner and %zu surf points in %zu tiles.", directory.c_str(),
+						 localizationCornerMap.numPoints(), localizationSurfMap.numPoints(), localizationSurfMap.numTiles());
+		Metrics::instance().record("localization/load_ms", t_load.toc("Localization map load"));
+	}
+
+	// _path with the symlinks, "." and ".." resolved and a trailing '/', as given if it does not exist
+	static std::string canonicalDirectory(const std::string &_path)
+	{
+		char resolved[PATH_MAX];
+		std::string path = realpath(_path.c_str(), resolved) != nullptr ? std::string(resolved) : _path;
+		if (path.empty() || path.back() != '/')
+			path += '/';
+		return path;
+	}
+
+	void loadPriorSession()
+	{
+		// savePCDDirectory is cleared at startup (rm -r), while the session file stays mapped and its clouds are read lazily:
+		// neither directory may contain the other
+		const std::string loadDirectory = canonicalDirectory(loadSessionDirectory);
+		const std::string saveDirectory = canonicalDirectory(savePCDDirectory);
+		const bool overlapping = loadDirectory.compare(0, saveDirectory.size(), saveDirectory) == 0 ||
+								 saveDirectory.compare(0, loadDirectory.size(), loadDirectory) == 0;
+		if (overlapping && localizationMode == false)
+		{
+			ROS_ERROR("loadSessionDirectory %s overlaps savePCDDirectory %s, which is cleared at startup; not loading it.",
+					  loadSessionDirectory.c_str(), savePCDDirectory.c_str());
+			return;
+		}
+
+		TicToc t_load;
+		priorSession.reset(new PriorSession<PointType>(size_t(priorSessionCloudCacheBudget * 1024 * 1024)));
+		if (priorSession->load(loadSessionDirectory) == false)
+		{
+			ROS_WARN("No session found in %s, mapping in a new map frame.", loadSessionDirectory.c_str());
+			priorSession.reset();
+			return;
+		}
+		ROS_INFO("Loaded %zu keyframes of the session in %s.", priorSession->size(), loadSessionDirectory.c_str());
+		Metrics::instance().record("session/load_ms", t_load.toc("Session load"));
+	}
+
+	/**
+	 * 在先验地图(loadSessionDirectory)中重定位当前帧：
+	 * 1、当前帧的Scan Context在先验地图的所有描述子中查询候选关键帧
+	 * 2、候选关键帧及其前后historyKeyframeSearchNum帧的点云（按需从磁盘读取）拼成目标点云
+	 * 3、ICP配准当前帧，初值为候选关键帧位姿加上SC的yaw，通过historyKeyframeFitnessScore则用配准结果作为当前帧位姿
+	 */
+	bool relocalizeInPriorSession()
+	{
+		TicToc t_relocalize;
+		pcl::PointCloud<PointType>::Ptr source(new pcl::PointCloud<PointType>());
+		downSizeFilterSC.setInputCloud(laserCloudRaw);
+		downSizeFilterSC.filter(*source);
+
+		bool relocalized = false;
+		for (const SCLoopCandidate &candidate : priorSession->scManager().detectRelocalizationCandidates(*source))
+		{
+			pcl::PointCloud<PointType>::Ptr target = priorSessionSubmap(candidate.index);
+			if (target->size() < 300)
+				continue;
+
+			// p_candidate = Rz(-yaw) p_current (SCLoopCandidate)
+			Eigen::Matrix4f guess = priorSession->pose(candidate.index) * Eigen::Affine3f(Eigen::AngleAxisf(-candidate.yaw_diff_rad, Eigen::Vector3f::UnitZ())).matrix();
+			LoopRegistration<PointType>::Result result = loopRegistration->align(source, target, -1, guess);
+			if (result.converged == false || result.fitness > historyKeyframeFitnessScore)
+				continue;
+
+			Eigen::Affine3f pose(result.transform);
+			pcl::getTranslationAndEulerAngles(pose, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+											  transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+			ROS_INFO("Relocalized at keyframe %d of the prior session (fitness %f).", candidate.index, result.fitness);
+			relocalized = true;
+			break;
+		}
+		Metrics::instance().record("session/relocalize_ms", t_relocalize.toc("Relocalization"));
+		return relocalized;
+	}
+
+	// keyframes key-historyKeyframeSearchNum .. key+historyKeyframeSearchNum of the prior session, in its map frame
+	pcl::PointCloud<PointType>::Ptr priorSessionSubmap(int key)
+	{
+		pcl::PointCloud<PointType>::Ptr submap(new pcl::PointCloud<PointType>());
+		int first = std::max(0, key - historyKeyframeSearchNum);
+		int last = std::min((int)priorSession->size() - 1, key + historyKeyframeSearchNum);
+		for (int i = first; i <= last; ++i)
+		{
+			pcl::PointCloud<PointType>::Ptr cloud = priorSession->keyframeCloud(i);
+			if (!cloud)
+				continue;
+			pcl::PointCloud<PointType> transformed;
+			pcl::transformPointCloud(*cloud, transformed, priorSession->pose(i));
+			*submap += transformed;
+		}
+
+		pcl::PointCloud<PointType>::Ptr submapDS(new pcl::PointCloud<PointType>());
+		downSizeFilterICP.setInputCloud(submap);
+		downSizeFilterICP.filter(*submapDS);
+		return submapDS;
+	}
+
+	void updateInitialGuess()
+	{
+		// save current transformation before any processing
+		incrementalOdometryAffineFront = trans2Affine3f(transformTobeMapped);
+
+		static Eigen::Affine3f lastImuTransformation;
+		// initialization
+		if (poseInitialized() == false)
+		{
+			transformTobeMapped[0] = cloudInfo.imuRollInit;
+			transformTobeMapped[1] = cloudInfo.imuPitchInit;
+			transformTobeMapped[2] = cloudInfo.imuYawInit;
+
+			if (!useImuHeadingInitialization)
+				transformTobeMapped[2] = 0;
+
+			lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit); // save imu before return;
+			return;
+		}
+
+		// use imu pre-integration estimation for pose guess
+		static bool lastImuPreTransAvailable = false;
+		static Eigen::Affine3f lastImuPreTransformation;
+		if (cloudInfo.odomAvailable == true)
+		{
+			Eigen::Affine3f transBack = pcl::getTransformation(cloudInfo.initialGuessX, cloudInfo.initialGuessY, cloudInfo.initialGuessZ,
+																												 cloudInfo.initialGuessRoll, cloudInfo.initialGuessPitch, cloudInfo.initialGuessYaw);
+			if (lastImuPreTransAvailable == false)
+			{
+				lastImuPreTransformation = transBack;
+				lastImuPreTransAvailable = true;
+			}
+			else
+			{
+				Eigen::Affine3f transIncre = lastImuPreTransformation.inverse() * transBack;
+				Eigen::Affine3f transTobe = trans2Affine3f(transformTobeMapped);
+				Eigen::Affine3f transFinal = transTobe * transIncre;
+				pcl::getTranslationAndEulerAngles(transFinal, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+																					transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+
+				lastImuPreTransformation = transBack;
+
+				lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit); // save imu before return;
+				return;
+			}
+		}
+
+		// use imu incremental estimation for pose guess (only rotation)
+		if (cloudInfo.imuAvailable == true)
+		{
+			Eigen::Affine3f transBack = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit);
+			Eigen::Affine3f transIncre = lastImuTransformation.inverse() * transBack;
+
+			Eigen::Affine3f transTobe = trans2Affine3f(transformTobeMapped);
+			Eigen::Affine3f transFinal = transTobe * transIncre;
+			pcl::getTranslationAndEulerAngles(transFinal, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+																				transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+
+			lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit); // save imu before return;
+			return;
+		}
+	}
+
+	void extractForLoopClosure()
+	{
+		pcl::PointCloud<PointType>::Ptr cloudToExtract(new pcl::PointCloud<PointType>());
+		int numPoses = cloudKeyPoses3D->size();
+		for (int i = numPoses - 1; i >= 0; --i)
+		{
+			if ((int)cloudToExtract->size() <= surroundingKeyframeSize)
+				cloudToExtract->push_back(cloudKeyPoses3D->points[i]);
+			else
+				break;
+		}
+
+		extractCloud(cloudToExtract);
+	}
+
+	void extractNearby()
+	{
+		surroundingKeyPoses->clear();
+		surroundingKeyPosesDS->clear();
+
+		// extract all the nearby key poses and downsample them
+		// the key pose tree only changes when a keyframe is added or the key poses are corrected
+		if (localMapNeedsRebuild || (int)cloudKeyPoses3D->size() != kdtreeSurroundingKeyPosesSize)
+		{
+			kdtreeSurroundingKeyPoses.setInputCloud(cloudKeyPoses3D); // create kd-tree
+			kdtreeSurroundingKeyPosesSize = cloudKeyPoses3D->size();
+		}
+		kdtreeSurroundingKeyPoses.radiusSearch(cloudKeyPoses3D->back(), surroundingKeyframeSearchRadius, surroundingKeyPosesSearch);
+		for (const auto &match : surroundingKeyPosesSearch)
+			surroundingKeyPoses->push_back(cloudKeyPoses3D->points[match.first]);
+
+		downSizeFilterSurroundingKeyPoses.setInputCloud(surroundingKeyPoses);
+		downSizeFilterSurroundingKeyPoses.filter(*surroundingKeyPosesDS);
+
+		// also extract some latest key frames in case the robot rotates in one position
+		int numPoses = cloudKeyPoses3D->size();
+		for (int i = numPoses - 1; i >= 0; --i)
+		{
+			if (timeLaserInfoCur - cloudKeyPoses6D->points[i].time < 10.0)
+				surroundingKeyPosesDS->push_back(cloudKeyPoses3D->points[i]);
+			else
+				break;
+		}
+
+		extractCloud(surroundingKeyPosesDS);
+	}
+
+	void extractCloud(pcl::PointCloud<PointType>::Ptr cloudToExtract)
+	{
+		// key poses were corrected, re-project the whole local map
+		if (localMapNeedsRebuild)
+		{
+			localCornerMap.clear();
+			localSurfMap.clear();
+			localMapNeedsRebuild = false;
+			localMapChanged = true;
+		}
+
+		// keyframes that make up the local map of this scan (sorted, unique)
+		keysToExtract.clear();
+		for (int i = 0; i < (int)cloudToExtract->size(); ++i)
+		{
+			if (pointDistance(cloudToExtract->points[i], cloudKeyPoses3D->back()) > surroundingKeyframeSearchRadius)
+				continue;
+			keysToExtract.push_back((int)cloudToExtract->points[i].intensity);
+		}
+		std::sort(keysToExtract.begin(), keysToExtract.end());
+		keysToExtract.erase(std::unique(keysToExtract.begin(), keysToExtract.end()), keysToExtract.end());
+
+		// evict keyframes that left the surrounding region
+		localCornerMap.keys(localMapKeys);
+		for (int thisKeyInd : localMapKeys)
+		{
+			if (std::binary_search(keysToExtract.begin(), keysToExtract.end(), thisKeyInd))
+				continue;
+			localCornerMap.erase(thisKeyInd);
+			localSurfMap.erase(thisKeyInd);
+			localMapChanged = true;
+		}
+
+		// insert keyframes that entered it
+		for (int thisKeyInd : keysToExtract)
+		{
+			if (localCornerMap.contains(thisKeyInd))
+				continue;
+
+			// transformed clouds are shared between the cache and the local map, nothing is copied
+			TransformedKeyFrame thisKeyFrame;
+			const TransformedKeyFrame *cachedKeyFrame = laserCloudMapContainer.get(thisKeyInd);
+			if (cachedKeyFrame != nullptr)
+			{
+				// transformed cloud available
+				thisKeyFrame = *cachedKeyFrame;
+			}
+			else
+			{
+				// transformed cloud not available
+				KeyFrameStore<PointType>::KeyFrame keyFrame = keyFrameStore.get(thisKeyInd);
+				thisKeyFrame.corner = transformPointCloud(keyFrame.corner, &cloudKeyPoses6D->points[thisKeyInd]);
+				thisKeyFrame.surf = transformPointCloud(keyFrame.surf, &cloudKeyPoses6D->points[thisKeyInd]);
+				thisKeyFrame.pose = cloudKeyPoses6D->points[thisKeyInd];
+				size_t thisKeyFrameBytes = (thisKeyFrame.corner->size() + thisKeyFrame.surf->size()) * sizeof(PointType);
+				laserCloudMapContainer.put(thisKeyInd, thisKeyFrame, thisKeyFrameBytes);
+			}
+			localCornerMap.insert(thisKeyInd, thisKeyFrame.corner);
+			localSurfMap.insert(thisKeyInd, thisKeyFrame.surf);
+			localMapChanged = true;
+		}
+
+		// the voxel maps are already downsampled with mappingCornerLeafSize / mappingSurfLeafSize
+		if (localMapChanged)
+		{
+			localCornerMap.getCloud(*laserCloudCornerFromMapDS);
+			localSurfMap.getCloud(*laserCloudSurfFromMapDS);
+		}
+		laserCloudCornerFromMapDSNum = laserCloudCornerFromMapDS->size();
+		laserCloudSurfFromMapDSNum = laserCloudSurfFromMapDS->size();
+	}
+
+	void extractSurroundingKeyFrames()
+	{
+		TRACE_SPAN("mapping/extract_surrounding_ms");
+		if (cloudKeyPoses3D->points.empty() == true)
+			return;
+
+		// if (loopClosureEnableFlag == true)
+		// {
+		//     extractForLoopClosure();
+		// } else {
+		//     extractNearby();
+		// }
+
+		extractNearby();
+	}
+
+	void downsampleCurrentScan()
+	{
+		TRACE_SPAN("mapping/downsample_ms");
+		// giseop
+		laserCloudRawDS->clear();
+		downSizeFilterSC.setInputCloud(laserCloudRaw);
+		downSizeFilterSC.filter(*laserCloudRawDS);
+
+		// Downsample cloud from current scan
+		laserCloudCornerLastDS->clear();
+		downSizeFilterCorner.setInputCloud(laserCloudCornerLast);
+		downSizeFilterCorner.filter(*laserCloudCornerLastDS);
+		laserCloudCornerLastDSNum = laserCloudCornerLastDS->size();
+
+		laserCloudSurfLastDS->clear();
+		downSizeFilterSurf.setInputCloud(laserCloudSurfLast);
+		downSizeFilterSurf.filter(*laserCloudSurfLastDS);
+		laserCloudSurfLastDSNum = laserCloudSurfLastDS->size();
+	}
+
+	void updatePointAssociateToMap()
+	{
+		transPointAssociateToMap = trans2Affine3f(transformTobeMapped);
+	}
+
+	// adds the point-to-line residuals of the corner features to equations (each thread sums its own part, then reduced)
+	void cornerOptimization(LMNormalEquations &equations)
+	{
+		updatePointAssociateToMap();
+
+		LMNormalEquations partial = LMNormalEquations::emptyLike(equations);
+		uint64_t allocations = 0;
+#pragma omp parallel for num_threads(numberOfCores) reduction(+ : partial, allocations)
+		for (int i = 0; i < laserCloudCornerLastDSNum; i++)
+		{
+			const uint64_t allocationsBefore = threadAllocationCount();
+			PointType pointOri, pointSel, coeff;
+			int pointSearchInd[5];
+			float pointSearchSqDis[5];
+
+			pointOri = laserCloudCornerLastDS->points[i];
+			pointAssociateToMap(&pointOri, &pointSel);
+			const pcl::PointCloud<PointType> *mapCloud = laserCloudCornerFromMapDS.get();
+			int numFound = localizationMode ? localizationCornerMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis, mapCloud)
+																			: kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+
+			Eigen::Matrix3f matA1 = Eigen::Matrix3f::Zero();
+
+			if (numFound == 5 && pointSearchSqDis[4] < 1.0)
+			{
+				float cx = 0, cy = 0, cz = 0;
+				for (int j = 0; j < 5; j++)
+				{
+					cx += mapCloud->points[pointSearchInd[j]].x;
+					cy += mapCloud->points[pointSearchInd[j]].y;
+					cz += mapCloud->points[pointSearchInd[j]].z;
+				}
+				cx /= 5;
+				cy /= 5;
+				cz /= 5;
+
+				float a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+				for (int j = 0; j < 5; j++)
+				{
+					float ax = mapCloud->points[pointSearchInd[j]].x - cx;
+					float ay = mapCloud->points[pointSearchInd[j]].y - cy;
+					float az = mapCloud->points[pointSearchInd[j]].z - cz;
+
+					a11 += ax * ax;
+					a12 += ax * ay;
+					a13 += ax * az;
+					a22 += ay * ay;
+					a23 += ay * az;
+					a33 += az * az;
+				}
+				a11 /= 5;
+				a12 /= 5;
+				a13 /= 5;
+				a22 /= 5;
+				a23 /= 5;
+				a33 /= 5;
+
+				matA1(0, 0) = a11;
+				matA1(0, 1) = a12;
+				matA1(0, 2) = a13;
+				matA1(1, 0) = a12;
+				matA1(1, 1) = a22;
+				matA1(1, 2) = a23;
+				matA1(2, 0) = a13;
+				matA1(2, 1) = a23;
+				matA1(2, 2) = a33;
+
+				// fixed size, no allocation; eigenvalues in ascending order (cv::eigen's are descending)
+				Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigenSolver(matA1);
+				const Eigen::Vector3f &matD1 = eigenSolver.eigenvalues();
+				const Eigen::Vector3f lineDirection = eigenSolver.eigenvectors().col(2);
+
+				if (matD1(2) > 3 * matD1(1))
+				{
+
+					float x0 = pointSel.x;
+					float y0 = pointSel.y;
+					float z0 = pointSel.z;
+					float x1 = cx + 0.1 * lineDirection(0);
+					float y1 = cy + 0.1 * lineDirection(1);
+					float z1 = cz + 0.1 * lineDirection(2);
+					float x2 = cx - 0.1 * lineDirection(0);
+					float y2 = cy - 0.1 * lineDirection(1);
+					float z2 = cz - 0.1 * lineDirection(2);
+
+					float a012 = sqrt(((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) + ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) + ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)));
+
+					float l12 = sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2) + (z1 - z2) * (z1 - z2));
+
+					float la = ((y1 - y2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) + (z1 - z2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1))) / a012 / l12;
+
+					float lb = -((x1 - x2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) - (z1 - z2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
+
+					float lc = -((x1 - x2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) + (y1 - y2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
+
+					float ld2 = a012 / l12;
+
+					float s = 1 - 0.9 * fabs(ld2);
+
+					coeff.x = s * la;
+					coeff.y = s * lb;
+					coeff.z = s * lc;
+					coeff.intensity = s * ld2;
+
+					if (s > 0.1)
+					{
+						partial.add(pointOri, coeff);
+					}
+				}
+			}
+			if (omp_get_thread_num() != 0) // the mapping thread's own allocations are counted over the whole scan
+				allocations += threadAllocationCount() - allocationsBefore;
+		}
+		equations += partial;
+		scanAllocations += allocations;
+	}
+
+	// adds the point-to-plane residuals of the surf features to equations (each thread sums its own part, then reduced)
+	void surfOptimization(LMNormalEquations &equations)
+	{
+		updatePointAssociateToMap();
+
+		LMNormalEquations partial = LMNormalEquations::emptyLike(equations);
+		uint64_t allocations = 0;
+#pragma omp parallel for num_threads(numberOfCores) reduction(+ : partial, allocations)
+		for (int i = 0; i < laserCloudSurfLastDSNum; i++)
+		{
+			const uint64_t allocationsBefore = threadAllocationCount();
+			PointType pointOri, pointSel, coeff;
+			int pointSearchInd[5];
+			float pointSearchSqDis[5];
+
+			pointOri = laserCloudSurfLastDS->points[i];
+			pointAssociateToMap(&pointOri, &pointSel);
+			const pcl::PointCloud<PointType> *mapCloud = laserCloudSurfFromMapDS.get();
+			int numFound = localizationMode ? localizationSurfMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis, mapCloud)
+																			: kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+
+			Eigen::Matrix<float, 5, 3> matA0;
+			Eigen::Matrix<float, 5, 1> matB0;
+			Eigen::Vector3f matX0;
+
+			matA0.setZero();
+			matB0.fill(-1);
+			matX0.setZero();
+
+			if (numFound == 5 && pointSearchSqDis[4] < 1.0)
+			{
+				for (int j = 0; j < 5; j++)
+				{
+					matA0(j, 0) = mapCloud->points[pointSearchInd[j]].x;
+					matA0(j, 1) = mapCloud->points[pointSearchInd[j]].y;
+					matA0(j, 2) = mapCloud->points[pointSearchInd[j]].z;
+				}
+
+				matX0 = matA0.colPivHouseholderQr().solve(matB0);
+
+				float pa = matX0(0, 0);
+				float pb = matX0(1, 0);
+				float pc = matX0(2, 0);
+				float pd = 1;
+
+				float ps = sqrt(pa * pa + pb * pb + pc * pc);
+				pa /= ps;
+				pb /= ps;
+				pc /= ps;
+				pd /= ps;
+
+				bool planeValid = true;
+				for (int j = 0; j < 5; j++)
+				{
+					if (fabs(pa * mapCloud->points[pointSearchInd[j]].x +
+									 pb * mapCloud->points[pointSearchInd[j]].y +
+									 pc * mapCloud->points[pointSearchInd[j]].z + pd) > 0.2)
+					{
+						planeValid = false;
+						break;
+					}
+				}
+
+				if (planeValid)
+				{
+					float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
+
+					float s = 1 - 0.9 * fabs(pd2) / sqrt(sqrt(pointSel.x * pointSel.x + pointSel.y * pointSel.y + pointSel.z * pointSel.z));
+
+					coeff.x = s * pa;
+					coeff.y = s * pb;
+					coeff.z = s * pc;
+					coeff.intensity = s * pd2;
+
+					if (s > 0.1)
+					{
+						partial.add(pointOri, coeff);
+					}
+				}
+			}
+			if (omp_get_thread_num() != 0) // the mapping thread's own allocations are counted over the whole scan
+				allocations += threadAllocationCount() - allocationsBefore;
+		}
+		equations += partial;
+		scanAllocations += allocations;
+	}
+
+	bool LMOptimization(int iterCount, const LMNormalEquations &equations)
+	{
+		// This optimization is from the original loam_velodyne by Ji Zhang, need to cope with coordinate transformation
+		// lidar <- camera      ---     camera <- lidar
+		// x = z                ---     x = y
+		// y = x                ---     y = z
+		// z = y                ---     z = x
+		// roll = yaw           ---     roll = pitch
+		// pitch = roll         ---     pitch = yaw
+		// yaw = pitch          ---     yaw = roll
+
+		// the Jacobian rows (lidar -> camera) were already accumulated into equations, see LMNormalEquations::add
+		if (equations.numResiduals < 50)
+		{
+			return false;
+		}
+
+		// fixed-size (stack) matrices, cv::Mat would allocate on every iteration
+		Eigen::Matrix<float, 6, 6> matAtA = equations.AtA.cast<float>();
+		Eigen::Matrix<float, 6, 1> matAtB = equations.AtB.cast<float>();
+		Eigen::Matrix<float, 6, 1> matX = matAtA.colPivHouseholderQr().solve(matAtB);
+		Eigen::Matrix<float, 6, 6> matP = Eigen::Matrix<float, 6, 6>::Zero();
+
+		if (iterCount == 0)
+		{
+			// eigenvectors in rows, eigenvalues in descending order, as cv::eigen
+			Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> eigenSolver(matAtA);
+			Eigen::Matrix<float, 1, 6> matE = eigenSolver.eigenvalues().reverse().transpose();
+			Eigen::Matrix<float, 6, 6> matV = eigenSolver.eigenvectors().rowwise().reverse().transpose();
+			Eigen::Matrix<float, 6, 6> matV2 = matV;
+
+			isDegenerate = false;
+			float eignThre[6] = {100, 100, 100, 100, 100, 100};
+			for (int i = 5; i >= 0; i--)
+			{
+				if (matE(0, i) < eignThre[i])
+				{
+					for (int j = 0; j < 6; j++)
+					{
+						matV2(i, j) = 0;
+					}
+					isDegenerate = true;
+				}
+				else
+				{
+					break;
+				}
+			}
+			matP = matV.inverse() * matV2;
+		}
+
+		if (isDegenerate)
+		{
+			Eigen::Matrix<float, 6, 1> matX2 = matX;
+			matX = matP * matX2;
+		}
+
+		transformTobeMapped[0] += matX(0, 0);
+		transformTobeMapped[1] += matX(1, 0);
+		transformTobeMapped[2] += matX(2, 0);
+		transformTobeMapped[3] += matX(3, 0);
+		transformTobeMapped[4] += matX(4, 0);
+		transformTobeMapped[5] += matX(5, 0);
+
+		float deltaR = sqrt(
+				pow(pcl::rad2deg(matX(0, 0)), 2) +
+				pow(pcl::rad2deg(matX(1, 0)), 2) +
+				pow(pcl::rad2deg(matX(2, 0)), 2));
+		float deltaT = sqrt(
+				pow(matX(3, 0) * 100, 2) +
+				pow(matX(4, 0) * 100, 2) +
+				pow(matX(5, 0) * 100, 2));
+
+		if (deltaR < 0.05 && deltaT < 0.05)
+		{
+			return true; // converged
+		}
+		return false; // keep optimizing
+	}
+
+	void scan2MapOptimization()
+	{
+		if (poseInitialized() == false)
+			return;
+
+		TRACE_SPAN("mapping/scan2map_ms");
+
+		if (laserCloudCornerLastDSNum > edgeFeatureMinValidNum && laserCloudSurfLastDSNum > surfFeatureMinValidNum)
+		{
+			// rebuild the map kd-trees only if the local map changed since the last build (the localizationMode tiles never change)
+			if (localizationMode == false && localMapChanged)
+			{
+				kdtreeCornerFromMap.setInputCloud(laserCloudCornerFromMapDS);
+				kdtreeSurfFromMap.setInputCloud(laserCloudSurfFromMapDS);
+				localMapChanged = false;
+			}
+
+			const int maxIterations = overloadScheduler.maxIterations(30);
+			int iterCount = 0;
+			for (; iterCount < maxIterations; iterCount++)
+			{
+				TRACE_SPAN("mapping/lm_iteration_ms");
+				LMNormalEquations equations(transformTobeMapped);
+				cornerOptimization(equations);
+				surfOptimization(equations);
+
+				if (LMOptimization(iterCount, equations) == true)
+					break;
+			}
+			// looked up once, record() would build a std::string from the name in the allocation-free window of every scan
+			static MetricStat &lmIterations = Metrics::instance().stat("mapping/lm_iterations");
+			lmIterations.add(std::min(iterCount + 1, maxIterations));
+
+			transformUpdate();
+		}
+		else
+		{
+			ROS_WARN("Not enough features! Only %d edge and %d planar features available.", laserCloudCornerLastDSNum, laserCloudSurfLastDSNum);
+		}
+	}
+
+	void transformUpdate()
+	{
+		if (cloudInfo.imuAvailable == true)
+		{
+			if (std::abs(cloudInfo.imuPitchInit) < 1.4)
+			{
+				double imuWeight = imuRPYWeight;
+				tf::Quaternion imuQuaternion;
+				tf::Quaternion transformQuaternion;
+				double rollMid, pitchMid, yawMid;
+
+				// slerp roll
+				transformQuaternion.setRPY(transformTobeMapped[0], 0, 0);
+				imuQuaternion.setRPY(cloudInfo.imuRollInit, 0, 0);
+				tf::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
+				transformTobeMapped[0] = rollMid;
+
+				// slerp pitch
+				transformQuaternion.setRPY(0, transformTobeMapped[1], 0);
+				imuQuaternion.setRPY(0, cloudInfo.imuPitchInit, 0);
+				tf::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
+				transformTobeMapped[1] = pitchMid;
+			}
+		}
+
+		transformTobeMapped[0] = constraintTransformation(transformTobeMapped[0], rotation_tollerance);
+		transformTobeMapped[1] = constraintTransformation(transformTobeMapped[1], rotation_tollerance);
+		transformTobeMapped[5] = constraintTransformation(transformTobeMapped[5], z_tollerance);
+
+		incrementalOdometryAffineBack = trans2Affine3f(transformTobeMapped);
+	}
+
+	float constraintTransformation(float value, float limit)
+	{
+		if (value < -limit)
+			value = -limit;
+		if (value > limit)
+			value = limit;
+
+		return value;
+	}
+	// 根据位姿增量判断当前帧是否为关键帧
+	bool saveFrame()
+	{
+		if (cloudKeyPoses3D->points.empty())
+			return true;
+
+		Eigen::Affine3f transStart = pclPointToAffine3f(cloudKeyPoses6D->back());
+		Eigen::Affine3f transFinal = pcl::getTransformation(transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+																												transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+		Eigen::Affine3f transBetween = transStart.inverse() * transFinal;
+		float x, y, z, roll, pitch, yaw;
+		pcl::getTranslationAndEulerAngles(transBetween, x, y, z, roll, pitch, yaw);
+
+		// overloadScheduling: fewer keyframes, i.e., fewer factor graph updates and descriptors, while overloaded
+		const float angleThreshold = surroundingkeyframeAddingAngleThreshold * overloadScheduler.keyframeThresholdScale();
+		const float distThreshold = surroundingkeyframeAddingDistThreshold * overloadScheduler.keyframeThresholdScale();
+		if (abs(roll) < angleThreshold &&
+				abs(pitch) < angleThreshold &&
+				abs(yaw) < angleThreshold &&
+				sqrt(x * x + y * y + z * z) < distThreshold)
+			return false;
+
+		return true;
+	}
+	// 加入里程计因子
+	void addOdomFactor()
+	{
+		if (cloudKeyPoses3D->points.empty()) // 还没有历史关键帧，第一个位姿
+		{
+			noiseModel::Diagonal::shared_ptr priorNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-2, 1e-2, M_PI * M_PI, 1e8, 1e8, 1e8).finished()); // rad*rad, meter*meter
+			gtSAMgraph.add(PriorFactor<Pose3>(0, trans2gtsamPose(transformTobeMapped), priorNoise));
+			initialEstimate.insert(0, trans2gtsamPose(transformTobeMapped));
+
+			writeVertex(0, trans2gtsamPose(transformTobeMapped));
+		}
+		else
+		{
+			noiseModel::Diagonal::shared_ptr odometryNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
+			gtsam::Pose3 poseFrom = pclPointTogtsamPose3(cloudKeyPoses6D->points.back());
+			gtsam::Pose3 poseTo = trans2gtsamPose(transformTobeMapped);
+			gtsam::Pose3 relPose = poseFrom.between(poseTo);
+			gtSAMgraph.add(BetweenFactor<Pose3>(cloudKeyPoses3D->size() - 1, cloudKeyPoses3D->size(), relPose, odometryNoise));
+			initialEstimate.insert(cloudKeyPoses3D->size(), poseTo);
+
+			writeVertex(cloudKeyPoses3D->size(), poseTo);
+			writeEdge({cloudKeyPoses3D->size() - 1, cloudKeyPoses3D->size()}, relPose); // giseop
+		}
+	}
+
+	// marginal covariance of the latest key pose, computed on the first request after an iSAM update
+	// isamBackEndThread: the back-end computes it after its next update; false until one was delivered
+	bool latestPoseCovariance(Eigen::MatrixXd &covariance)
+	{
+		if (isamBackEndThread)
+		{
+			backEndCovarianceRequested = true;
+			if (poseCovariance.size() == 0)
+				return false;
+			covariance = poseCovariance;
+			return true;
+		}
+		if (poseCovarianceStale)
+		{
+			TicToc t_covariance;
+			poseCovariance = isam->marginalCovariance(cloudKeyPoses3D->size() - 1);
+			poseCovarianceStale = false;
+			Metrics::instance().record("isam/covariance_ms", t_covariance.toc("Pose covariance"));
+		}
+		covariance = poseCovariance;
+		return true;
+	}
+
+	void addGPSFactor()
+	{
+		if (gpsQueue.empty())
+			return;
+
+		// wait for system initialized and settles down
+		if (cloudKeyPoses3D->points.empty())
+			return;
+		else
+		{
+			if (pointDistance(cloudKeyPoses3D->front(), cloudKeyPoses3D->back()) < 5.0)
+				return;
+		}
+
+		// pose covariance small, no need to correct
+		Eigen::MatrixXd covariance;
+		if (latestPoseCovariance(covariance) == false)
+			return;
+		if (covariance(3, 3) < poseCovThreshold && covariance(4, 4) < poseCovThreshold)
+			return;
+
+		// last gps position
+		static PointType lastGPSPoint;
+
+		while (!gpsQueue.empty())
+		{
+			if (gpsQueue.front().header.stamp.toSec() < timeLaserInfoCur - 0.2)
+			{
+				// message too old
+				gpsQueue.pop_front();
+			}
+			else if (gpsQueue.front().header.stamp.toSec() > timeLaserInfoCur + 0.2)
+			{
+				// message too new
+				break;
+			}
+			else
+			{
+				nav_msgs::Odometry thisGPS = gpsQueue.front();
+				gpsQueue.pop_front();
+
+				// GPS too noisy, skip
+				float noise_x = thisGPS.pose.covariance[0];
+				float noise_y = thisGPS.pose.covariance[7];
+				float noise_z = thisGPS.pose.covariance[14];
+				if (noise_x > gpsCovThreshold || noise_y > gpsCovThreshold)
+					continue;
+
+				float gps_x = thisGPS.pose.pose.position.x;
+				float gps_y = thisGPS.pose.pose.position.y;
+				float gps_z = thisGPS.pose.pose.position.z;
+				if (!useGpsElevation)
+				{
+					gps_z = transformTobeMapped[5];
+					noise_z = 0.01;
+				}
+
+				// GPS not properly initialized (0,0,0)
+				if (abs(gps_x) < 1e-6 && abs(gps_y) < 1e-6)
+					continue;
+
+				// Add GPS every a few meters
+				PointType curGPSPoint;
+				curGPSPoint.x = gps_x;
+				curGPSPoint.y = gps_y;
+				curGPSPoint.z = gps_z;
+				if (pointDistance(curGPSPoint, lastGPSPoint) < 5.0)
+					continue;
+				else
+					lastGPSPoint = curGPSPoint;
+
+				gtsam::Vector Vector3(3);
+				Vector3 << max(noise_x, 1.0f), max(noise_y, 1.0f), max(noise_z, 1.0f);
+				noiseModel::Diagonal::shared_ptr gps_noise = noiseModel::Diagonal::Variances(Vector3);
+				gtsam::GPSFactor gps_factor(cloudKeyPoses3D->size(), gtsam::Point3(gps_x, gps_y, gps_z), gps_noise);
+				gtSAMgraph.add(gps_factor);
+
+				aLoopIsClosed = true;
+				break;
+			}
+		}
+	}
+
+	void addLoopFactor()
+	{
+		for (int i = 0; i < (int)priorLoopQueue.size(); ++i)
+		{
+			gtSAMgraph.add(PriorFactor<Pose3>(priorLoopQueue[i].first, priorLoopQueue[i].second, priorLoopNoiseQueue[i]));
+			aLoopIsClosed = true;
+		}
+		priorLoopQueue.clear();
+		priorLoopNoiseQueue.clear();
+
+		if (loopIndexQueue.empty())
+			return;
+
+		for (int i = 0; i < (int)loopIndexQueue.size(); ++i)
+		{
+			int indexFrom = loopIndexQueue[i].first;
+			int indexTo = loopIndexQueue[i].second;
+			gtsam::Pose3 poseBetween = loopPoseQueue[i];
+			// gtsam::noiseModel::Diagonal::shared_ptr noiseBetween = loopNoiseQueue[i]; // original
+			auto noiseBetween = loopNoiseQueue[i]; // giseop for polymorhpism // shared_ptr<gtsam::noiseModel::Base>, typedef noiseModel::Base::shared_ptr gtsam::SharedNoiseModel
+			gtSAMgraph.add(BetweenFactor<Pose3>(indexFrom, indexTo, poseBetween, noiseBetween));
+
+			writeEdge({indexFrom, indexTo}, poseBetween); // giseop
+		}
+
+		loopIndexQueue.clear();
+		loopPoseQueue.clear();
+		loopNoiseQueue.clear();
+
+		aLoopIsClosed = true;
+	}
+	/**
+	 * 设置当前帧为关键帧并执行因子图优化
+	 * 1、计算当前帧与前一帧位姿变换，如果变化太小，不设为关键帧，反之设为关键帧
+	 * 2、添加激光里程计因子、GPS因子、闭环因子
+	 * 3、执行因子图优化
+	 * 4、得到当前帧优化后位姿，位姿协方差
+	 * 5、添加keyPoses3D，keyPoses6D，更新latestPose6D，添加当前关键帧的角点、平面点集合
+	 */
+	void saveKeyFramesAndFactor()
+	{
+		TRACE_SPAN("mapping/save_keyframe_ms");
+		if (saveFrame() == false)
+			return;
+
+		// odom factor
+		addOdomFactor();
+
+		// gps factor
+		addGPSFactor();
+
+		// loop factor
+		addLoopFactor(); // radius search loop factor (I changed the orignal func name addLoopFactor to addLoopFactor)
+
+		// update iSAM
+		Pose3 latestEstimate;
+		if (isamBackEndThread)
+			latestEstimate = enqueueBackEndJob();
+		else
+			latestEstimate = updateIsam(gtSAMgraph, initialEstimate, aLoopIsClosed, cloudKeyPoses3D->size(), isamCurrentEstimate);
+		// update之后要清空一下保存的因子图，注：历史数据不会清掉，ISAM保存起来了
+		gtSAMgraph.resize(0);
+		initialEstimate.clear();
+
+		// save key poses
+		PointType thisPose3D;
+		PointTypePose thisPose6D;
+
+		// cout << "****************************************************" << endl;
+		// isamCurrentEstimate.print("Current estimate: ");
+		// keyPose3D加入当前关键帧位置
+		thisPose3D.x = latestEstimate.translation().x();
+		thisPose3D.y = latestEstimate.translation().y();
+		thisPose3D.z = latestEstimate.translation().z();
+		thisPose3D.intensity = cloudKeyPoses3D->size(); // this can be used as index
+		cloudKeyPoses3D->push_back(thisPose3D);
+		// keyPoses6D加入当前帧位姿
+		thisPose6D.x = thisPose3D.x;
+		thisPose6D.y = thisPose3D.y;
+		thisPose6D.z = thisPose3D.z;
+		thisPose6D.intensity = thisPose3D.intensity; // this can be used as index
+		thisPose6D.roll = latestEstimate.rotation().roll();
+		thisPose6D.pitch = latestEstimate.rotation().pitch();
+		thisPose6D.yaw = latestEstimate.rotation().yaw();
+		thisPose6D.time = timeLaserInfoCur;
+		cloudKeyPoses6D->push_back(thisPose6D);
+
+		// cout << "****************************************************" << endl;
+		// cout << "Pose covariance:" << endl;
+		// cout << isam->marginalCovariance(isamCurrentEstimate.size()-1) << endl << endl;
+
+		// save updated transform
+		transformTobeMapped[0] = latestEstimate.rotation().roll();
+		transformTobeMapped[1] = latestEstimate.rotation().pitch();
+		transformTobeMapped[2] = latestEstimate.rotation().yaw();
+		transformTobeMapped[3] = latestEstimate.translation().x();
+		transformTobeMapped[4] = latestEstimate.translation().y();
+		transformTobeMapped[5] = latestEstimate.translation().z();
+
+		// save all the received edge and surf points
+		pcl::PointCloud<PointType>::Ptr thisCornerKeyFrame(new pcl::PointCloud<PointType>());
+		pcl::PointCloud<PointType>::Ptr thisSurfKeyFrame(new pcl::PointCloud<PointType>());
+		pcl::copyPointCloud(*laserCloudCornerLastDS, *thisCornerKeyFrame);
+		pcl::copyPointCloud(*laserCloudSurfLastDS, *thisSurfKeyFrame);
+
+		// save key frame cloud
+		keyFrameStore.push_back(thisCornerKeyFrame, thisSurfKeyFrame);
+		keyFrameStore.enforceBudget(*cloudKeyPoses3D); // spills the keyframes farthest from this one if over keyframeMemoryBudget
+		Metrics::instance().record("keyframes/resident_mb", keyFrameStore.residentBytes() / (1024.0 * 1024.0));
+		Metrics::instance().record("keyframes/spilled", keyFrameStore.spilledCount());
+		Metrics::instance().record("keyframes/page_ins", keyFrameStore.pageIns());
+
+		// Scan Context loop detector - giseop
+		// - SINGLE_SCAN_FULL: using downsampled original point cloud (/full_cloud_projected + downsampling)
+		// - SINGLE_SCAN_FEAT: using surface feature as an input point cloud for scan context (2020.04.01: checked it works.)
+		// - MULTI_SCAN_FEAT: using NearKeyframes (because a MulRan scan does not have beyond region, so to solve this issue ... )
+		const SCInputType sc_input_type = SCInputType::SINGLE_SCAN_FULL; // change this
+
+		if (sc_input_type == SCInputType::SINGLE_SCAN_FULL)
+		{
+			pcl::PointCloud<PointType>::Ptr thisRawCloudKeyFrame(new pcl::PointCloud<PointType>());
+			pcl::copyPointCloud(*laserCloudRawDS, *thisRawCloudKeyFrame);
+			scManager.makeAndSaveScancontextAndKeys(*thisRawCloudKeyFrame);
+		}
+		else if (sc_input_type == SCInputType::SINGLE_SCAN_FEAT)
+		{
+			scManager.makeAndSaveScancontextAndKeys(*thisSurfKeyFrame);
+		}
+		else if (sc_input_type == SCInputType::MULTI_SCAN_FEAT)
+		{
+			pcl::PointCloud<PointType>::Ptr multiKeyFrameFeatureCloud(new pcl::PointCloud<PointType>());
+			loopFindNearKeyframes(multiKeyFrameFeatureCloud, cloudKeyPoses6D->size() - 1, historyKeyframeSearchNum);
+			scManager.makeAndSaveScancontextAndKeys(*multiKeyFrameFeatureCloud);
+		}
+
+		// save sc data (the descriptor is read in place from scManager, whose records never move)
+		const auto curr_scd = scManager.getConstRefRecentSCD();
+		std::string curr_scd_node_idx = padZeros(scManager.numDescriptors() - 1);
+
+		if (sessionFile)
+		{
+			const uint64_t key = scManager.numDescriptors() - 1;
+			pushKeyframeWrite([this, key, curr_scd]() { sessionFile->append(SESSION_DESCRIPTOR, key, curr_scd.data(), sizeof(SCDescriptor)); });
+		}
+		else if (saveBinarySCD)
+		{
+			const std::string scdFileName = saveSCDDirectory + curr_scd_node_idx + ".bin";
+			pushKeyframeWrite([scdFileName, curr_scd]() { saveSCDBinary(scdFileName, curr_scd); });
+		}
+		else
+		{
+			const std::string scdFileName = saveSCDDirectory + curr_scd_node_idx + ".scd";
+			pushKeyframeWrite([scdFileName, curr_scd]() { saveSCD(scdFileName, curr_scd); });
+		}
+
+		// save keyframe cloud as file giseop
+		bool saveRawCloud{true};
+		pcl::PointCloud<PointType>::Ptr thisKeyFrameCloud(new pcl::PointCloud<PointType>());
+		if (saveRawCloud)
+		{
+			*thisKeyFrameCloud += *laserCloudRaw;
+		}
+		else
+		{
+			*thisKeyFrameCloud += *thisCornerKeyFrame;
+			*thisKeyFrameCloud += *thisSurfKeyFrame;
+		}
+		// the writer takes over thisKeyFrameCloud, nothing else references it
+		if (sessionFile)
+		{
+			const uint64_t key = scManager.numDescriptors() - 1;
+			pushKeyframeWrite([this, key, thisKeyFrameCloud]()
+			{
+				std::vector<float> payload;
+				encodeSessionCloud(*thisKeyFrameCloud, payload);
+				sessionFile->append(SESSION_CLOUD, key, payload.data(), payload.size() * sizeof(float));
+			});
+		}
+		else
+		{
+			const std::string pcdFileName = saveNodePCDDirectory + curr_scd_node_idx + ".pcd";
+			pushKeyframeWrite([pcdFileName, thisKeyFrameCloud]() { pcl::io::savePCDFileBinary(pcdFileName, *thisKeyFrameCloud); });
+		}
+		pgTimeSaveStream << laserCloudRawTime << std::endl;
+
+		// save path for visualization
+		updatePath(thisPose6D);
+	}
+
+	// queues a file write; blocks only if keyframeWriterQueueSize writes are already pending (back-pressure)
+	void pushKeyframeWrite(std::function<void()> write)
+	{
+		Metrics::instance().record("io/keyframe_writer_depth", keyframeWriter->pending());
+
+		TicToc t_push;
+		keyframeWriter->push([write]()
+		{
+			TicToc t_write;
+			write();
+			Metrics::instance().record("io/keyframe_write_ms", t_write.toc("Keyframe write"));
+		});
+		Metrics::instance().record("io/keyframe_writer_wait_ms", t_push.toc("Keyframe writer wait"));
+	}
+
+	/**
+	 * 执行iSAM2更新，返回关键帧latestKey的优化位姿
+	 * 同步模式下由建图线程调用，isamBackEndThread下只由后端线程调用（isam归后端线程所有）
+	 * fullEstimate: 只在需要整条轨迹时（非isamBatchedUpdates，或有闭环）更新
+	 */
+	Pose3 updateIsam(const NonlinearFactorGraph &graph, const Values &values, bool loopClosed, int latestKey, Values &fullEstimate)
+	{
+		{ // the updates, not the estimate below
+			TRACE_SPAN("isam/update_ms");
+			ISAM2Result result = isamWindowSize > 0 ? updateIsamWindow(graph, values, latestKey) : isam->update(graph, values);
+			if (isamBatchedUpdates)
+			{
+				// iterate only while iSAM2 still relinearizes something, i.e. some delta is above relinearizeThreshold
+				int numUpdates = 1;
+				int maxUpdates = loopClosed ? 2 + isamMaxExtraUpdates : 2; // as many as before at most
+				while (numUpdates < maxUpdates && (numUpdates == 1 || result.variablesRelinearized > 0))
+				{
+					result = isam->update();
+					++numUpdates;
+				}
+				Metrics::instance().record("isam/updates", numUpdates);
+			}
+			else
+			{
+				isam->update();
+
+				if (loopClosed == true)
+				{
+					isam->update();
+					isam->update();
+					isam->update();
+					isam->update();
+					isam->update();
+				}
+			}
+		}
+		poseCovarianceStale = true;
+
+		// the full trajectory is only needed when a loop moved it (correctPoses)
+		if (isamBatchedUpdates == false || loopClosed == true)
+		{
+			fullEstimate = isam->calculateEstimate();
+			return fullEstimate.at<Pose3>(latestKey);
+		}
+		return isam->calculateEstimate<Pose3>(latestKey);
+	}
+
+	/**
+	 * isamWindowSize下的iSAM2更新：因子图只保留最近isamWindowSize个关键帧
+	 * 1、更早的关键帧在本次更新中约束为最先消元（成为Bayes tree的叶子），更新后边缘化，位姿固定在当时的估计值(isamMarginalizedPoses)
+	 * 2、连接到已边缘化关键帧的闭环因子，改为对窗口内关键帧的先验因子
+	 * 每个关键帧的更新代价和iSAM2的内存与轨迹长度无关
+	 */
+	ISAM2Result updateIsamWindow(const NonlinearFactorGraph &graph, const Values &values, int latestKey)
+	{
+		NonlinearFactorGraph newFactors;
+		for (const auto &factor : graph)
+		{
+			auto prior = boost::dynamic_pointer_cast<PriorFactor<Pose3>>(factor);
+			if (prior && isamMarginalizedPoses.exists(prior->key()))
+				continue; // a prior-session loop on a fixed keyframe
+			auto between = boost::dynamic_pointer_cast<BetweenFactor<Pose3>>(factor);
+			const bool fixed1 = between && isamMarginalizedPoses.exists(between->key1());
+			const bool fixed2 = between && isamMarginalizedPoses.exists(between->key2());
+			if (fixed1 && fixed2)
+				continue; // both ends are fixed already
+			else if (fixed1) // X2 = X1 * measured
+				newFactors.add(PriorFactor<Pose3>(between->key2(), isamMarginalizedPoses.at<Pose3>(between->key1()) * between->measured(), between->noiseModel()));
+			else if (fixed2)
+				newFactors.add(PriorFactor<Pose3>(between->key1(), isamMarginalizedPoses.at<Pose3>(between->key2()) * between->measured().inverse(), between->noiseModel()));
+			else
+				newFactors.add(factor);
+		}
+
+		const int windowStart = latestKey + 1 - std::max(isamWindowSize, 2);
+		if (windowStart <= isamWindowStart)
+			return isam->update(newFactors, values);
+
+		// as gtsam's IncrementalFixedLagSmoother: eliminate the keys to marginalize first, re-eliminating the cliques below them
+		FastList<Key> marginalKeys;
+		FastMap<Key, int> constrainedKeys;
+		std::set<Key> reelimKeys;
+		for (int key = isamWindowStart; key < windowStart; ++key)
+		{
+			marginalKeys.push_back(key);
+			for (const auto &child : (*isam)[key]->children)
+				markCliquesBelow(key, child, reelimKeys);
+		}
+		for (const auto &key_value : isam->getLinearizationPoint())
+			constrainedKeys[key_value.key] = int(key_value.key) < windowStart ? 0 : 1;
+		for (const auto &key_value : values)
+			constrainedKeys[key_value.key] = 1;
+
+		ISAM2Result result = isam->update(newFactors, values, FactorIndices(), constrainedKeys, boost::none,
+										  FastList<Key>(reelimKeys.begin(), reelimKeys.end()));
+		for (Key key : marginalKeys)
+			isamMarginalizedPoses.insert(key, isam->calculateEstimate<Pose3>(key));
+		isam->marginalizeLeaves(marginalKeys);
+		isamWindowStart = windowStart;
+		Metrics::instance().record("isam/marginalized", marginalKeys.size());
+		return result;
+	}
+
+	// the frontal keys of the cliques under _clique that have _key in their separator
+	void markCliquesBelow(Key _key, const ISAM2Clique::shared_ptr &_clique, std::set<Key> &_keys)
+	{
+		const auto &conditional = _clique->conditional();
+		if (std::find(conditional->beginParents(), conditional->endParents(), _key) == conditional->endParents())
+			return;
+		for (Key frontal : conditional->frontals())
+			_keys.insert(frontal);
+		for (const auto &child : _clique->children)
+			markCliquesBelow(_key, child, _keys);
+	}
+
+	/**
+	 * isamBackEndThread: 把本关键帧的新因子交给后端线程，当前帧位姿先用scan-to-map的结果(transformTobeMapped)
+	 * 后端提交结果后，在applyBackEndResults中校正
+	 */
+	Pose3 enqueueBackEndJob()
+	{
+		BackEndJob job;
+		job.graph = gtSAMgraph;
+		job.values = initialEstimate;
+		job.loopClosed = aLoopIsClosed;
+		job.key = cloudKeyPoses3D->size();
+		aLoopIsClosed = false; // the poses are corrected once the back-end has committed this job
+		{
+			std::lock_guard<std::mutex> lock(backEndMtx);
+			backEndJobs.push_back(std::move(job));
+			Metrics::instance().record("isam/backend_queue", backEndJobs.size());
+		}
+		backEndCondition.notify_one();
+		return trans2gtsamPose(transformTobeMapped);
+	}
+
+	// isamBackEndThread: owns isam; commits the queued jobs in order
+	void backEndThread()
+	{
+		while (true)
+		{
+			BackEndJob job;
+			{
+				std::unique_lock<std::mutex> lock(backEndMtx);
+				backEndCondition.wait(lock, [this]() { return backEndStop || !backEndJobs.empty(); });
+				if (backEndJobs.empty())
+					return; // stopped and drained
+				job = std::move(backEndJobs.front());
+				backEndJobs.pop_front();
+			}
+
+			TicToc t_backEnd;
+			BackEndResult result;
+			result.key = job.key;
+			result.loopClosed = job.loopClosed;
+			result.latest = updateIsam(job.graph, job.values, job.loopClosed, job.key, result.estimate);
+			if (backEndCovarianceRequested.exchange(false))
+			{
+				result.covariance = isam->marginalCovariance(job.key);
+				result.hasCovariance = true;
+			}
+			Metrics::instance().record("isam/backend_ms", t_backEnd.toc("iSAM back-end"));
+
+			std::lock_guard<std::mutex> lock(backEndMtx);
+			backEndResults.push_back(std::move(result));
+		}
+	}
+
+	/**
+	 * 建图结束时（保存之前）把关键帧位姿更新为最终估计：
+	 * 1、isamBackEndThread下提交队列中的关键帧，停止后端线程，应用其尚未应用的结果
+	 * 2、isamBatchedUpdates、isamBackEndThread只在闭环时刷新isamCurrentEstimate，isamWindowSize下只有窗口内的关键帧，这里重新计算整条轨迹并校正cloudKeyPoses3D/6D
+	 */
+	void flushBackEnd()
+	{
+		stopBackEnd();
+
+		std::lock_guard<std::mutex> lock(mtx);
+		if (isamBackEndThread)
+			applyBackEndResults();
+		if (cloudKeyPoses3D->points.empty() || (isamBatchedUpdates == false && isamBackEndThread == false && isamWindowSize == 0))
+			return; // every update refreshed the estimate and the poses
+
+		isamCurrentEstimate = isam->calculateEstimate();
+		if (isamWindowSize > 0)
+			isamCurrentEstimate.insert(isamMarginalizedPoses); // the whole trajectory
+		aLoopIsClosed = true;
+		correctPoses();
+	}
+
+	// commits what is still queued and joins the back-end thread; isam belongs to the caller afterwards
+	void stopBackEnd()
+	{
+		if (!backEndWorker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(backEndMtx);
+			backEndStop = true;
+		}
+		backEndCondition.notify_one();
+		backEndWorker.join();
+	}
+
+	/**
+	 * isamBackEndThread下，在处理新一帧之前（持有mtx）应用后端已提交的结果：
+	 * 1、已提交的关键帧位姿改为iSAM2的估计；有闭环时用整条轨迹校正（correctPoses）
+	 * 2、尚未提交的关键帧位姿和transformTobeMapped做同样的刚体校正，跟随最新的已提交关键帧
+	 */
+	void applyBackEndResults()
+	{
+		std::deque<BackEndResult> results;
+		{
+			std::lock_guard<std::mutex> lock(backEndMtx);
+			results.swap(backEndResults);
+		}
+
+		for (BackEndResult &result : results)
+		{
+			if (result.hasCovariance)
+				poseCovariance = result.covariance;
+
+			const int key = result.key;
+			const Eigen::Affine3f before = pclPointToAffine3f(cloudKeyPoses6D->points[key]);
+			if (result.loopClosed)
+			{
+				isamCurrentEstimate = std::move(result.estimate);
+				aLoopIsClosed = true;
+				correctPoses(); // the committed keys 0..key
+			}
+			else
+			{
+				PointTypePose &pose = cloudKeyPoses6D->points[key];
+				PointTypePose committed = pose;
+				setPoseFromGtsam(committed, result.latest);
+				if (keyPoseMoved(pose, committed))
+					laserCloudMapContainer.erase(key);
+				pose = committed;
+				cloudKeyPoses3D->points[key].x = pose.x;
+				cloudKeyPoses3D->points[key].y = pose.y;
+				cloudKeyPoses3D->points[key].z = pose.z;
+				globalPath.poses[key] = makePathPose(pose);
+			}
+
+			// the uncommitted keys were estimated relative to key
+			const Eigen::Affine3f correction = pclPointToAffine3f(cloudKeyPoses6D->points[key]) * before.inverse();
+			for (int i = key + 1; i < (int)cloudKeyPoses6D->size(); ++i)
+			{
+				PointTypePose &pose = cloudKeyPoses6D->points[i];
+				PointTypePose corrected = pose;
+				Eigen::Affine3f transCorrected = correction * pclPointToAffine3f(pose);
+				pcl::getTranslationAndEulerAngles(transCorrected, corrected.x, corrected.y, corrected.z, corrected.roll, corrected.pitch, corrected.yaw);
+				if (keyPoseMoved(pose, corrected))
+					laserCloudMapContainer.erase(i);
+				pose = corrected;
+				cloudKeyPoses3D->points[i].x = pose.x;
+				cloudKeyPoses3D->points[i].y = pose.y;
+				cloudKeyPoses3D->points[i].z = pose.z;
+				if (i < (int)globalPath.poses.size())
+					globalPath.poses[i] = makePathPose(pose);
+				else
+					updatePath(pose); // correctPoses rebuilt the path up to key only
+			}
+
+			Eigen::Affine3f transCurrent = correction * trans2Affine3f(transformTobeMapped);
+			pcl::getTranslationAndEulerAngles(transCurrent, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+											  transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+		}
+	}
+
+	void setPoseFromGtsam(PointTypePose &pose, const Pose3 &estimate)
+	{
+		pose.x = estimate.translation().x();
+		pose.y = estimate.translation().y();
+		pose.z = estimate.translation().z();
+		pose.roll = estimate.rotation().roll();
+		pose.pitch = estimate.rotation().pitch();
+		pose.yaw = estimate.rotation().yaw();
+	}
+
+	void correctPoses()
+	{
+		if (cloudKeyPoses3D->points.empty())
+			return;
+		// 一旦有新的Prior Factor, GPS Factor 或 Loop Factor加入，则更新历史关键帧位姿
+		if (aLoopIsClosed == true)
+		{
+			localMapNeedsRebuild = true; // re-project the local map with the corrected poses
+			globalVizMapNeedsRebuild = true; // and the global map visualization
+			if (isamBatchedUpdates || isamWindowSize > 0)
+			{
+				correctMovedPoses();
+				++poseGeneration; // loop targets built from the old poses are stale
+				aLoopIsClosed = false;
+				return;
+			}
+			// clear path
+			globalPath.poses.clear(); // clear path 清空里程计轨迹
+			// update key poses 更新因子图中所有变量节点的位姿，也就是所有历史关键帧的位姿
+			int numPoses = isamCurrentEstimate.size();
+			for (int i = 0; i < numPoses; ++i)
+			{
+				cloudKeyPoses3D->points[i].x = isamCurrentEstimate.at<Pose3>(i).translation().x();
+				cloudKeyPoses3D->points[i].y = isamCurrentEstimate.at<Pose3>(i).translation().y();
+				cloudKeyPoses3D->points[i].z = isamCurrentEstimate.at<Pose3>(i).translation().z();
+
+				cloudKeyPoses6D->points[i].x = cloudKeyPoses3D->points[i].x;
+				cloudKeyPoses6D->points[i].y = cloudKeyPoses3D->points[i].y;
+				cloudKeyPoses6D->points[i].z = cloudKeyPoses3D->points[i].z;
+				cloudKeyPoses6D->points[i].roll = isamCurrentEstimate.at<Pose3>(i).rotation().roll();
+				cloudKeyPoses6D->points[i].pitch = isamCurrentEstimate.at<Pose3>(i).rotation().pitch();
+				cloudKeyPoses6D->points[i].yaw = isamCurrentEstimate.at<Pose3>(i).rotation().yaw();
+				// 更新里程计轨迹
+				updatePath(cloudKeyPoses6D->points[i]);
+			}
+
+			// invalidate only the cached clouds whose key pose actually moved
+			laserCloudMapContainer.eraseIf([&](const int &key, const TransformedKeyFrame &cached)
+																		 { return keyPoseMoved(cached.pose, cloudKeyPoses6D->points[key]); });
+
+			++poseGeneration; // loop targets built from the old poses are stale
+			aLoopIsClosed = false;
+		}
+	}
+
+	/**
+	 * isamBatchedUpdates或isamWindowSize下的位姿校正（isamCurrentEstimate中的关键帧）：只更新移动超过keyframeCacheInvalidateDist/Angle的关键帧位姿，轨迹原地修改，不清空重建
+	 * 其余位姿保持不变，它们的缓存点云也保持有效
+	 */
+	void correctMovedPoses()
+	{
+		TicToc t_correct;
+		int numMoved = 0;
+		for (const auto &key_value : isamCurrentEstimate)
+		{
+			const int i = key_value.key;
+			const Pose3 &estimate = key_value.value.cast<Pose3>();
+			PointTypePose corrected = cloudKeyPoses6D->points[i];
+			corrected.x = estimate.translation().x();
+			corrected.y = estimate.translation().y();
+			corrected.z = estimate.translation().z();
+			corrected.roll = estimate.rotation().roll();
+			corrected.pitch = estimate.rotation().pitch();
+			corrected.yaw = estimate.rotation().yaw();
+			if (keyPoseMoved(cloudKeyPoses6D->points[i], corrected) == false)
+				continue;
+
+			cloudKeyPoses6D->points[i] = corrected;
+			cloudKeyPoses3D->points[i].x = corrected.x;
+			cloudKeyPoses3D->points[i].y = corrected.y;
+			cloudKeyPoses3D->points[i].z = corrected.z;
+			globalPath.poses[i] = makePathPose(corrected);
+			laserCloudMapContainer.erase(i);
+			++numMoved;
+		}
+		Metrics::instance().record("isam/corrected_poses", numMoved);
+		Metrics::instance().record("isam/correct_poses_ms", t_correct.toc("Correct poses"));
+	}
+
+	bool keyPoseMoved(const PointTypePose &poseFrom, const PointTypePose &poseTo)
+	{
+		Eigen::Affine3f transBetween = pclPointToAffine3f(poseFrom).inverse() * pclPointToAffine3f(poseTo);
+		if (transBetween.translation().norm() > keyframeCacheInvalidateDist)
+			return true;
+		return Eigen::AngleAxisf(transBetween.rotation()).angle() > keyframeCacheInvalidateAngle;
+	}
+
+	void updatePath(const PointTypePose &pose_in)
+	{
+		globalPath.poses.push_back(makePathPose(pose_in));
+	}
+
+	geometry_msgs::PoseStamped makePathPose(const PointTypePose &pose_in)
+	{
+		geometry_msgs::PoseStamped pose_stamped;
+		pose_stamped.header.stamp = ros::Time().fromSec(pose_in.time);
+		pose_stamped.header.frame_id = odometryFrame;
+		pose_stamped.pose.position.x = pose_in.x;
+		pose_stamped.pose.position.y = pose_in.y;
+		pose_stamped.pose.position.z = pose_in.z;
+		tf::Quaternion q = tf::createQuaternionFromRPY(pose_in.roll, pose_in.pitch, pose_in.yaw);
+		pose_stamped.pose.orientation.x = q.x();
+		pose_stamped.pose.orientation.y = q.y();
+		pose_stamped.pose.orientation.z = q.z();
+		pose_stamped.pose.orientation.w = q.w();
+		return pose_stamped;
+	}
+
+	void publishOdometry()
+	{
+		// Publish odometry for ROS (global)
+		nav_msgs::Odometry laserOdometryROS;
+		laserOdometryROS.header.stamp = timeLaserInfoStamp;
+		laserOdometryROS.header.frame_id = odometryFrame;
+		laserOdometryROS.child_frame_id = "odom_mapping";
+		laserOdometryROS.pose.pose.position.x = transformTobeMapped[3];
+		laserOdometryROS.pose.pose.position.y = transformTobeMapped[4];
+		laserOdometryROS.pose.pose.position.z = transformTobeMapped[5];
+		laserOdometryROS.pose.pose.orientation = tf::createQuaternionMsgFromRollPitchYaw(transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
+		pubLaserOdometryGlobal.publish(laserOdometryROS);
+
+		// Publish TF
+		static tf::TransformBroadcaster br;
+		tf::Transform t_odom_to_lidar = tf::Transform(tf::createQuaternionFromRPY(transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]),
+																									tf::Vector3(transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5]));
+		tf::StampedTransform trans_odom_to_lidar = tf::StampedTransform(t_odom_to_lidar, timeLaserInfoStamp, odometryFrame, "lidar_link");
+		br.sendTransform(trans_odom_to_lidar);
+
+		// Publish odometry for ROS (incremental)
+		static bool lastIncreOdomPubFlag = false;
+		static nav_msgs::Odometry laserOdomIncremental; // incremental odometry msg
+		static Eigen::Affine3f increOdomAffine;					// incremental odometry in affine
+		if (lastIncreOdomPubFlag == false)
+		{
+			lastIncreOdomPubFlag = true;
+			laserOdomIncremental = laserOdometryROS;
+			increOdomAffine = trans2Affine3f(transformTobeMapped);
+		}
+		else
+		{
+			Eigen::Affine3f affineIncre = incrementalOdometryAffineFront.inverse() * incrementalOdometryAffineBack;
+			increOdomAffine = increOdomAffine * affineIncre;
+			float x, y, z, roll, pitch, yaw;
+			pcl::getTranslationAndEulerAngles(increOdomAffine, x, y, z, roll, pitch, yaw);
+			if (cloudInfo.imuAvailable == true)
+			{
+				if (std::abs(cloudInfo.imuPitchInit) < 1.4)
+				{
+					double imuWeight = 0.1;
+					tf::Quaternion imuQuaternion;
+					tf::Quaternion transformQuaternion;
+					double rollMid, pitchMid, yawMid;
+
+					// slerp roll
+					transformQuaternion.setRPY(roll, 0, 0);
+					imuQuaternion.setRPY(cloudInfo.imuRollInit, 0, 0);
+					tf::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
+					roll = rollMid;
+
+					// slerp pitch
+					transformQuaternion.setRPY(0, pitch, 0);
+					imuQuaternion.setRPY(0, cloudInfo.imuPitchInit, 0);
+					tf::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
+					pitch = pitchMid;
+				}
+			}
+			laserOdomIncremental.header.stamp = timeLaserInfoStamp;
+			laserOdomIncremental.header.frame_id = odometryFrame;
+			laserOdomIncremental.child_frame_id = "odom_mapping";
+			laserOdomIncremental.pose.pose.position.x = x;
+			laserOdomIncremental.pose.pose.position.y = y;
+			laserOdomIncremental.pose.pose.position.z = z;
+			laserOdomIncremental.pose.pose.orientation = tf::createQuaternionMsgFromRollPitchYaw(roll, pitch, yaw);
+			if (isDegenerate)
+				laserOdomIncremental.pose.covariance[0] = 1;
+			else
+				laserOdomIncremental.pose.covariance[0] = 0;
+		}
+		pubLaserOdometryIncremental.publish(laserOdomIncremental);
+	}
+
+	// cloud_registered: the downsampled features of the current scan in the map frame
+	void publishRegisteredScan()
+	{
+		PointTypePose thisPose6D = trans2PointTypePose(transformTobeMapped);
+		*registeredScan = *laserCloudCornerLastDS;
+		*registeredScan += *laserCloudSurfLastDS;
+		transformPointCloud(*registeredScan, &thisPose6D, *registeredScan);
+		publishCloud(&pubRecentKeyFrame, registeredScan, timeLaserInfoStamp, odometryFrame);
+	}
+
+	// localizationMode: the map tiles around the pose and the registered scan
+	void publishLocalizationFrames()
+	{
+		if (pubRecentKeyFrames.getNumSubscribers() != 0)
+		{
+			pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
+			localizationSurfMap.getNeighborhood(transformTobeMapped[3], transformTobeMapped[4], surroundingKeyframeSearchRadius, *cloudOut);
+			publishCloud(&pubRecentKeyFrames, cloudOut, timeLaserInfoStamp, odometryFrame);
+		}
+		if (pubRecentKeyFrame.getNumSubscribers() != 0)
+			publishRegisteredScan();
+	}
+
+	void publishFrames()
+	{
+		if (localizationMode)
+		{
+			publishLocalizationFrames();
+			return;
+		}
+		if (cloudKeyPoses3D->points.empty())
+			return;
+		// publish key poses
+		publishCloud(&pubKeyPoses, cloudKeyPoses3D, timeLaserInfoStamp, odometryFrame);
+		// Publish surrounding key frames
+		publishCloud(&pubRecentKeyFrames, laserCloudSurfFromMapDS, timeLaserInfoStamp, odometryFrame);
+		// publish registered key frame
+		if (pubRecentKeyFrame.getNumSubscribers() != 0)
+			publishRegisteredScan();
+		// publish registered high-res raw cloud
+		if (pubCloudRegisteredRaw.getNumSubscribers() != 0)
+		{
+			pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
+			pcl::fromROSMsg(cloudInfo.cloud_deskewed, *cloudOut);
+			PointTypePose thisPose6D = trans2PointTypePose(transformTobeMapped);
+			*cloudOut = *transformPointCloud(cloudOut, &thisPose6D);
+			publishCloud(&pubCloudRegisteredRaw, cloudOut, timeLaserInfoStamp, odometryFrame);
+		}
+		// publish path
+		if (pubPath.getNumSubscribers() != 0)
+		{
+			globalPath.header.stamp = timeLaserInfoStamp;
+			globalPath.header.frame_id = odometryFrame;
+			pubPath.publish(globalPath);
+		}
+	}
+};
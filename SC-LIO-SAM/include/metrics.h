@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+/*
+ * Process-wide runtime metrics.
+ *
+ * A metric is a named stream of samples (typically a duration in ms, e.g. from TicToc::toc) summarized
+ * as count / mean / max / last and p50 / p90 / p99. The percentiles come from a histogram with four
+ * buckets per octave, so they are within ~10% of the exact value. Any module can record into it
+ * without depending on ROS; the nodes publish the summaries (see publishMetricsDiagnostics in
+ * utility.h). Thread-safe.
+ */
+class MetricStat
+{
+public:
+    struct Summary
+    {
+        size_t count = 0;
+        double mean = 0;
+        double max = 0;
+        double last = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+    };
+
+    void add(double _value)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        summary_.max = summary_.count == 0 ? _value : std::max(summary_.max, _value);
+        ++summary_.count;
+        sum_ += _value;
+        summary_.mean = sum_ / summary_.count;
+        summary_.last = _value;
+        ++histogram_[bucket(_value)];
+    }
+
+    Summary summary() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        Summary summary = summary_;
+        summary.p50 = percentile(0.50);
+        summary.p90 = percentile(0.90);
+        summary.p99 = percentile(0.99);
+        return summary;
+    }
+
+private:
+    // bucket b > 0 holds values in [MIN_VALUE * 2^((b-1)/4), MIN_VALUE * 2^(b/4)), bucket 0 everything below
+    static constexpr int NUM_BUCKETS = 128;
+    static constexpr double MIN_VALUE = 1e-4;
+
+    static int bucket(double _value)
+    {
+        if (!(_value >= MIN_VALUE))
+            return 0;
+        const int b = 1 + static_cast<int>(std::floor(4.0 * std::log2(_value / MIN_VALUE)));
+        return std::min(b, NUM_BUCKETS - 1);
+    }
+
+    // upper edge of the bucket the quantile falls in, capped by the max seen
+    double percentile(double _quantile) const
+    {
+        if (summary_.count == 0)
+            return 0;
+        const uint64_t rank = static_cast<uint64_t>(std::ceil(_quantile * summary_.count));
+        uint64_t seen = 0;
+        for (int b = 0; b < NUM_BUCKETS; b++)
+        {
+            seen += histogram_[b];
+            if (seen >= rank)
+                return std::min(summary_.max, MIN_VALUE * std::exp2(b / 4.0));
+        }
+        return summary_.max;
+    }
+
+    mutable std::mutex mtx_;
+    Summary summary_;
+    double sum_ = 0;
+    std::array<uint64_t, NUM_BUCKETS> histogram_{};
+}; // MetricStat
+
+class Metrics
+{
+public:
+    static Metrics &instance()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    // the returned reference stays valid for the lifetime of the process
+    MetricStat &stat(const std::string &_name)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return stats_[_name];
+    }
+
+    void record(const std::string &_name, double _value)
+    {
+        stat(_name).add(_value);
+    }
+
+    // _func(name, summary) for every metric, in name order
+    template <typename Func>
+    void forEach(Func _func) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const auto &stat : stats_)
+            _func(stat.first, stat.second.summary());
+    }
+
+private:
+    Metrics() = default;
+
+    mutable std::mutex mtx_;
+    std::map<std::string, MetricStat> stats_;
+}; // Metrics
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+
+/*
+ * Overload level of the mapping node, from the latency and the processing time of its scans.
+ *
+ * The mapping node processes a scan every mappingProcessInterval with fixed voxel leaves, LM iterations and keyframe
+ * thresholds. When the CPU is saturated (e.g., by a burst of loop-closure ICP) a scan takes longer than that, the scans
+ * wait in the transport and the latency grows. Each level trades accuracy for time:
+ *
+ *   level  process interval  voxel leaves       LM iterations      keyframe thresholds
+ *   0      x1                x1                 30                 x1                    (the fixed schedule)
+ *   L      x(1 + L)          x(1 + 0.25 L)      30 / (1 + L), >= 5 x(1 + 0.5 L)
+ *
+ * The level goes up one step when the smoothed scan latency (stamp to odometry) exceeds the budget or the smoothed
+ * processing time exceeds the process interval of the level, and down one step when both have a 2x margin at the level
+ * below; it holds at least holdScans processed scans between steps. A scan older than maxScanAge when it arrives is
+ * dropped, the subscription keeps the newest one so it is already waiting; at most maxConsecutiveDrops in a row, so a
+ * clock offset between the lidar and the node cannot stop the mapping. Not thread-safe, the mapping thread owns it.
+ */
+class OverloadScheduler
+{
+public:
+    static constexpr int holdScans = 5;
+    static constexpr int maxConsecutiveDrops = 3;
+
+    // disabled (the default) it stays at level 0 and drops nothing
+    void configure(bool _enabled, double _latency_budget, double _max_scan_age, int _max_level)
+    {
+        enabled_ = _enabled;
+        latency_budget_ = _latency_budget;
+        max_scan_age_ = _max_scan_age;
+        max_level_ = std::max(0, _max_level);
+    }
+
+    bool enabled() const { return enabled_; }
+
+    // false if a scan _age seconds old on arrival is to be dropped
+    bool accept(double _age)
+    {
+        if (!enabled_ || _age <= max_scan_age_ || consecutive_drops_ >= maxConsecutiveDrops)
+        {
+            consecutive_drops_ = 0;
+            return true;
+        }
+        ++consecutive_drops_;
+        return false;
+    }
+
+    // after a processed scan, with the process interval of level 0 (s); true if the level changed
+    bool update(double _processing_time, double _latency, double _base_interval)
+    {
+        if (!enabled_)
+            return false;
+
+        const double alpha = 0.3;
+        processing_time_ = scans_ == 0 ? _processing_time : processing_time_ + alpha * (_processing_time - processing_time_);
+        latency_ = scans_ == 0 ? _latency : latency_ + alpha * (_latency - latency_);
+        ++scans_;
+
+        if (++held_ < holdScans)
+            return false;
+
+        if (level_ < max_level_ && (latency_ > latency_budget_ || processing_time_ > _base_interval * intervalScale(level_)))
+        {
+            ++level_;
+            held_ = 0;
+            return true;
+        }
+        if (level_ > 0 && latency_ < 0.5 * latency_budget_ && processing_time_ < 0.5 * _base_interval * intervalScale(level_ - 1))
+        {
+            --level_;
+            held_ = 0;
+            return true;
+        }
+        return false;
+    }
+
+    int level() const { return level_; }
+
+    double intervalScale() const { return intervalScale(level_); }
+    float leafScale() const { return 1.0f + 0.25f * level_; }
+    float keyframeThresholdScale() const { return 1.0f + 0.5f * level_; }
+    int maxIterations(int _iterations) const { return level_ == 0 ? _iterations : std::max(5, _iterations / (1 + level_)); }
+
+private:
+    static double intervalScale(int _level) { return 1.0 + _level; }
+
+    bool enabled_ = false;
+    double latency_budget_ = 0;
+    double max_scan_age_ = 0;
+    int max_level_ = 0;
+
+    int level_ = 0;
+    int held_ = 0; // processed scans since the last step
+    int consecutive_drops_ = 0;
+    long scans_ = 0;
+    double processing_time_ = 0; // smoothed, s
+    double latency_ = 0;         // smoothed, s
+}; // OverloadScheduler
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Binary PCD file written incrementally, for clouds too large to hold in memory at once.
+ *
+ * Points (x y z intensity, float32) are appended chunk by chunk; the point count in the header is
+ * written with a fixed width at open() and patched in place at close(), so the output is a regular
+ * "DATA binary" PCD readable by pcl::io::loadPCDFile.
+ */
+class PCDStreamWriter
+{
+public:
+    ~PCDStreamWriter()
+    {
+        close();
+    }
+
+    bool open(const std::string &_file_name)
+    {
+        file_.open(_file_name, std::ios::binary | std::ios::trunc);
+        num_points_ = 0;
+        if (!file_.is_open())
+            return false;
+
+        writeHeader();
+        return true;
+    }
+
+    template <typename PointT>
+    void append(const pcl::PointCloud<PointT> &_cloud)
+    {
+        if (!file_.is_open())
+            return;
+
+        for (const auto &pt : _cloud.points)
+        {
+            const float fields[4] = {pt.x, pt.y, pt.z, pt.intensity};
+            file_.write(reinterpret_cast<const char *>(fields), sizeof(fields));
+        }
+        num_points_ += _cloud.size();
+    }
+
+    uint64_t size() const { return num_points_; }
+
+    void close()
+    {
+        if (!file_.is_open())
+            return;
+
+        file_.seekp(0);
+        writeHeader();
+        file_.close();
+    }
+
+private:
+    void writeHeader()
+    {
+        char count[32];
+        snprintf(count, sizeof(count), "%012llu", static_cast<unsigned long long>(num_points_)); // fixed width, so the header size never changes
+
+        file_ << "# .PCD v0.7 - Point Cloud Data file format\n"
+              << "VERSION 0.7\n"
+              << "FIELDS x y z intensity\n"
+              << "SIZE 4 4 4 4\n"
+              << "TYPE F F F F\n"
+              << "COUNT 1 1 1 1\n"
+              << "WIDTH " << count << "\n"
+              << "HEIGHT 1\n"
+              << "VIEWPOINT 0 0 0 1 0 0 0\n"
+              << "POINTS " << count << "\n"
+              << "DATA binary\n";
+    }
+
+    std::ofstream file_;
+    uint64_t num_points_ = 0;
+}; // PCDStreamWriter
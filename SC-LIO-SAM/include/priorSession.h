@@ -0,0 +1,212 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/io/pcd_io.h>
+
+#include "Scancontext.h"
+#include "lruCache.h"
+#include "sessionFile.h"
+
+/*
+ * A session saved by an earlier run of mapOptimization (its savePCDDirectory): session.bin (saveSessionFile), or else
+ * optimized_poses.txt, SCDs/ and Scans/.
+ *
+ * load() reads the optimized key poses and every descriptor (the session file and binary SCDs are memory-mapped instead of parsed), then indexes
+ * the descriptors with a single bulk build of the ring-key tree. Keyframe clouds stay on disk until keyframeCloud() asks for
+ * one and are then kept in an LRU bounded by the cloud cache budget. Not thread-safe; meant for the mapping thread.
+ */
+template <typename PointT>
+class PriorSession
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudPtr = typename Cloud::Ptr;
+
+    explicit PriorSession(size_t _cloud_cache_budget_bytes) : clouds_(_cloud_cache_budget_bytes) {}
+
+    // false if _directory holds no keyframe with both a pose and a descriptor
+    bool load(std::string _directory)
+    {
+        if (!_directory.empty() && _directory.back() != '/')
+            _directory += '/';
+        directory_ = _directory;
+
+        if (session_.open(directory_ + "session.bin"))
+            return loadSessionFile();
+        if (!loadPoses(directory_ + "optimized_poses.txt"))
+            return false;
+
+        for (size_t i = 0; i < poses_.size(); ++i)
+        {
+            SCDescriptor desc;
+            const std::string scd = directory_ + "SCDs/" + nodeName(i);
+            if (!loadBinarySCD(scd + ".bin", desc) && !loadTextSCD(scd + ".scd", desc))
+            {
+                poses_.resize(i); // the descriptors are indexed by keyframe, so stop at the first missing one
+                break;
+            }
+            sc_.loadScancontext(desc);
+        }
+        sc_.buildIndex();
+        return !poses_.empty();
+    }
+
+    size_t size() const { return poses_.size(); }
+    const std::string &directory() const { return directory_; }
+
+    // optimized pose of keyframe _idx (its lidar frame to the session's map frame)
+    const Eigen::Matrix4f &pose(size_t _idx) const { return poses_[_idx]; }
+
+    // descriptors of all keyframes, for detectRelocalizationCandidates()
+    SCManager &scManager() { return sc_; }
+
+    // keyframe _idx in its lidar frame, read from disk on a cache miss; nullptr if it can not be read
+    CloudPtr keyframeCloud(size_t _idx)
+    {
+        const CloudPtr *cached = clouds_.get(_idx);
+        if (cached != nullptr)
+            return *cached;
+
+        CloudPtr cloud(new Cloud());
+        if (from_session_file_)
+        {
+            std::vector<char> buffer;
+            size_t bytes = 0;
+            const char *payload = session_.read(SESSION_CLOUD, _idx, bytes, buffer);
+            if (payload == nullptr)
+                return nullptr;
+            decodeSessionCloud(payload, bytes, *cloud);
+        }
+        else if (pcl::io::loadPCDFile<PointT>(directory_ + "Scans/" + nodeName(_idx) + ".pcd", *cloud) < 0)
+            return nullptr;
+        clouds_.put(_idx, cloud, cloud->size() * sizeof(PointT));
+        return cloud;
+    }
+
+private:
+    static std::string nodeName(size_t _idx)
+    {
+        std::ostringstream out;
+        out << std::setfill('0') << std::setw(6) << _idx; // as padZeros()
+        return out.str();
+    }
+
+    // keyframes 0, 1, ... up to the first without a descriptor; optimized poses if the session was shut down normally, else initial ones
+    bool loadSessionFile()
+    {
+        from_session_file_ = true;
+        const SessionChunkType pose_type = session_.keys(SESSION_OPTIMIZED_POSE).empty() ? SESSION_VERTEX : SESSION_OPTIMIZED_POSE;
+
+        std::vector<char> buffer;
+        for (uint64_t i = 0;; ++i)
+        {
+            SessionPose pose;
+            size_t bytes = 0;
+            const char *desc = session_.read(SESSION_DESCRIPTOR, i, bytes, buffer);
+            if (desc == nullptr || bytes != sizeof(SCDescriptor) || !session_.read(pose_type, i, pose))
+                break;
+
+            Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+            transform.block<3, 3>(0, 0) = Eigen::Quaterniond(pose.qw, pose.qx, pose.qy, pose.qz).toRotationMatrix().cast<float>();
+            transform.block<3, 1>(0, 3) = Eigen::Vector3d(pose.x, pose.y, pose.z).cast<float>();
+            poses_.push_back(transform);
+            SCDescriptor descriptor;
+            std::memcpy(descriptor.data(), desc, sizeof(SCDescriptor));
+            sc_.loadScancontext(descriptor);
+        }
+        sc_.buildIndex();
+        return !poses_.empty();
+    }
+
+    // one row-major 3x4 [R | t] per line, in key order (saveOptimizedVerticesKITTIformat)
+    bool loadPoses(const std::string &_file)
+    {
+        std::ifstream file(_file);
+        if (!file.is_open())
+            return false;
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream row(line);
+            Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 4; ++c)
+                    row >> pose(r, c);
+            if (!row)
+                break;
+            poses_.push_back(pose);
+        }
+        return !poses_.empty();
+    }
+
+    // saveSCDBinary(): int32 rows, int32 cols, rows x cols float32 in row-major order
+    static bool loadBinarySCD(const std::string &_file, SCDescriptor &_desc)
+    {
+        using RowMajorDescriptor = Eigen::Matrix<float, SC_NUM_RING, SC_NUM_SECTOR, Eigen::RowMajor>;
+        const size_t bytes = 2 * sizeof(int32_t) + sizeof(RowMajorDescriptor);
+
+        int fd = open(_file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        bool ok = false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) == bytes)
+        {
+            void *data = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                int32_t header[2];
+                std::memcpy(header, data, sizeof(header));
+                if (header[0] == SC_NUM_RING && header[1] == SC_NUM_SECTOR)
+                {
+                    RowMajorDescriptor desc;
+                    std::memcpy(desc.data(), static_cast<const char *>(data) + sizeof(header), sizeof(RowMajorDescriptor));
+                    _desc = desc;
+                    ok = true;
+                }
+                munmap(data, bytes);
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+    // saveSCD(): one ring per line, space separated
+    static bool loadTextSCD(const std::string &_file, SCDescriptor &_desc)
+    {
+        std::ifstream file(_file);
+        if (!file.is_open())
+            return false;
+
+        for (int r = 0; r < SC_NUM_RING; ++r)
+            for (int c = 0; c < SC_NUM_SECTOR; ++c)
+                file >> _desc(r, c);
+        return !file.fail();
+    }
+
+    std::string directory_;
+    SessionFileReader session_;
+    bool from_session_file_ = false;
+    std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> poses_;
+    SCManager sc_;
+    LRUCache<size_t, CloudPtr> clouds_;
+}; // PriorSession
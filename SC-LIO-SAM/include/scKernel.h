@@ -0,0 +1,18 @@
+#pragma once
+
+// Scan Context distance kernels on raw float storage.
+// Kept free of Eigen so that src/scKernel.cpp alone can be built with wider SIMD flags (see SC_KERNEL_AVX2 in CMakeLists.txt)
+// without changing the alignment of Eigen types shared with the other translation units.
+
+constexpr int SC_NUM_RING = 20; // 20 in the original paper (IROS 18)
+constexpr int SC_NUM_SECTOR = 60; // 60 in the original paper (IROS 18)
+
+// _desc: column-major SC_NUM_RING x SC_NUM_SECTOR descriptor, _norms: SC_NUM_SECTOR output L2 norms (one per sector)
+void scColumnNorms( const float* _desc, float* _norms );
+
+// "d" (eq 5) in the original paper (IROS 18) between _sc1 and _sc2 circularly shifted right by _num_shift sectors,
+// evaluated with modular column indexing and the precomputed column norms (i.e., no shifted copy of _sc2)
+double scDistAtShift( const float* _sc1, const float* _norms1, const float* _sc2, const float* _norms2, int _num_shift );
+
+// the right shift of _vkey2 that best matches _vkey1 in L2 (both are SC_NUM_SECTOR sector keys)
+int scAlignSectorKeys( const float* _vkey1, const float* _vkey2 );
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+
+/*
+ * Point layouts and field semantics of the supported lidar models.
+ *
+ * A traits struct names the ring and time fields of a model's sensor_msgs::PointCloud2 and gives their types through the
+ * model's point struct, so that TypedPointCloud2Reader<Traits> (cloudReader.h) and the projection kernel of ImageProjection
+ * are instantiated per model: the field reads have fixed types and the time conversion to seconds is a compile-time
+ * constant, with no per-point branching on the sensor or the field datatypes.
+ *
+ *   Point        point struct with the driver's layout (x y z are float32 for every model)
+ *   RingType     type of the ring field, ringField() its name
+ *   TimeType     type of the time field, timeField() its name
+ *   timeScale()  factor from the time field's unit to seconds
+ *   absoluteTime true if the field is a time stamp rather than an offset from the first point; the header stamp, which the
+ *                driver must set to the scan start, is subtracted then
+ *
+ * Adding a model: a point struct, a traits struct, a SensorType and its case in ImageProjection::dispatchSensor().
+ */
+
+struct VelodynePointXYZIRT
+{
+    PCL_ADD_POINT4D                 // 位置
+    PCL_ADD_INTENSITY;              // 激光点反射强度 float intensity;
+    uint16_t ring;                  // 扫描线
+    float time;                     // 时间戳，记录相对于当前帧第一个激光点的时差，第一个点time=0
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW // 内存16字节对齐，EIGEN SSE优化要求
+} EIGEN_ALIGN16;
+POINT_CLOUD_REGISTER_POINT_STRUCT(VelodynePointXYZIRT,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(uint16_t, ring, ring)(float, time, time))
+
+struct OusterPointXYZIRT
+{
+    PCL_ADD_POINT4D;
+    float intensity;
+    uint32_t t;
+    uint16_t reflectivity;
+    uint8_t ring;
+    uint16_t noise;
+    uint32_t range;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+} EIGEN_ALIGN16;
+POINT_CLOUD_REGISTER_POINT_STRUCT(OusterPointXYZIRT,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(uint32_t, t, t)(uint16_t, reflectivity, reflectivity)(uint8_t, ring, ring)(uint16_t, noise, noise)(uint32_t, range, range))
+
+struct MulranPointXYZIRT
+{ // from the file player's topic https://github.com/irapkaist/file_player_mulran, see https://github.com/irapkaist/file_player_mulran/blob/17da0cb6ef66b4971ec943ab8d234aa25da33e7e/src/ROSThread.cpp#L7
+    PCL_ADD_POINT4D;
+    float intensity;
+    uint32_t t;
+    int ring;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+} EIGEN_ALIGN16;
+POINT_CLOUD_REGISTER_POINT_STRUCT(MulranPointXYZIRT,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(uint32_t, t, t)(int, ring, ring))
+
+struct LivoxPointXYZITL
+{ // livox_ros_driver2 PointCloud2 (xfer_format 0): the laser line as ring, timestamp in ns since the epoch
+    PCL_ADD_POINT4D;
+    float intensity;
+    uint8_t tag;
+    uint8_t line;
+    double timestamp;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+} EIGEN_ALIGN16;
+POINT_CLOUD_REGISTER_POINT_STRUCT(LivoxPointXYZITL,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(uint8_t, tag, tag)(uint8_t, line, line)(double, timestamp, timestamp))
+
+struct HesaiPointXYZIRT
+{ // HesaiLidar_General_ROS / Pandar drivers: timestamp in s since the epoch
+    PCL_ADD_POINT4D;
+    float intensity;
+    double timestamp;
+    uint16_t ring;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+} EIGEN_ALIGN16;
+POINT_CLOUD_REGISTER_POINT_STRUCT(HesaiPointXYZIRT,
+                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(double, timestamp, timestamp)(uint16_t, ring, ring))
+
+// Use the Velodyne point format as a common representation
+using PointXYZIRT = VelodynePointXYZIRT;
+
+struct VelodyneTraits
+{
+    using Point = VelodynePointXYZIRT;
+    using RingType = decltype(Point::ring);
+    using TimeType = decltype(Point::time);
+    static constexpr const char *ringField() { return "ring"; }
+    static constexpr const char *timeField() { return "time"; }
+    static constexpr double timeScale() { return 1.0; }
+    static constexpr bool absoluteTime = false;
+};
+
+struct OusterTraits
+{
+    using Point = OusterPointXYZIRT;
+    using RingType = decltype(Point::ring);
+    using TimeType = decltype(Point::t);
+    static constexpr const char *ringField() { return "ring"; }
+    static constexpr const char *timeField() { return "t"; }
+    static constexpr double timeScale() { return 1e-9; }
+    static constexpr bool absoluteTime = false;
+};
+
+// the file player fills ring, so the rows no longer have to be guessed from the point index of the .bin file
+struct MulranTraits
+{
+    using Point = MulranPointXYZIRT;
+    using RingType = decltype(Point::ring);
+    using TimeType = decltype(Point::t);
+    static constexpr const char *ringField() { return "ring"; }
+    static constexpr const char *timeField() { return "t"; }
+    static constexpr double timeScale() { return 1.0; }
+    static constexpr bool absoluteTime = false;
+};
+
+struct LivoxTraits
+{
+    using Point = LivoxPointXYZITL;
+    using RingType = decltype(Point::line);
+    using TimeType = decltype(Point::timestamp);
+    static constexpr const char *ringField() { return "line"; }
+    static constexpr const char *timeField() { return "timestamp"; }
+    static constexpr double timeScale() { return 1e-9; }
+    static constexpr bool absoluteTime = true;
+};
+
+struct HesaiTraits
+{
+    using Point = HesaiPointXYZIRT;
+    using RingType = decltype(Point::ring);
+    using TimeType = decltype(Point::timestamp);
+    static constexpr const char *ringField() { return "ring"; }
+    static constexpr const char *timeField() { return "timestamp"; }
+    static constexpr double timeScale() { return 1.0; }
+    static constexpr bool absoluteTime = true;
+};
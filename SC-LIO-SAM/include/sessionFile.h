@@ -0,0 +1,373 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#ifdef LIO_SAM_WITH_LZ4
+#include <lz4.h>
+#endif
+
+/*
+ * Append-only binary session file: one file instead of SCDs/, Scans/ and the g2o lines kept in memory until shutdown.
+ *
+ * Layout: SessionFileHeader, then chunks (SessionChunkHeader + payload) in the order they were appended, then on close an
+ * INDEX chunk (one SessionIndexEntry per chunk) and a SessionFileFooter pointing at it. A chunk is identified by (type, key),
+ * the key being the keyframe index for per-keyframe data and a running count for edges; a later chunk with the same id
+ * replaces an earlier one. A file that was not closed (e.g. the process was killed) has no index, and the reader recovers it
+ * by walking the chunk headers. Payloads may be LZ4 compressed (chunk by chunk) when built with LIO_SAM_WITH_LZ4.
+ * All integers are in host byte order.
+ */
+enum SessionChunkType : uint32_t
+{
+    SESSION_DESCRIPTOR = 1,     // SC_NUM_RING x SC_NUM_SECTOR float32, column-major (SCDescriptor storage order)
+    SESSION_VERTEX = 2,         // SessionPose, initial estimate of the keyframe (g2o VERTEX_SE3:QUAT)
+    SESSION_EDGE = 3,           // SessionEdge (g2o EDGE_SE3:QUAT)
+    SESSION_CLOUD = 4,          // float32 x y z intensity per point, keyframe cloud in its lidar frame
+    SESSION_OPTIMIZED_POSE = 5, // SessionPose, optimized estimate of the keyframe (written at shutdown)
+    SESSION_INDEX = 0x7fffffff  // SessionIndexEntry per chunk
+};
+
+struct SessionPose
+{
+    double x, y, z;
+    double qx, qy, qz, qw;
+};
+
+struct SessionEdge
+{
+    int64_t from;
+    int64_t to;
+    SessionPose relative;
+};
+
+struct SessionFileHeader
+{
+    char magic[8];    // SESSION_FILE_MAGIC
+    uint32_t version; // SESSION_FILE_VERSION
+    uint32_t reserved;
+};
+
+struct SessionChunkHeader
+{
+    uint32_t magic;        // SESSION_CHUNK_MAGIC
+    uint32_t type;         // SessionChunkType
+    uint64_t key;
+    uint32_t stored_bytes; // payload bytes in the file
+    uint32_t raw_bytes;    // payload bytes once decompressed
+    uint32_t flags;        // SESSION_CHUNK_LZ4
+    uint32_t reserved;
+};
+
+struct SessionIndexEntry
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t offset; // of the chunk header
+};
+
+struct SessionFileFooter
+{
+    uint64_t index_offset; // of the INDEX chunk header
+    uint64_t magic;        // SESSION_FOOTER_MAGIC
+};
+
+static constexpr char SESSION_FILE_MAGIC[8] = {'L', 'I', 'O', 'S', 'A', 'M', 'S', 'F'};
+static constexpr uint32_t SESSION_FILE_VERSION = 1;
+static constexpr uint32_t SESSION_CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+static constexpr uint64_t SESSION_FOOTER_MAGIC = 0x5844494e49534553ull; // "SESINIDX"
+static constexpr uint32_t SESSION_CHUNK_LZ4 = 1;
+
+
+// not thread-safe: meant to be fed by one writer thread (mapOptimization's keyframe writer)
+class SessionFileWriter
+{
+public:
+    SessionFileWriter() = default;
+    SessionFileWriter(const SessionFileWriter &) = delete;
+    SessionFileWriter &operator=(const SessionFileWriter &) = delete;
+    ~SessionFileWriter() { close(); }
+
+    // _compress: LZ4 per chunk, ignored when built without LIO_SAM_WITH_LZ4
+    bool open(const std::string &_file, bool _compress)
+    {
+        file_.open(_file, std::ios::binary | std::ios::trunc);
+        if (!file_.is_open())
+            return false;
+        compress_ = _compress;
+
+        SessionFileHeader header;
+        std::memcpy(header.magic, SESSION_FILE_MAGIC, sizeof(header.magic));
+        header.version = SESSION_FILE_VERSION;
+        header.reserved = 0;
+        write(&header, sizeof(header));
+        return true;
+    }
+
+    bool isOpen() const { return file_.is_open(); }
+    uint64_t bytesWritten() const { return offset_; }
+
+    // the chunk is on disk (flushed) when this returns
+    void append(SessionChunkType _type, uint64_t _key, const void *_data, size_t _bytes)
+    {
+        if (!file_.is_open())
+            return;
+
+        SessionChunkHeader header;
+        header.magic = SESSION_CHUNK_MAGIC;
+        header.type = _type;
+        header.key = _key;
+        header.raw_bytes = _bytes;
+        header.stored_bytes = _bytes;
+        header.flags = 0;
+        header.reserved = 0;
+
+        const char *payload = static_cast<const char *>(_data);
+#ifdef LIO_SAM_WITH_LZ4
+        if (compress_ && _bytes >= 256)
+        {
+            buffer_.resize(LZ4_compressBound(_bytes));
+            int compressed = LZ4_compress_default(payload, buffer_.data(), _bytes, buffer_.size());
+            if (compressed > 0 && size_t(compressed) < _bytes)
+            {
+                header.stored_bytes = compressed;
+                header.flags = SESSION_CHUNK_LZ4;
+                payload = buffer_.data();
+            }
+        }
+#endif
+        index_.push_back(SessionIndexEntry{_type, 0, _key, offset_});
+        write(&header, sizeof(header));
+        write(payload, header.stored_bytes);
+        file_.flush();
+    }
+
+    // writes the index and the footer; nothing can be appended afterwards
+    void close()
+    {
+        if (!file_.is_open())
+            return;
+
+        SessionFileFooter footer;
+        footer.index_offset = offset_;
+        footer.magic = SESSION_FOOTER_MAGIC;
+        const bool compress = compress_;
+        compress_ = false; // the reader walks the index in place
+        std::vector<SessionIndexEntry> index;
+        index.swap(index_);
+        append(SESSION_INDEX, 0, index.data(), index.size() * sizeof(SessionIndexEntry));
+        compress_ = compress;
+        write(&footer, sizeof(footer));
+        file_.close();
+    }
+
+private:
+    void write(const void *_data, size_t _bytes)
+    {
+        file_.write(static_cast<const char *>(_data), _bytes);
+        offset_ += _bytes;
+    }
+
+    std::ofstream file_;
+    uint64_t offset_ = 0;
+    bool compress_ = false;
+    std::vector<SessionIndexEntry> index_;
+    std::vector<char> buffer_;
+}; // SessionFileWriter
+
+
+// memory-maps a session file; uncompressed payloads are read in place. Concurrent reads are fine (read() only touches _buffer)
+class SessionFileReader
+{
+public:
+    SessionFileReader() = default;
+    SessionFileReader(const SessionFileReader &) = delete;
+    SessionFileReader &operator=(const SessionFileReader &) = delete;
+    ~SessionFileReader()
+    {
+        if (data_ != nullptr)
+            munmap(data_, size_);
+    }
+
+    bool open(const std::string &_file)
+    {
+        int fd = ::open(_file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SessionFileHeader))
+        {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                data_ = static_cast<char *>(data);
+                size_ = st.st_size;
+            }
+        }
+        ::close(fd);
+        if (data_ == nullptr)
+            return false;
+
+        if (size_ < sizeof(SessionFileHeader))
+            return false;
+        SessionFileHeader header;
+        std::memcpy(&header, data_, sizeof(header));
+        if (std::memcmp(header.magic, SESSION_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != SESSION_FILE_VERSION)
+            return false;
+
+        if (!readIndex())
+            recoverIndex();
+        return true;
+    }
+
+    bool closedCleanly() const { return closed_cleanly_; }
+
+    // keys of the chunks of _type, ascending
+    std::vector<uint64_t> keys(SessionChunkType _type) const
+    {
+        std::vector<uint64_t> keys;
+        for (auto it = index_.lower_bound({_type, 0}); it != index_.end() && it->first.first == _type; ++it)
+            keys.push_back(it->first.second);
+        return keys;
+    }
+
+    // payload of chunk (_type, _key), decompressed into _buffer if it is compressed; nullptr if there is no such chunk
+    const char *read(SessionChunkType _type, uint64_t _key, size_t &_bytes, std::vector<char> &_buffer) const
+    {
+        auto it = index_.find({_type, _key});
+        if (it == index_.end())
+            return nullptr;
+
+        SessionChunkHeader header;
+        std::memcpy(&header, data_ + it->second, sizeof(header));
+        const char *payload = data_ + it->second + sizeof(SessionChunkHeader);
+        if (header.flags & SESSION_CHUNK_LZ4)
+        {
+#ifdef LIO_SAM_WITH_LZ4
+            _buffer.resize(header.raw_bytes);
+            if (LZ4_decompress_safe(payload, _buffer.data(), header.stored_bytes, header.raw_bytes) != int(header.raw_bytes))
+                return nullptr;
+            _bytes = header.raw_bytes;
+            return _buffer.data();
+#else
+            return nullptr; // written by a build with LZ4
+#endif
+        }
+        _bytes = header.stored_bytes;
+        return payload; // unaligned, read it with memcpy
+    }
+
+    // fixed-size payloads (SessionPose, SessionEdge); false if absent or of another size
+    template <typename T>
+    bool read(SessionChunkType _type, uint64_t _key, T &_value) const
+    {
+        std::vector<char> buffer;
+        size_t bytes = 0;
+        const char *payload = read(_type, _key, bytes, buffer);
+        if (payload == nullptr || bytes != sizeof(T))
+            return false;
+        std::memcpy(&_value, payload, sizeof(T));
+        return true;
+    }
+
+private:
+    // chunks are not padded, so the headers, the footer and the index entries are copied out of the mapping rather than
+    // dereferenced in place (unaligned)
+
+    // a complete chunk starts at _offset, its header into _header
+    bool chunkAt(uint64_t _offset, SessionChunkHeader &_header) const
+    {
+        if (_offset + sizeof(SessionChunkHeader) > size_)
+            return false;
+        std::memcpy(&_header, data_ + _offset, sizeof(_header));
+        return _header.magic == SESSION_CHUNK_MAGIC && _offset + sizeof(SessionChunkHeader) + _header.stored_bytes <= size_;
+    }
+
+    bool readIndex()
+    {
+        if (size_ < sizeof(SessionFileHeader) + sizeof(SessionFileFooter))
+            return false;
+        SessionFileFooter footer;
+        std::memcpy(&footer, data_ + size_ - sizeof(SessionFileFooter), sizeof(footer));
+        if (footer.magic != SESSION_FOOTER_MAGIC)
+            return false;
+        SessionChunkHeader header;
+        if (!chunkAt(footer.index_offset, header) || header.type != SESSION_INDEX || header.flags != 0)
+            return false;
+
+        const char *entries = data_ + footer.index_offset + sizeof(SessionChunkHeader);
+        const size_t count = header.stored_bytes / sizeof(SessionIndexEntry);
+        for (size_t i = 0; i < count; ++i)
+        {
+            SessionIndexEntry entry;
+            std::memcpy(&entry, entries + i * sizeof(SessionIndexEntry), sizeof(entry));
+            SessionChunkHeader chunk;
+            if (chunkAt(entry.offset, chunk))
+                index_[{entry.type, entry.key}] = entry.offset;
+        }
+        closed_cleanly_ = true;
+        return true;
+    }
+
+    // walks the chunks up to the first incomplete one (a write cut short)
+    void recoverIndex()
+    {
+        uint64_t offset = sizeof(SessionFileHeader);
+        SessionChunkHeader header;
+        while (chunkAt(offset, header))
+        {
+            if (header.type == SESSION_INDEX)
+                break;
+            index_[{header.type, header.key}] = offset;
+            offset += sizeof(SessionChunkHeader) + header.stored_bytes;
+        }
+    }
+
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    bool closed_cleanly_ = false;
+    std::map<std::pair<uint32_t, uint64_t>, uint64_t> index_; // (type, key) -> chunk offset
+}; // SessionFileReader
+
+
+// SESSION_CLOUD payload
+template <typename PointT>
+void encodeSessionCloud(const pcl::PointCloud<PointT> &_cloud, std::vector<float> &_payload)
+{
+    _payload.resize(_cloud.size() * 4);
+    for (size_t i = 0; i < _cloud.size(); ++i)
+    {
+        _payload[4 * i + 0] = _cloud.points[i].x;
+        _payload[4 * i + 1] = _cloud.points[i].y;
+        _payload[4 * i + 2] = _cloud.points[i].z;
+        _payload[4 * i + 3] = _cloud.points[i].intensity;
+    }
+}
+
+template <typename PointT>
+void decodeSessionCloud(const char *_payload, size_t _bytes, pcl::PointCloud<PointT> &_cloud)
+{
+    const size_t count = _bytes / (4 * sizeof(float));
+    _cloud.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        float values[4];
+        std::memcpy(values, _payload + i * sizeof(values), sizeof(values));
+        _cloud.points[i].x = values[0];
+        _cloud.points[i].y = values[1];
+        _cloud.points[i].z = values[2];
+        _cloud.points[i].intensity = values[3];
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "sessionFile.h"
+
+/*
+ * Corner and surf points binned by xy map tile, for a pass over all keyframes that must not hold the whole map in RAM.
+ *
+ * append() writes the points one keyframe has in one tile as a block of an append-only file (x y z intensity, as
+ * SESSION_CLOUD) and remembers the block under its tile; forEachTile() gathers the blocks of each tile in the order
+ * they were appended. A block that cannot be written (no file, disk full) stays in RAM instead, so nothing is lost.
+ * Not thread-safe.
+ */
+template <typename PointT>
+class TileSpill
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using TileIndex = std::pair<int, int>;
+
+    TileSpill() = default;
+    TileSpill(const TileSpill &) = delete;
+    TileSpill &operator=(const TileSpill &) = delete;
+
+    ~TileSpill()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            unlink(file_.c_str());
+        }
+    }
+
+    // _file is truncated, and removed on destruction
+    bool open(const std::string &_file)
+    {
+        file_ = _file;
+        fd_ = ::open(file_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        return fd_ >= 0;
+    }
+
+    void append(const TileIndex &_tile, const Cloud &_corner, const Cloud &_surf)
+    {
+        Block block;
+        block.num_corner = _corner.size();
+        encodeSessionCloud(_corner, block.resident);
+        std::vector<float> surf;
+        encodeSessionCloud(_surf, surf);
+        block.resident.insert(block.resident.end(), surf.begin(), surf.end());
+
+        const size_t bytes = block.resident.size() * sizeof(float);
+        if (fd_ >= 0 && writeAll(block.resident.data(), bytes, file_bytes_))
+        {
+            block.offset = file_bytes_;
+            block.bytes = bytes;
+            file_bytes_ += bytes;
+            block.resident = std::vector<float>();
+        }
+        tiles_[_tile].push_back(std::move(block));
+    }
+
+    size_t numTiles() const { return tiles_.size(); }
+
+    // _visit(tile, corner, surf) for every tile in (ix, iy) order; a tile's blocks are dropped once it was visited
+    template <typename Visitor>
+    void forEachTile(Visitor &&_visit)
+    {
+        std::vector<char> buffer;
+        for (auto &tile : tiles_)
+        {
+            typename Cloud::Ptr corner(new Cloud()), surf(new Cloud());
+            Cloud part;
+            for (Block &block : tile.second)
+            {
+                const char *data = reinterpret_cast<const char *>(block.resident.data());
+                size_t bytes = block.resident.size() * sizeof(float);
+                if (block.resident.empty() && block.bytes > 0)
+                {
+                    buffer.resize(block.bytes);
+                    if (!readAll(buffer.data(), block.bytes, block.offset))
+                        continue; // the spill file is gone, the block is lost
+                    data = buffer.data();
+                    bytes = block.bytes;
+                }
+                const size_t corner_bytes = block.num_corner * 4 * sizeof(float);
+                decodeSessionCloud(data, corner_bytes, part);
+                *corner += part;
+                decodeSessionCloud(data + corner_bytes, bytes - corner_bytes, part);
+                *surf += part;
+            }
+            tile.second = std::vector<Block>();
+            _visit(tile.first, corner, surf);
+        }
+    }
+
+private:
+    struct Block
+    {
+        uint64_t offset = 0; // in the spill file
+        uint64_t bytes = 0;
+        uint64_t num_corner = 0;
+        std::vector<float> resident; // the points, if the block was not written
+    };
+
+    bool writeAll(const void *_data, size_t _bytes, uint64_t _offset)
+    {
+        const char *data = static_cast<const char *>(_data);
+        while (_bytes > 0)
+        {
+            ssize_t written = pwrite(fd_, data, _bytes, _offset);
+            if (written <= 0)
+                return false;
+            data += written;
+            _bytes -= written;
+            _offset += written;
+        }
+        return true;
+    }
+
+    bool readAll(char *_data, size_t _bytes, uint64_t _offset) const
+    {
+        while (_bytes > 0)
+        {
+            ssize_t got = pread(fd_, _data, _bytes, _offset);
+            if (got <= 0)
+                return false;
+            _data += got;
+            _bytes -= got;
+            _offset += got;
+        }
+        return true;
+    }
+
+    std::map<TileIndex, std::vector<Block>> tiles_;
+    std::string file_;
+    int fd_ = -1;
+    uint64_t file_bytes_ = 0;
+}; // TileSpill
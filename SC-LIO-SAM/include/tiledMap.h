@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "cloudKdTree.h"
+
+/*
+ * Static map for localization against a pre-built map, split into tiles on the xy plane.
+ *
+ * build() bins the map once into _tile_size x _tile_size tiles and builds one kd-tree per tile; nothing is rebuilt
+ * afterwards, so the per-scan cost is the searches alone and the memory footprint stays constant. A tile also holds the
+ * points up to _margin outside of it, so a search from anywhere inside the tile finds every neighbor within _margin exactly,
+ * whichever tile it lies in. Searches are const and may run concurrently.
+ */
+template <typename PointT>
+class TiledMap
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudPtr = typename Cloud::Ptr;
+
+    void build(const Cloud &_cloud, float _tile_size, float _margin)
+    {
+        tiles_.clear();
+        tile_size_ = _tile_size;
+        num_points_ = _cloud.size();
+
+        for (const auto &pt : _cloud.points)
+        {
+            if (!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z))
+                continue;
+            for (int ix = tileIndex(pt.x - _margin); ix <= tileIndex(pt.x + _margin); ++ix)
+                for (int iy = tileIndex(pt.y - _margin); iy <= tileIndex(pt.y + _margin); ++iy)
+                {
+                    Tile &tile = tiles_[tileKey(ix, iy)];
+                    if (!tile.cloud)
+                        tile.cloud.reset(new Cloud());
+                    tile.cloud->push_back(pt);
+                }
+        }
+
+        for (auto &tile : tiles_)
+        {
+            tile.second.kdtree.reset(new CloudKdTree<PointT>());
+            tile.second.kdtree->setInputCloud(tile.second.cloud);
+        }
+    }
+
+    // up to _k nearest neighbors of _point in the tile containing it (0 outside the map); _cloud is set to the tile cloud _indices refer to
+    int nearestKSearch(const PointT &_point, int _k, int *_indices, float *_sq_distances, const Cloud *&_cloud) const
+    {
+        auto it = tiles_.find(tileKey(tileIndex(_point.x), tileIndex(_point.y)));
+        if (it == tiles_.end())
+            return 0;
+
+        _cloud = it->second.cloud.get();
+        return it->second.kdtree->nearestKSearch(_point, _k, _indices, _sq_distances);
+    }
+
+    // the map points of the tiles within _radius of (_x, _y), without the tile margins, e.g., for visualization
+    void getNeighborhood(float _x, float _y, float _radius, Cloud &_cloud_out) const
+    {
+        _cloud_out.clear();
+        for (int ix = tileIndex(_x - _radius); ix <= tileIndex(_x + _radius); ++ix)
+            for (int iy = tileIndex(_y - _radius); iy <= tileIndex(_y + _radius); ++iy)
+            {
+                auto it = tiles_.find(tileKey(ix, iy));
+                if (it == tiles_.end())
+                    continue;
+                for (const auto &pt : it->second.cloud->points)
+                    if (tileIndex(pt.x) == ix && tileIndex(pt.y) == iy)
+                        _cloud_out.push_back(pt);
+            }
+    }
+
+    bool empty() const { return tiles_.empty(); }
+    size_t numTiles() const { return tiles_.size(); }
+    size_t numPoints() const { return num_points_; }
+
+private:
+    struct Tile
+    {
+        CloudPtr cloud;
+        std::unique_ptr<CloudKdTree<PointT>> kdtree;
+    };
+
+    int tileIndex(float _coord) const
+    {
+        return static_cast<int>(std::floor(_coord / tile_size_));
+    }
+
+    static int64_t tileKey(int _ix, int _iy)
+    {
+        return static_cast<int64_t>((uint64_t(uint32_t(_ix)) << 32) | uint32_t(_iy)); // unsigned, _ix is often negative
+    }
+
+    float tile_size_ = 50.0f;
+    size_t num_points_ = 0;
+    std::unordered_map<int64_t, Tile> tiles_;
+}; // TiledMap
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "metrics.h"
+
+/*
+ * Scoped stage spans.
+ *
+ * TRACE_SPAN("mapping/scan2map_ms") times the rest of the enclosing scope with the monotonic clock and records it in ms as
+ * that metric (metrics.h, so it shows up with p50 / p99 on the node's metrics topic). The metric is looked up once per call
+ * site, a span costs two clock reads and one histogram update. If Tracer::open() was called, every span is also written to
+ * a Chrome trace (chrome://tracing, Perfetto) as a complete event of the thread it ran on.
+ *
+ * Spans are compiled out unless LIO_SAM_TRACING is defined (CMake option TRACING); the Tracer then records nothing.
+ */
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Tracer &instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // starts writing the spans to _path as a Chrome trace (JSON array format), flushed once a second; false if it cannot be
+    // created. Only the first call opens a file, a process has one trace.
+    bool open(const std::string &_path)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (file_ != nullptr)
+            return true;
+        file_ = std::fopen(_path.c_str(), "w");
+        if (file_ == nullptr)
+            return false;
+        std::fputs("[\n", file_);
+        enabled_.store(true, std::memory_order_release);
+        flusher_ = std::thread(&Tracer::flushLoop, this);
+        return true;
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void record(const char *_name, Clock::time_point _begin, Clock::time_point _end)
+    {
+        if (!enabled())
+            return;
+        Event event;
+        event.name = _name;
+        event.tid = threadId();
+        event.begin_us = std::chrono::duration<double, std::micro>(_begin - origin_).count();
+        event.duration_us = std::chrono::duration<double, std::micro>(_end - _begin).count();
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_.push_back(event);
+    }
+
+    ~Tracer()
+    {
+        enabled_.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (flusher_.joinable())
+            flusher_.join();
+        if (file_ != nullptr)
+        {
+            flush();
+            std::fputs("\n]\n", file_); // optional in the format, a killed node's trace still loads
+            std::fclose(file_);
+        }
+    }
+
+private:
+    struct Event
+    {
+        const char *name; // a TRACE_SPAN literal
+        int tid;
+        double begin_us;
+        double duration_us;
+    };
+
+    Tracer() : origin_(Clock::now()), pid_(getpid()) {}
+
+    // small sequential ids, the trace viewer shows one row per thread
+    int threadId()
+    {
+        static thread_local int tid = next_tid_.fetch_add(1);
+        return tid;
+    }
+
+    void flushLoop()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (!stop_)
+        {
+            cv_.wait_for(lock, std::chrono::seconds(1));
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    // writes the pending events outside of the lock, so recording never waits for the file
+    void flush()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            writing_.swap(pending_);
+        }
+        for (const Event &event : writing_)
+        {
+            std::fprintf(file_, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+                         num_written_ == 0 ? "" : ",\n", event.name, pid_, event.tid, event.begin_us, event.duration_us);
+            ++num_written_;
+        }
+        std::fflush(file_);
+        writing_.clear();
+    }
+
+    const Clock::time_point origin_;
+    const int pid_;
+    std::atomic<bool> enabled_{false};
+    std::atomic<int> next_tid_{1};
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::vector<Event> pending_; // guarded by mtx_
+    std::vector<Event> writing_; // flusher thread only (or the destructor after it stopped), as is num_written_
+    uint64_t num_written_ = 0;
+    std::FILE *file_ = nullptr;
+    std::thread flusher_;
+}; // Tracer
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char *_name, MetricStat &_stat) : name_(_name), stat_(_stat), begin_(Tracer::Clock::now()) {}
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    ~TraceSpan()
+    {
+        const Tracer::Clock::time_point end = Tracer::Clock::now();
+        stat_.add(std::chrono::duration<double, std::milli>(end - begin_).count());
+        Tracer::instance().record(name_, begin_, end);
+    }
+
+private:
+    const char *name_;
+    MetricStat &stat_;
+    const Tracer::Clock::time_point begin_;
+}; // TraceSpan
+
+#define TRACE_CONCAT_INNER(_a, _b) _a##_b
+#define TRACE_CONCAT(_a, _b) TRACE_CONCAT_INNER(_a, _b)
+
+#ifdef LIO_SAM_TRACING
+// _name must be a string literal
+#define TRACE_SPAN(_name)                                                                                  \
+    static MetricStat &TRACE_CONCAT(traceStat_, __LINE__) = Metrics::instance().stat(_name);              \
+    TraceSpan TRACE_CONCAT(traceSpan_, __LINE__)(_name, TRACE_CONCAT(traceStat_, __LINE__))
+#else
+#define TRACE_SPAN(_name) ((void)0)
+#endif
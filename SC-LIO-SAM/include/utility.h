@@ -10,6 +10,10 @@
 #include <nav_msgs/Path.h>
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include "metrics.h"
+#include "trace.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -51,6 +55,11 @@
 #include <array>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <set>
+#include <map>
+#include <unordered_set>
 #include <sstream>
 
 using namespace std;
@@ -59,7 +68,7 @@ typedef std::numeric_limits< double > dbl;
 
 typedef pcl::PointXYZI PointType;
 
-enum class SensorType { MULRAN, VELODYNE, OUSTER, LIVOX };
+enum class SensorType { MULRAN, VELODYNE, OUSTER, LIVOX, HESAI };
 
 class ParamServer
 {
@@ -90,6 +99,10 @@ public:
     // Save pcd
     bool savePCD;
     string savePCDDirectory;
+    bool saveBinarySCD;
+    bool saveSessionFile;
+    bool sessionFileCompression;
+    int keyframeWriterQueueSize;
 
     // Velodyne Sensor Configuration: Velodyne
     SensorType sensor;
@@ -106,6 +119,7 @@ public:
     float imuGyrBiasN;
     float imuGravity;
     float imuRPYWeight;
+    float imuRepropagationBiasTolerance;
     vector<double> extRotV;
     vector<double> extRPYV;
     vector<double> extTransV;
@@ -131,12 +145,23 @@ public:
     // CPU Params
     int numberOfCores;
     double mappingProcessInterval;
+    bool  overloadScheduling;
+    float overloadLatencyBudget;
+    float overloadMaxScanAge;
+    int   overloadMaxLevel;
 
     // Surrounding map
     float surroundingkeyframeAddingDistThreshold; 
     float surroundingkeyframeAddingAngleThreshold; 
     float surroundingKeyframeDensity;
     float surroundingKeyframeSearchRadius;
+
+    // Transformed keyframe cloud cache
+    float keyframeCacheBudget;
+    float keyframeCacheInvalidateDist;
+    float keyframeCacheInvalidateAngle;
+    float keyframeMemoryBudget;
+    int   keyframeResidentRecent;
     
     // Loop closure
     bool  loopClosureEnableFlag;
@@ -146,11 +171,37 @@ public:
     float historyKeyframeSearchTimeDiff;
     int   historyKeyframeSearchNum;
     float historyKeyframeFitnessScore;
+    int   loopClosureCandidates;
+    std::string loopRegistrationMethod;
+    float loopRegistrationMaxCorrespondenceDistance;
+    float loopRegistrationCacheBudget;
+    float loopSubmapCacheBudget;
+
+    // iSAM2
+    bool  isamBatchedUpdates;
+    int   isamMaxExtraUpdates;
+    bool  isamBackEndThread;
+    int   isamWindowSize;
+
+    // Prior session
+    std::string loadSessionDirectory;
+    int   relocalizationAttempts;
+    float priorSessionCloudCacheBudget;
+
+    // Localization
+    bool  localizationMode;
+    std::string localizationMapDirectory;
+    float localizationTileSize;
+
+    // Tracing
+    std::string traceDirectory;
 
     // global map visualization radius
     float globalMapVisualizationSearchRadius;
     float globalMapVisualizationPoseDensity;
     float globalMapVisualizationLeafSize;
+    float globalMapVisualizationChunkSize;
+    float globalMapExportTileSize;
 
     ParamServer()
     {
@@ -173,6 +224,10 @@ public:
 
         nh.param<bool>("lio_sam/savePCD", savePCD, false);
         nh.param<std::string>("lio_sam/savePCDDirectory", savePCDDirectory, "/Downloads/LOAM/");
+        nh.param<bool>("lio_sam/saveBinarySCD", saveBinarySCD, false);
+        nh.param<bool>("lio_sam/saveSessionFile", saveSessionFile, false);
+        nh.param<bool>("lio_sam/sessionFileCompression", sessionFileCompression, true);
+        nh.param<int>("lio_sam/keyframeWriterQueueSize", keyframeWriterQueueSize, 64);
 
         std::string sensorStr;
         nh.param<std::string>("lio_sam/sensor", sensorStr, "");
@@ -188,14 +243,18 @@ public:
         {
             sensor = SensorType::MULRAN;
         }
-				else if (sensorStr == "livox")
+        else if (sensorStr == "livox")
         {
             sensor = SensorType::LIVOX;
         }
+        else if (sensorStr == "hesai")
+        {
+            sensor = SensorType::HESAI;
+        }
         else
         {
             ROS_ERROR_STREAM(
-                "Invalid sensor type (must be either 'velodyne' or 'ouster' or 'mulran'): " << sensorStr);
+                "Invalid sensor type (must be either 'velodyne', 'ouster', 'mulran', 'livox' or 'hesai'): " << sensorStr);
             ros::shutdown();
         }
 
@@ -211,6 +270,7 @@ public:
         nh.param<float>("lio_sam/imuGyrBiasN", imuGyrBiasN, 0.00003);
         nh.param<float>("lio_sam/imuGravity", imuGravity, 9.80511);
         nh.param<float>("lio_sam/imuRPYWeight", imuRPYWeight, 0.01);
+        nh.param<float>("lio_sam/imuRepropagationBiasTolerance", imuRepropagationBiasTolerance, 0.0);
         nh.param<vector<double>>("lio_sam/extrinsicRot", extRotV, vector<double>());
         nh.param<vector<double>>("lio_sam/extrinsicRPY", extRPYV, vector<double>());
         nh.param<vector<double>>("lio_sam/extrinsicTrans", extTransV, vector<double>());
@@ -233,12 +293,22 @@ public:
 
         nh.param<int>("lio_sam/numberOfCores", numberOfCores, 2);
         nh.param<double>("lio_sam/mappingProcessInterval", mappingProcessInterval, 0.15);
+        nh.param<bool>("lio_sam/overloadScheduling", overloadScheduling, false);
+        nh.param<float>("lio_sam/overloadLatencyBudget", overloadLatencyBudget, 0.2);
+        nh.param<float>("lio_sam/overloadMaxScanAge", overloadMaxScanAge, 0.5);
+        nh.param<int>("lio_sam/overloadMaxLevel", overloadMaxLevel, 3);
 
         nh.param<float>("lio_sam/surroundingkeyframeAddingDistThreshold", surroundingkeyframeAddingDistThreshold, 1.0);
         nh.param<float>("lio_sam/surroundingkeyframeAddingAngleThreshold", surroundingkeyframeAddingAngleThreshold, 0.2);
         nh.param<float>("lio_sam/surroundingKeyframeDensity", surroundingKeyframeDensity, 1.0);
         nh.param<float>("lio_sam/surroundingKeyframeSearchRadius", surroundingKeyframeSearchRadius, 50.0);
 
+        nh.param<float>("lio_sam/keyframeCacheBudget", keyframeCacheBudget, 512.0);
+        nh.param<float>("lio_sam/keyframeCacheInvalidateDist", keyframeCacheInvalidateDist, 0.01);
+        nh.param<float>("lio_sam/keyframeCacheInvalidateAngle", keyframeCacheInvalidateAngle, 0.001);
+        nh.param<float>("lio_sam/keyframeMemoryBudget", keyframeMemoryBudget, 0.0);
+        nh.param<int>("lio_sam/keyframeResidentRecent", keyframeResidentRecent, 100);
+
         nh.param<bool>("lio_sam/loopClosureEnableFlag", loopClosureEnableFlag, false);
         nh.param<float>("lio_sam/loopClosureFrequency", loopClosureFrequency, 1.0);
         nh.param<int>("lio_sam/surroundingKeyframeSize", surroundingKeyframeSize, 50);
@@ -246,12 +316,50 @@ public:
         nh.param<float>("lio_sam/historyKeyframeSearchTimeDiff", historyKeyframeSearchTimeDiff, 30.0);
         nh.param<int>("lio_sam/historyKeyframeSearchNum", historyKeyframeSearchNum, 25);
         nh.param<float>("lio_sam/historyKeyframeFitnessScore", historyKeyframeFitnessScore, 0.3);
+        nh.param<int>("lio_sam/loopClosureCandidates", loopClosureCandidates, 3);
+        nh.param<std::string>("lio_sam/loopRegistrationMethod", loopRegistrationMethod, "ICP");
+        nh.param<float>("lio_sam/loopRegistrationMaxCorrespondenceDistance", loopRegistrationMaxCorrespondenceDistance, 150.0);
+        nh.param<float>("lio_sam/loopRegistrationCacheBudget", loopRegistrationCacheBudget, 64.0);
+        nh.param<float>("lio_sam/loopSubmapCacheBudget", loopSubmapCacheBudget, 128.0);
+
+        nh.param<bool>("lio_sam/isamBatchedUpdates", isamBatchedUpdates, false);
+        nh.param<int>("lio_sam/isamMaxExtraUpdates", isamMaxExtraUpdates, 5);
+        nh.param<bool>("lio_sam/isamBackEndThread", isamBackEndThread, false);
+        nh.param<int>("lio_sam/isamWindowSize", isamWindowSize, 0);
+
+        nh.param<std::string>("lio_sam/loadSessionDirectory", loadSessionDirectory, "");
+        nh.param<int>("lio_sam/relocalizationAttempts", relocalizationAttempts, 10);
+        nh.param<float>("lio_sam/priorSessionCloudCacheBudget", priorSessionCloudCacheBudget, 256.0);
+
+        nh.param<bool>("lio_sam/localizationMode", localizationMode, false);
+        nh.param<std::string>("lio_sam/localizationMapDirectory", localizationMapDirectory, "");
+        nh.param<float>("lio_sam/localizationTileSize", localizationTileSize, 50.0);
+
+        nh.param<std::string>("lio_sam/traceDirectory", traceDirectory, "");
+        if (!traceDirectory.empty())
+            openTrace();
 
         nh.param<float>("lio_sam/globalMapVisualizationSearchRadius", globalMapVisualizationSearchRadius, 1e3);
         nh.param<float>("lio_sam/globalMapVisualizationPoseDensity", globalMapVisualizationPoseDensity, 10.0);
         nh.param<float>("lio_sam/globalMapVisualizationLeafSize", globalMapVisualizationLeafSize, 1.0);
+        nh.param<float>("lio_sam/globalMapVisualizationChunkSize", globalMapVisualizationChunkSize, 50.0);
+        nh.param<float>("lio_sam/globalMapExportTileSize", globalMapExportTileSize, 100.0);
 
         usleep(100);
+    }
+
+    // one Chrome trace per process, <traceDirectory>/<node name>.trace.json; the nodes of frontEnd share it
+    void openTrace()
+    {
+#ifdef LIO_SAM_TRACING
+        std::string node = ros::this_node::getName();
+        std::replace(node.begin(), node.end(), '/', '_');
+        std::string path = traceDirectory + "/" + node.substr(node.find_first_not_of('_')) + ".trace.json";
+        if (!Tracer::instance().open(path))
+            ROS_WARN("Cannot write the trace to %s", path.c_str());
+#else
+        ROS_WARN("traceDirectory is set, but lio_sam was built without TRACING");
+#endif
     }
 		//transform imu data from imu frame to lidar frame
     sensor_msgs::Imu imuConverter(const sensor_msgs::Imu& imu_in)
@@ -299,6 +407,41 @@ sensor_msgs::PointCloud2 publishCloud(ros::Publisher *thisPub, pcl::PointCloud<P
     return tempCloud;
 }
 
+// Metrics (metrics.h) as one DiagnosticStatus per metric; only the metrics starting with prefix, if given
+void publishMetricsDiagnostics(ros::Publisher *thisPub, const std::string &prefix = "")
+{
+    if (thisPub->getNumSubscribers() == 0)
+        return;
+
+    diagnostic_msgs::DiagnosticArray diagnostics;
+    diagnostics.header.stamp = ros::Time::now();
+    Metrics::instance().forEach([&](const std::string &name, const MetricStat::Summary &summary)
+    {
+        if (name.compare(0, prefix.size(), prefix) != 0)
+            return;
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = "lio_sam/" + name;
+        status.hardware_id = "lio_sam";
+        auto addValue = [&](const std::string &key, const std::string &value)
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = key;
+            kv.value = value;
+            status.values.push_back(kv);
+        };
+        addValue("count", std::to_string(summary.count));
+        addValue("mean", std::to_string(summary.mean));
+        addValue("max", std::to_string(summary.max));
+        addValue("last", std::to_string(summary.last));
+        addValue("p50", std::to_string(summary.p50));
+        addValue("p90", std::to_string(summary.p90));
+        addValue("p99", std::to_string(summary.p99));
+        diagnostics.status.push_back(status);
+    });
+    thisPub->publish(diagnostics);
+}
+
 template<typename T>
 double ROS_TIME(T msg)
 {
@@ -349,7 +492,8 @@ float pointDistance(PointType p1, PointType p2)
     return sqrt((p1.x-p2.x)*(p1.x-p2.x) + (p1.y-p2.y)*(p1.y-p2.y) + (p1.z-p2.z)*(p1.z-p2.z));
 }
 
-void saveSCD(std::string fileName, Eigen::MatrixXd matrix, std::string delimiter = " ")
+template<typename Derived>
+void saveSCD(std::string fileName, const Eigen::MatrixBase<Derived>& matrix, std::string delimiter = " ")
 {
     // delimiter: ", " or " " etc.
 
@@ -364,6 +508,24 @@ void saveSCD(std::string fileName, Eigen::MatrixXd matrix, std::string delimiter
     }
 }
 
+// binary SCD: int32 rows, int32 cols, then rows x cols float32 in row-major order (the same order as the text SCD)
+template<typename Derived>
+void saveSCDBinary(std::string fileName, const Eigen::MatrixBase<Derived>& matrix)
+{
+    const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> rowMajor = matrix.template cast<float>();
+    const int32_t rows = rowMajor.rows();
+    const int32_t cols = rowMajor.cols();
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (file.is_open())
+    {
+        file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+        file.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+        file.write(reinterpret_cast<const char*>(rowMajor.data()), sizeof(float) * rowMajor.size());
+        file.close();
+    }
+}
+
 std::string padZeros(int val, int num_digits = 6) {
   std::ostringstream out;
   out << std::internal << std::setfill('0') << std::setw(num_digits) << val;
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Insert-only voxel map split into square xy chunks, for the global map visualization.
+ *
+ * Like VoxelLocalMap (localMap.h), each voxel keeps the running sum of the points that fell in it,
+ * so a chunk's cloud is the centroid-per-voxel result of pcl::VoxelGrid over everything inserted.
+ * The inserted clouds are not kept. Chunks touched by an insert are marked dirty; a chunk's
+ * cloud is regenerated only when it is asked for after it changed.
+ */
+template <typename PointT>
+class VoxelChunkMap
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudPtr = typename Cloud::Ptr;
+
+    void setLeafSize(float _leaf_size)
+    {
+        inverse_leaf_size_ = 1.0f / _leaf_size;
+        clear();
+    }
+
+    void setChunkSize(float _chunk_size)
+    {
+        chunk_size_ = _chunk_size;
+        clear();
+    }
+
+    void insert(const Cloud &_cloud)
+    {
+        for (const auto &pt : _cloud.points)
+        {
+            if (!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z))
+                continue;
+
+            const int64_t key = chunkKey(pt.x, pt.y);
+            Chunk &chunk = chunks_[key];
+            Voxel &v = chunk.voxels[voxelKey(pt)];
+            v.x += pt.x;
+            v.y += pt.y;
+            v.z += pt.z;
+            v.intensity += pt.intensity;
+            ++v.count;
+            chunk.cloud_stale = true;
+            if (!chunk.dirty)
+            {
+                chunk.dirty = true;
+                dirty_keys_.push_back(key);
+            }
+        }
+    }
+
+    void clear()
+    {
+        chunks_.clear();
+        dirty_keys_.clear();
+    }
+
+    // chunks changed since the last call
+    std::vector<int64_t> takeDirtyChunks()
+    {
+        std::vector<int64_t> dirty;
+        dirty.swap(dirty_keys_);
+        for (int64_t key : dirty)
+            chunks_[key].dirty = false;
+        return dirty;
+    }
+
+    std::vector<int64_t> chunkKeys() const
+    {
+        std::vector<int64_t> keys;
+        keys.reserve(chunks_.size());
+        for (const auto &chunk : chunks_)
+            keys.push_back(chunk.first);
+        return keys;
+    }
+
+    // xy center of a chunk
+    void chunkCenter(int64_t _key, float &_x, float &_y) const
+    {
+        _x = (float(int32_t(_key >> 32)) + 0.5f) * chunk_size_;
+        _y = (float(int32_t(_key & 0xFFFFFFFF)) + 0.5f) * chunk_size_;
+    }
+
+    float chunkSize() const { return chunk_size_; }
+
+    // voxel centroids of one chunk; cached until the chunk changes again
+    CloudPtr chunkCloud(int64_t _key)
+    {
+        auto it = chunks_.find(_key);
+        if (it == chunks_.end())
+            return CloudPtr(new Cloud());
+
+        Chunk &chunk = it->second;
+        if (!chunk.cloud || chunk.cloud_stale)
+        {
+            CloudPtr cloud(new Cloud());
+            cloud->reserve(chunk.voxels.size());
+            for (const auto &voxel : chunk.voxels)
+            {
+                const Voxel &v = voxel.second;
+                PointT pt;
+                pt.x = v.x / v.count;
+                pt.y = v.y / v.count;
+                pt.z = v.z / v.count;
+                pt.intensity = v.intensity / v.count;
+                cloud->push_back(pt);
+            }
+            chunk.cloud = cloud;
+            chunk.cloud_stale = false;
+        }
+        return chunk.cloud;
+    }
+
+private:
+    struct Voxel
+    {
+        double x = 0;
+        double y = 0;
+        double z = 0;
+        double intensity = 0;
+        int count = 0;
+    };
+
+    struct Chunk
+    {
+        std::unordered_map<int64_t, Voxel> voxels;
+        CloudPtr cloud;         // cached centroids
+        bool cloud_stale = true; // voxels changed since the cloud was generated
+        bool dirty = false;      // listed in dirty_keys_
+    };
+
+    int64_t chunkKey(float _x, float _y) const
+    {
+        const int32_t ix = static_cast<int32_t>(std::floor(_x / chunk_size_));
+        const int32_t iy = static_cast<int32_t>(std::floor(_y / chunk_size_));
+        return static_cast<int64_t>((uint64_t(uint32_t(ix)) << 32) | uint32_t(iy));
+    }
+
+    // same grid as pcl::VoxelGrid: floor(p / leaf), 21 bits per axis (+-1M voxels)
+    int64_t voxelKey(const PointT &_pt) const
+    {
+        const int64_t ix = static_cast<int64_t>(std::floor(_pt.x * inverse_leaf_size_));
+        const int64_t iy = static_cast<int64_t>(std::floor(_pt.y * inverse_leaf_size_));
+        const int64_t iz = static_cast<int64_t>(std::floor(_pt.z * inverse_leaf_size_));
+        return ((ix & 0x1FFFFF) << 42) | ((iy & 0x1FFFFF) << 21) | (iz & 0x1FFFFF);
+    }
+
+    float inverse_leaf_size_ = 1.0f;
+    float chunk_size_ = 50.0f;
+    std::unordered_map<int64_t, Chunk> chunks_;
+    std::vector<int64_t> dirty_keys_;
+}; // VoxelChunkMap
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Drop-in for pcl::VoxelGrid (setLeafSize / setInputCloud / filter) that keeps its working buffers between calls.
+ *
+ * Same grid and output as pcl::VoxelGrid with its defaults: floor(p / leaf) voxels, one point per occupied voxel with the
+ * mean of every field (x y z intensity), in the same z, y, x voxel order; non-finite points are dropped. pcl::VoxelGrid
+ * allocates its index vector on every call, this one reuses the capacity of the previous largest input, so filtering
+ * a scan in steady state does not allocate (the output cloud keeps its capacity as well). Not thread-safe.
+ */
+template <typename PointT>
+class VoxelFilter
+{
+public:
+    using Cloud = pcl::PointCloud<PointT>;
+    using CloudConstPtr = typename Cloud::ConstPtr;
+
+    void setLeafSize(float _lx, float _ly, float _lz)
+    {
+        inverse_leaf_size_[0] = 1.0f / _lx;
+        inverse_leaf_size_[1] = 1.0f / _ly;
+        inverse_leaf_size_[2] = 1.0f / _lz;
+    }
+
+    void setInputCloud(const CloudConstPtr &_cloud)
+    {
+        input_ = _cloud;
+    }
+
+    void filter(Cloud &_cloud_out)
+    {
+        keys_.clear();
+        const auto &points = input_->points;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            const PointT &pt = points[i];
+            if (!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z))
+                continue;
+            keys_.emplace_back(voxelKey(pt), static_cast<uint32_t>(i));
+        }
+        std::sort(keys_.begin(), keys_.end());
+
+        _cloud_out.clear();
+        for (size_t begin = 0; begin < keys_.size();)
+        {
+            size_t end = begin;
+            float x = 0, y = 0, z = 0, intensity = 0;
+            for (; end < keys_.size() && keys_[end].first == keys_[begin].first; ++end)
+            {
+                const PointT &pt = points[keys_[end].second];
+                x += pt.x;
+                y += pt.y;
+                z += pt.z;
+                intensity += pt.intensity;
+            }
+            const float count = static_cast<float>(end - begin);
+            PointT centroid;
+            centroid.x = x / count;
+            centroid.y = y / count;
+            centroid.z = z / count;
+            centroid.intensity = intensity / count;
+            _cloud_out.push_back(centroid);
+            begin = end;
+        }
+        _cloud_out.header = input_->header;
+        _cloud_out.is_dense = true;
+    }
+
+private:
+    // z, y, x major as pcl::VoxelGrid's voxel index, 21 bits per axis (+-1M voxels)
+    uint64_t voxelKey(const PointT &_pt) const
+    {
+        const int64_t bias = int64_t(1) << 20;
+        const uint64_t ix = static_cast<uint64_t>(static_cast<int64_t>(std::floor(_pt.x * inverse_leaf_size_[0])) + bias) & 0x1FFFFF;
+        const uint64_t iy = static_cast<uint64_t>(static_cast<int64_t>(std::floor(_pt.y * inverse_leaf_size_[1])) + bias) & 0x1FFFFF;
+        const uint64_t iz = static_cast<uint64_t>(static_cast<int64_t>(std::floor(_pt.z * inverse_leaf_size_[2])) + bias) & 0x1FFFFF;
+        return (iz << 42) | (iy << 21) | ix;
+    }
+
+    float inverse_leaf_size_[3] = {1.0f, 1.0f, 1.0f};
+    CloudConstPtr input_;
+    std::vector<std::pair<uint64_t, uint32_t>> keys_; // (voxel, point index)
+}; // VoxelFilter
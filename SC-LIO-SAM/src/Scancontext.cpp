@@ -36,106 +36,49 @@ float xy2theta( const float & _x, const float & _y )
 } // xy2theta
 
 
-MatrixXd circshift( MatrixXd &_mat, int _num_shift )
-{
-    // shift columns to right direction 
-    assert(_num_shift >= 0);
-
-    if( _num_shift == 0 )
-    {
-        MatrixXd shifted_mat( _mat );
-        return shifted_mat; // Early return 
-    }
-
-    MatrixXd shifted_mat = MatrixXd::Zero( _mat.rows(), _mat.cols() );
-    for ( int col_idx = 0; col_idx < _mat.cols(); col_idx++ )
-    {
-        int new_location = (col_idx + _num_shift) % _mat.cols();
-        shifted_mat.col(new_location) = _mat.col(col_idx);
-    }
-
-    return shifted_mat;
-
-} // circshift
-
-
-std::vector<float> eig2stdvec( MatrixXd _eigmat )
-{
-    std::vector<float> vec( _eigmat.data(), _eigmat.data() + _eigmat.size() );
-    return vec;
-} // eig2stdvec
+constexpr int SCManager::PC_NUM_RING;
+constexpr int SCManager::PC_NUM_SECTOR;
 
 
-double SCManager::distDirectSC ( MatrixXd &_sc1, MatrixXd &_sc2 )
+double SCManager::distDirectSC ( const SCDescriptor &_sc1, const SCDescriptor &_sc2 )
 {
-    int num_eff_cols = 0; // i.e., to exclude all-nonzero sector
-    double sum_sector_similarity = 0;
-    for ( int col_idx = 0; col_idx < _sc1.cols(); col_idx++ )
-    {
-        VectorXd col_sc1 = _sc1.col(col_idx);
-        VectorXd col_sc2 = _sc2.col(col_idx);
-        
-        if( (col_sc1.norm() == 0) | (col_sc2.norm() == 0) )
-            continue; // don't count this sector pair. 
-
-        double sector_similarity = col_sc1.dot(col_sc2) / (col_sc1.norm() * col_sc2.norm());
+    float norms_sc1[SC_NUM_SECTOR], norms_sc2[SC_NUM_SECTOR];
+    scColumnNorms( _sc1.data(), norms_sc1 );
+    scColumnNorms( _sc2.data(), norms_sc2 );
 
-        sum_sector_similarity = sum_sector_similarity + sector_similarity;
-        num_eff_cols = num_eff_cols + 1;
-    }
-    
-    double sc_sim = sum_sector_similarity / num_eff_cols;
-    return 1.0 - sc_sim;
+    return scDistAtShift( _sc1.data(), norms_sc1, _sc2.data(), norms_sc2, 0 );
 
 } // distDirectSC
 
 
-int SCManager::fastAlignUsingVkey( MatrixXd & _vkey1, MatrixXd & _vkey2)
+int SCManager::fastAlignUsingVkey( const SCSectorKey & _vkey1, const SCSectorKey & _vkey2)
 {
-    int argmin_vkey_shift = 0;
-    double min_veky_diff_norm = 10000000;
-    for ( int shift_idx = 0; shift_idx < _vkey1.cols(); shift_idx++ )
-    {
-        MatrixXd vkey2_shifted = circshift(_vkey2, shift_idx);
-
-        MatrixXd vkey_diff = _vkey1 - vkey2_shifted;
-
-        double cur_diff_norm = vkey_diff.norm();
-        if( cur_diff_norm < min_veky_diff_norm )
-        {
-            argmin_vkey_shift = shift_idx;
-            min_veky_diff_norm = cur_diff_norm;
-        }
-    }
-
-    return argmin_vkey_shift;
+    return scAlignSectorKeys( _vkey1.data(), _vkey2.data() );
 
 } // fastAlignUsingVkey
 
 
-std::pair<double, int> SCManager::distanceBtnScanContext( MatrixXd &_sc1, MatrixXd &_sc2 )
+static std::pair<double, int> distanceBtnScanContextImpl( const float* _sc1, const float* _norms1, const float* _vkey1,
+                                                          const float* _sc2, const float* _norms2, const float* _vkey2, double _search_ratio )
 {
     // 1. fast align using variant key (not in original IROS18)
-    MatrixXd vkey_sc1 = makeSectorkeyFromScancontext( _sc1 );
-    MatrixXd vkey_sc2 = makeSectorkeyFromScancontext( _sc2 );
-    int argmin_vkey_shift = fastAlignUsingVkey( vkey_sc1, vkey_sc2 );
+    int argmin_vkey_shift = scAlignSectorKeys( _vkey1, _vkey2 );
 
-    const int SEARCH_RADIUS = round( 0.5 * SEARCH_RATIO * _sc1.cols() ); // a half of search range 
+    const int SEARCH_RADIUS = round( 0.5 * _search_ratio * SC_NUM_SECTOR ); // a half of search range 
     std::vector<int> shift_idx_search_space { argmin_vkey_shift };
     for ( int ii = 1; ii < SEARCH_RADIUS + 1; ii++ )
     {
-        shift_idx_search_space.push_back( (argmin_vkey_shift + ii + _sc1.cols()) % _sc1.cols() );
-        shift_idx_search_space.push_back( (argmin_vkey_shift - ii + _sc1.cols()) % _sc1.cols() );
+        shift_idx_search_space.push_back( (argmin_vkey_shift + ii + SC_NUM_SECTOR) % SC_NUM_SECTOR );
+        shift_idx_search_space.push_back( (argmin_vkey_shift - ii + SC_NUM_SECTOR) % SC_NUM_SECTOR );
     }
     std::sort(shift_idx_search_space.begin(), shift_idx_search_space.end());
 
-    // 2. fast columnwise diff 
+    // 2. fast columnwise diff (shifts are applied by indexing, not by shifted copies)
     int argmin_shift = 0;
     double min_sc_dist = 10000000;
     for ( int num_shift: shift_idx_search_space )
     {
-        MatrixXd sc2_shifted = circshift(_sc2, num_shift);
-        double cur_sc_dist = distDirectSC( _sc1, sc2_shifted );
+        double cur_sc_dist = scDistAtShift( _sc1, _norms1, _sc2, _norms2, num_shift );
         if( cur_sc_dist < min_sc_dist )
         {
             argmin_shift = num_shift;
@@ -145,18 +88,40 @@ std::pair<double, int> SCManager::distanceBtnScanContext( MatrixXd &_sc1, Matrix
 
     return make_pair(min_sc_dist, argmin_shift);
 
+} // distanceBtnScanContextImpl
+
+
+std::pair<double, int> SCManager::distanceBtnScanContext( const SCDescriptor &_sc1, const SCDescriptor &_sc2 )
+{
+    float norms_sc1[SC_NUM_SECTOR], norms_sc2[SC_NUM_SECTOR];
+    scColumnNorms( _sc1.data(), norms_sc1 );
+    scColumnNorms( _sc2.data(), norms_sc2 );
+    SCSectorKey vkey_sc1 = makeSectorkeyFromScancontext( _sc1 );
+    SCSectorKey vkey_sc2 = makeSectorkeyFromScancontext( _sc2 );
+
+    return distanceBtnScanContextImpl( _sc1.data(), norms_sc1, vkey_sc1.data(), _sc2.data(), norms_sc2, vkey_sc2.data(), SEARCH_RATIO );
+
 } // distanceBtnScanContext
 
 
-MatrixXd SCManager::makeScancontext( pcl::PointCloud<SCPointType> & _scan_down )
+std::pair<double, int> SCManager::distanceBtnScanContext( size_t _idx1, size_t _idx2 ) const
 {
-    TicToc t_making_desc;
+    return distanceBtnScanContextImpl( polarcontexts_.descriptorData(_idx1), polarcontexts_.columnNormsData(_idx1), polarcontexts_.sectorkeyData(_idx1),
+                                       polarcontexts_.descriptorData(_idx2), polarcontexts_.columnNormsData(_idx2), polarcontexts_.sectorkeyData(_idx2),
+                                       SEARCH_RATIO );
+
+} // distanceBtnScanContext
+
+
+SCDescriptor SCManager::makeScancontext( pcl::PointCloud<SCPointType> & _scan_down )
+{
+    TRACE_SPAN("sc/make_descriptor_ms");
 
     int num_pts_scan_down = _scan_down.points.size();
 
     // main
     const int NO_POINT = -1000;
-    MatrixXd desc = NO_POINT * MatrixXd::Ones(PC_NUM_RING, PC_NUM_SECTOR);
+    SCDescriptor desc = SCDescriptor::Constant(NO_POINT);
 
     SCPointType pt;
     float azim_angle, azim_range; // wihtin 2d plane
@@ -189,158 +154,209 @@ MatrixXd SCManager::makeScancontext( pcl::PointCloud<SCPointType> & _scan_down )
             if( desc(row_idx, col_idx) == NO_POINT )
                 desc(row_idx, col_idx) = 0;
 
-    t_making_desc.toc("PolarContext making");
-
     return desc;
 } // SCManager::makeScancontext
 
 
-MatrixXd SCManager::makeRingkeyFromScancontext( Eigen::MatrixXd &_desc )
+SCRingKey SCManager::makeRingkeyFromScancontext( const SCDescriptor &_desc )
 {
     /* 
      * summary: rowwise mean vector
     */
-    Eigen::MatrixXd invariant_key(_desc.rows(), 1);
-    for ( int row_idx = 0; row_idx < _desc.rows(); row_idx++ )
-    {
-        Eigen::MatrixXd curr_row = _desc.row(row_idx);
-        invariant_key(row_idx, 0) = curr_row.mean();
-    }
-
-    return invariant_key;
+    return _desc.rowwise().mean();
 } // SCManager::makeRingkeyFromScancontext
 
 
-MatrixXd SCManager::makeSectorkeyFromScancontext( Eigen::MatrixXd &_desc )
+SCSectorKey SCManager::makeSectorkeyFromScancontext( const SCDescriptor &_desc )
 {
     /* 
      * summary: columnwise mean vector
     */
-    Eigen::MatrixXd variant_key(1, _desc.cols());
-    for ( int col_idx = 0; col_idx < _desc.cols(); col_idx++ )
-    {
-        Eigen::MatrixXd curr_col = _desc.col(col_idx);
-        variant_key(0, col_idx) = curr_col.mean();
-    }
-
-    return variant_key;
+    return _desc.colwise().mean();
 } // SCManager::makeSectorkeyFromScancontext
 
 
-const Eigen::MatrixXd& SCManager::getConstRefRecentSCD(void)
+Eigen::Map<const SCDescriptor> SCManager::getConstRefRecentSCD(void)
 {
-    return polarcontexts_.back();
+    return polarcontexts_.descriptor( polarcontexts_.size() - 1 );
 }
 
 
 void SCManager::makeAndSaveScancontextAndKeys( pcl::PointCloud<SCPointType> & _scan_down )
 {
-    Eigen::MatrixXd sc = makeScancontext(_scan_down); // v1 
-    Eigen::MatrixXd ringkey = makeRingkeyFromScancontext( sc );
-    Eigen::MatrixXd sectorkey = makeSectorkeyFromScancontext( sc );
-    std::vector<float> polarcontext_invkey_vec = eig2stdvec( ringkey );
+    SCDescriptor sc = makeScancontext(_scan_down); // v1 
+    SCRingKey ringkey = makeRingkeyFromScancontext( sc );
+    SCSectorKey sectorkey = makeSectorkeyFromScancontext( sc );
 
-    polarcontexts_.push_back( sc ); 
-    polarcontext_invkeys_.push_back( ringkey );
-    polarcontext_vkeys_.push_back( sectorkey );
-    polarcontext_invkeys_mat_.push_back( polarcontext_invkey_vec );
+    polarcontexts_.push_back( sc, ringkey, sectorkey );
 
-    // cout <<polarcontext_vkeys_.size() << endl;
+    // append to the ring-key index (no periodic full rebuild) and publish; readers of the old snapshot are not waited for
+    TicToc t_tree_construction;
+    std::shared_ptr<const SCSnapshot> next = snapshot_->append( 10 /* max leaf */ ); // only this thread writes snapshot_
+    std::atomic_store( &snapshot_, next );
+    Metrics::instance().record( "sc/tree_build_ms", t_tree_construction.toc("Tree construction") );
 
 } // SCManager::makeAndSaveScancontextAndKeys
 
 
 std::pair<int, float> SCManager::detectLoopClosureID ( void )
 {
-    int loop_id { -1 }; // init with -1, -1 means no loop (== LeGO-LOAM's variable "closestHistoryFrameID")
+    std::shared_ptr<const SCSnapshot> snap = snapshot();
+    if( snap->size() == 0 )
+        return std::pair<int, float> {-1, 0.0};
+    return detectLoopClosureID( *snap, snap->size() - 1 ); // the latest descriptor
 
-    auto curr_key = polarcontext_invkeys_mat_.back(); // current observation (query)
-    auto curr_desc = polarcontexts_.back(); // current observation (query)
+} // SCManager::detectLoopClosureID
 
-    /* 
-     * step 1: candidates from ringkey tree_
-     */
-    if( (int)polarcontext_invkeys_mat_.size() < NUM_EXCLUDE_RECENT + 1)
-    {
-        std::pair<int, float> result {loop_id, 0.0};
-        return result; // Early return 
-    }
 
-    // tree_ reconstruction (not mandatory to make everytime)
-    if( tree_making_period_conter % TREE_MAKING_PERIOD_ == 0) // to save computation cost
-    {
-        TicToc t_tree_construction;
+std::pair<int, float> SCManager::detectLoopClosureID ( const SCSnapshot &_snapshot, size_t _query_idx )
+{
+    std::vector<SCLoopCandidate> candidates = detectLoopClosureCandidates( _snapshot, _query_idx );
+    if( candidates.empty() )
+        return std::pair<int, float> {-1, 0.0}; // -1 means no loop (== LeGO-LOAM's variable "closestHistoryFrameID")
 
-        polarcontext_invkeys_to_search_.clear();
-        polarcontext_invkeys_to_search_.assign( polarcontext_invkeys_mat_.begin(), polarcontext_invkeys_mat_.end() - NUM_EXCLUDE_RECENT ) ;
+    return std::pair<int, float> {candidates.front().index, candidates.front().yaw_diff_rad};
+
+} // SCManager::detectLoopClosureID
 
-        polarcontext_tree_.reset(); 
-        polarcontext_tree_ = std::make_unique<InvKeyTree>(PC_NUM_RING /* dim */, polarcontext_invkeys_to_search_, 10 /* max leaf */ );
-        // tree_ptr_->index->buildIndex(); // inernally called in the constructor of InvKeyTree (for detail, refer the nanoflann and KDtreeVectorOfVectorsAdaptor)
-        t_tree_construction.toc("Tree construction");
-    }
-    tree_making_period_conter = tree_making_period_conter + 1;
-        
-    double min_dist = 10000000; // init with somthing large
-    int nn_align = 0;
-    int nn_idx = 0;
 
-    // knn search
+std::vector<SCLoopCandidate> SCManager::rankCandidates ( const SCSnapshot &_snapshot, const float* _desc, const float* _norms, const float* _ringkey,
+                                                         const float* _sectorkey, size_t _index_limit ) const
+{
+    std::vector<SCLoopCandidate> candidates;
+
+    /* 
+     * step 1: candidates from ringkey tree_
+     */
     std::vector<size_t> candidate_indexes( NUM_CANDIDATES_FROM_TREE ); 
     std::vector<float> out_dists_sqr( NUM_CANDIDATES_FROM_TREE );
 
     TicToc t_tree_search;
-    nanoflann::KNNResultSet<float> knnsearch_result( NUM_CANDIDATES_FROM_TREE );
+    SCExcludeRecentResultSet knnsearch_result( NUM_CANDIDATES_FROM_TREE, _index_limit );
     knnsearch_result.init( &candidate_indexes[0], &out_dists_sqr[0] );
-    polarcontext_tree_->index->findNeighbors( knnsearch_result, &curr_key[0] /* query */, nanoflann::SearchParams(10) ); 
-    t_tree_search.toc("Tree search");
+    _snapshot.findNeighbors( knnsearch_result, _ringkey /* query */, nanoflann::SearchParams(10) ); 
+    Metrics::instance().record( "sc/tree_search_ms", t_tree_search.toc("Tree search") );
+    const int num_candidates = knnsearch_result.size();
 
     /* 
      *  step 2: pairwise distance (find optimal columnwise best-fit using cosine distance)
      */
-    TicToc t_calc_dist;   
-    for ( int candidate_iter_idx = 0; candidate_iter_idx < NUM_CANDIDATES_FROM_TREE; candidate_iter_idx++ )
+    TRACE_SPAN("sc/distance_ms");
+    for ( int candidate_iter_idx = 0; candidate_iter_idx < num_candidates; candidate_iter_idx++ )
     {
-        MatrixXd polarcontext_candidate = polarcontexts_[ candidate_indexes[candidate_iter_idx] ];
-        std::pair<double, int> sc_dist_result = distanceBtnScanContext( curr_desc, polarcontext_candidate ); 
-        
-        double candidate_dist = sc_dist_result.first;
-        int candidate_align = sc_dist_result.second;
+        const size_t idx = candidate_indexes[candidate_iter_idx];
+        std::pair<double, int> sc_dist_result = distanceBtnScanContextImpl( _desc, _norms, _sectorkey,
+                                                                            _snapshot.arena().descriptorData(idx), _snapshot.arena().columnNormsData(idx), _snapshot.arena().sectorkeyData(idx),
+                                                                            SEARCH_RATIO ); 
+
+        SCLoopCandidate candidate;
+        candidate.index = idx;
+        candidate.distance = sc_dist_result.first;
+        candidate.yaw_diff_rad = deg2rad(sc_dist_result.second * PC_UNIT_SECTORANGLE);
+        candidates.push_back( candidate );
+    }
+    std::sort( candidates.begin(), candidates.end(), []( const SCLoopCandidate &_a, const SCLoopCandidate &_b ) { return _a.distance < _b.distance; } );
 
-        if( candidate_dist < min_dist )
-        {
-            min_dist = candidate_dist;
-            nn_align = candidate_align;
+    return candidates;
+
+} // SCManager::rankCandidates
 
-            nn_idx = candidate_indexes[candidate_iter_idx];
-        }
-    }
-    t_calc_dist.toc("Distance calc");
+
+std::vector<SCLoopCandidate> SCManager::detectLoopClosureCandidates ( const SCSnapshot &_snapshot, size_t _query_idx )
+{
+    if( _query_idx >= _snapshot.size() || (int)_query_idx < NUM_EXCLUDE_RECENT )
+        return std::vector<SCLoopCandidate>(); // Early return 
+
+    // current observation (query); the NUM_EXCLUDE_RECENT most recent keys are in the index, but too close in time to be a loop
+    const size_t curr_idx = _query_idx;
+    const SCArena &arena = _snapshot.arena();
+    std::vector<SCLoopCandidate> candidates = rankCandidates( _snapshot, arena.descriptorData(curr_idx), arena.columnNormsData(curr_idx),
+                                                              arena.ringkeyData(curr_idx), arena.sectorkeyData(curr_idx),
+                                                              curr_idx + 1 - NUM_EXCLUDE_RECENT );
+
+    if( candidates.empty() )
+        return candidates;
 
     /* 
      * loop threshold check
      */
-    if( min_dist < SC_DIST_THRES )
+    const SCLoopCandidate nn = candidates.front();
+    if( nn.distance < SC_DIST_THRES )
     {
-        loop_id = nn_idx; 
-    
         // std::cout.precision(3); 
-        cout << "[Loop found] Nearest distance: " << min_dist << " btn " << polarcontexts_.size()-1 << " and " << nn_idx << "." << endl;
-        cout << "[Loop found] yaw diff: " << nn_align * PC_UNIT_SECTORANGLE << " deg." << endl;
+        cout << "[Loop found] Nearest distance: " << nn.distance << " btn " << curr_idx << " and " << nn.index << "." << endl;
+        cout << "[Loop found] yaw diff: " << rad2deg(nn.yaw_diff_rad) << " deg." << endl;
     }
     else
     {
         std::cout.precision(3); 
-        cout << "[Not loop] Nearest distance: " << min_dist << " btn " << polarcontexts_.size()-1 << " and " << nn_idx << "." << endl;
-        cout << "[Not loop] yaw diff: " << nn_align * PC_UNIT_SECTORANGLE << " deg." << endl;
+        cout << "[Not loop] Nearest distance: " << nn.distance << " btn " << curr_idx << " and " << nn.index << "." << endl;
+        cout << "[Not loop] yaw diff: " << rad2deg(nn.yaw_diff_rad) << " deg." << endl;
     }
 
-    // To do: return also nn_align (i.e., yaw diff)
-    float yaw_diff_rad = deg2rad(nn_align * PC_UNIT_SECTORANGLE);
-    std::pair<int, float> result {loop_id, yaw_diff_rad};
+    candidates.erase( std::remove_if( candidates.begin(), candidates.end(), [this]( const SCLoopCandidate &_c ) { return _c.distance >= SC_DIST_THRES; } ),
+                      candidates.end() );
+    return candidates;
 
-    return result;
+} // SCManager::detectLoopClosureCandidates
 
-} // SCManager::detectLoopClosureID
 
-// } // namespace SC2
\ No newline at end of file
+void SCManager::loadScancontext( const SCDescriptor &_desc )
+{
+    polarcontexts_.push_back( _desc, makeRingkeyFromScancontext( _desc ), makeSectorkeyFromScancontext( _desc ) );
+
+} // SCManager::loadScancontext
+
+
+void SCManager::buildIndex( void )
+{
+    TicToc t_tree_construction;
+    std::atomic_store( &snapshot_, SCSnapshot::build( polarcontexts_, polarcontexts_.size(), 10 /* max leaf */ ) );
+    Metrics::instance().record( "sc/tree_bulk_build_ms", t_tree_construction.toc("Tree bulk construction") );
+
+} // SCManager::buildIndex
+
+
+std::vector<SCLoopCandidate> SCManager::detectRelocalizationCandidates( pcl::PointCloud<SCPointType> & _scan_down )
+{
+    SCDescriptor sc = makeScancontext( _scan_down );
+    SCRingKey ringkey = makeRingkeyFromScancontext( sc );
+    SCSectorKey sectorkey = makeSectorkeyFromScancontext( sc );
+    float norms[SC_NUM_SECTOR];
+    scColumnNorms( sc.data(), norms );
+
+    return relocalizationCandidates( sc.data(), norms, ringkey.data(), sectorkey.data() );
+
+} // SCManager::detectRelocalizationCandidates
+
+
+std::vector<SCLoopCandidate> SCManager::detectRelocalizationCandidates( const SCSnapshot &_query_snapshot, size_t _query_idx )
+{
+    if( _query_idx >= _query_snapshot.size() )
+        return std::vector<SCLoopCandidate>();
+
+    const SCArena &arena = _query_snapshot.arena();
+    return relocalizationCandidates( arena.descriptorData(_query_idx), arena.columnNormsData(_query_idx),
+                                     arena.ringkeyData(_query_idx), arena.sectorkeyData(_query_idx) );
+
+} // SCManager::detectRelocalizationCandidates
+
+
+std::vector<SCLoopCandidate> SCManager::relocalizationCandidates( const float* _desc, const float* _norms, const float* _ringkey, const float* _sectorkey ) const
+{
+    std::shared_ptr<const SCSnapshot> snap = snapshot();
+    if( snap->size() == 0 )
+        return std::vector<SCLoopCandidate>();
+
+    // no recent exclusion, the stored descriptors are all from another session
+    std::vector<SCLoopCandidate> candidates = rankCandidates( *snap, _desc, _norms, _ringkey, _sectorkey, snap->size() );
+    if( ! candidates.empty() )
+        cout << "[Relocalization] Nearest distance: " << candidates.front().distance << " to " << candidates.front().index << "." << endl;
+
+    candidates.erase( std::remove_if( candidates.begin(), candidates.end(), [this]( const SCLoopCandidate &_c ) { return _c.distance >= SC_DIST_THRES; } ),
+                      candidates.end() );
+    return candidates;
+
+} // SCManager::relocalizationCandidates
+
+// } // namespace SC2
@@ -0,0 +1,74 @@
+#include "allocationCounter.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+// Replaces the glibc allocator entry points with counting wrappers around the glibc implementation (see "Replacing malloc"
+// in the glibc manual). The counter is initial-exec TLS of the executable, so counting never allocates itself.
+
+extern "C"
+{
+void *__libc_malloc(size_t _size);
+void *__libc_calloc(size_t _num, size_t _size);
+void *__libc_realloc(void *_ptr, size_t _size);
+void *__libc_memalign(size_t _alignment, size_t _size);
+void __libc_free(void *_ptr);
+}
+
+static thread_local uint64_t allocations __attribute__((tls_model("initial-exec"))) = 0;
+
+uint64_t threadAllocationCount()
+{
+    return allocations;
+}
+
+extern "C"
+{
+void *malloc(size_t _size)
+{
+    ++allocations;
+    return __libc_malloc(_size);
+}
+
+void *calloc(size_t _num, size_t _size)
+{
+    ++allocations;
+    return __libc_calloc(_num, _size);
+}
+
+void *realloc(void *_ptr, size_t _size)
+{
+    ++allocations;
+    return __libc_realloc(_ptr, _size);
+}
+
+void *memalign(size_t _alignment, size_t _size)
+{
+    ++allocations;
+    return __libc_memalign(_alignment, _size);
+}
+
+void *aligned_alloc(size_t _alignment, size_t _size)
+{
+    ++allocations;
+    return __libc_memalign(_alignment, _size);
+}
+
+int posix_memalign(void **_ptr, size_t _alignment, size_t _size)
+{
+    if (_alignment % sizeof(void *) != 0 || (_alignment & (_alignment - 1)) != 0)
+        return EINVAL;
+    ++allocations;
+    void *ptr = __libc_memalign(_alignment, _size);
+    if (ptr == nullptr)
+        return ENOMEM;
+    *_ptr = ptr;
+    return 0;
+}
+
+void free(void *_ptr)
+{
+    __libc_free(_ptr);
+}
+}
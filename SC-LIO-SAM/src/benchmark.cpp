@@ -0,0 +1,314 @@
+#include "imageProjection.h"
+#include "featureExtraction.h"
+#include "imuPreintegration.h"
+#include "mapOptmization.h"
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <ros/callback_queue.h>
+
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sys/resource.h>
+
+// Offline replay: the four nodes in one process, fed from a bag as fast as they process it.
+//
+// Every message is handed to its handlers directly, then the callbacks it triggered (cloud_info to
+// mapping, odometry to the IMU preintegration and back to the projection) are run to completion
+// before the next message, on this thread only; ros::Time follows the bag. No scan is dropped or
+// skipped for being late, so scans/s is the pipeline's throughput. Loop closure runs at
+// loopClosureFrequency in bag time instead of in its own thread. With isamBackEndThread off the
+// trajectory only differs between runs by the rounding of the OpenMP reductions (numberOfCores: 1
+// for bitwise repeatable runs). Needs a roscore for the node handles.
+//
+//   lio_sam_benchmark <bag> [trajectory]   replay, the mapping odometry in TUM format to trajectory
+//   lio_sam_benchmark --micro              Scan Context and LM micro-benchmarks on synthetic data
+
+namespace
+{
+
+void drainCallbacks()
+{
+    ros::CallbackQueue *queue = ros::getGlobalCallbackQueue();
+    while (!queue->empty())
+        queue->callAvailable();
+}
+
+// the in-process subscriptions are connected by the master asynchronously, messages published before are lost
+bool waitForSubscribers(const std::vector<ros::Publisher *> &_publishers, double _timeout)
+{
+    ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(_timeout);
+    for (ros::Publisher *pub : _publishers)
+    {
+        while (pub->getNumSubscribers() == 0)
+        {
+            if (!ros::ok() || ros::WallTime::now() > deadline)
+            {
+                ROS_ERROR("Nothing subscribed to %s", pub->getTopic().c_str());
+                return false;
+            }
+            ros::WallDuration(0.01).sleep();
+        }
+    }
+    return true;
+}
+
+double peakRssMb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kB on Linux
+}
+
+void writeTumPose(std::ofstream &out, double stamp, double x, double y, double z, const tf::Quaternion &q)
+{
+    out << std::fixed << std::setprecision(9) << stamp << std::setprecision(6) << " " << x << " " << y << " " << z << " "
+        << q.x() << " " << q.y() << " " << q.z() << " " << q.w() << "\n";
+}
+
+void printMetrics()
+{
+    printf("%-40s %8s %10s %10s %10s %10s\n", "metric", "count", "mean", "p50", "p99", "max");
+    Metrics::instance().forEach([](const std::string &name, const MetricStat::Summary &summary)
+    {
+        printf("%-40s %8zu %10.3f %10.3f %10.3f %10.3f\n", name.c_str(), summary.count, summary.mean, summary.p50, summary.p99, summary.max);
+    });
+}
+
+// median time per call of _func over _repeats batches of _iterations calls
+template <typename Func>
+void microBenchmark(const char *name, int _iterations, int _repeats, Func _func)
+{
+    std::vector<double> perCallUs;
+    for (int r = 0; r < _repeats; ++r)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < _iterations; ++i)
+            _func();
+        perCallUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / _iterations);
+    }
+    std::sort(perCallUs.begin(), perCallUs.end());
+    printf("%-40s %10.3f us/call (median of %d x %d, min %.3f)\n", name, perCallUs[perCallUs.size() / 2], _repeats, _iterations, perCallUs.front());
+}
+
+// a 64-beam-like scan of a street: ground, two walls and some poles, seeded so every run measures the same input
+pcl::PointCloud<SCPointType> syntheticScan(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> noise(-0.02f, 0.02f);
+    pcl::PointCloud<SCPointType> scan;
+    for (int ring = 0; ring < 64; ++ring)
+    {
+        float elevation = (-24.8f + ring * (26.8f / 63)) * float(M_PI / 180);
+        for (int col = 0; col < 1800; ++col)
+        {
+            float azimuth = col * float(2 * M_PI / 1800);
+            float dx = cos(elevation) * cos(azimuth), dy = cos(elevation) * sin(azimuth), dz = sin(elevation);
+            float range = 80.0f;
+            if (dz < 0)
+                range = std::min(range, -1.8f / dz);            // ground 1.8 m below
+            if (std::fabs(dy) > 1e-3f)
+                range = std::min(range, 8.0f / std::fabs(dy)); // walls 8 m to the sides
+            if (range >= 80.0f)
+                continue;
+            SCPointType pt;
+            pt.x = dx * range + noise(rng);
+            pt.y = dy * range + noise(rng);
+            pt.z = dz * range + noise(rng) + ((col / 60) % 5 == 0 ? 2.0f : 0.0f); // poles
+            pt.intensity = 0;
+            scan.push_back(pt);
+        }
+    }
+    return scan;
+}
+
+void runMicroBenchmarks(mapOptimization &MO)
+{
+    std::mt19937 rng(42);
+
+    SCManager scManager;
+    pcl::PointCloud<SCPointType> scan = syntheticScan(rng);
+    pcl::PointCloud<SCPointType> otherScan = syntheticScan(rng);
+    SCDescriptor desc = scManager.makeScancontext(scan);
+    SCDescriptor otherDesc = scManager.makeScancontext(otherScan);
+    printf("Scan Context on %zu points\n", scan.size());
+    microBenchmark("SCManager::makeScancontext", 100, 11, [&] { desc = scManager.makeScancontext(scan); });
+    volatile double distance = 0;
+    microBenchmark("SCManager::distanceBtnScanContext", 1000, 11, [&] { distance = scManager.distanceBtnScanContext(desc, otherDesc).first; });
+
+    // correspondences as cornerOptimization / surfOptimization produce them: unit residual directions, small residuals
+    const int numResiduals = 4000;
+    std::uniform_real_distribution<float> position(-30.0f, 30.0f), direction(-1.0f, 1.0f), residual(-0.1f, 0.1f);
+    std::vector<PointType> points(numResiduals), coeffs(numResiduals);
+    for (int i = 0; i < numResiduals; ++i)
+    {
+        points[i].x = position(rng);
+        points[i].y = position(rng);
+        points[i].z = position(rng) * 0.1f;
+        Eigen::Vector3f n(direction(rng), direction(rng), direction(rng));
+        n.normalize();
+        coeffs[i].x = n.x();
+        coeffs[i].y = n.y();
+        coeffs[i].z = n.z();
+        coeffs[i].intensity = residual(rng);
+    }
+
+    float transform[6];
+    std::copy(MO.transformTobeMapped, MO.transformTobeMapped + 6, transform);
+    LMNormalEquations equations(transform);
+    printf("LM step on %d residuals\n", numResiduals);
+    microBenchmark("LMNormalEquations::add (all residuals)", 100, 11, [&]
+    {
+        equations = LMNormalEquations(transform);
+        for (int i = 0; i < numResiduals; ++i)
+            equations.add(points[i], coeffs[i]);
+    });
+    microBenchmark("mapOptimization::LMOptimization (first)", 1000, 11, [&]
+    {
+        std::copy(transform, transform + 6, MO.transformTobeMapped);
+        MO.LMOptimization(0, equations);
+    });
+    microBenchmark("mapOptimization::LMOptimization", 1000, 11, [&]
+    {
+        std::copy(transform, transform + 6, MO.transformTobeMapped);
+        MO.LMOptimization(1, equations);
+    });
+    std::copy(transform, transform + 6, MO.transformTobeMapped);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "lio_sam_benchmark");
+
+    bool micro = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--micro")
+            micro = true;
+        else
+            args.push_back(argv[i]);
+    }
+    if (micro == false && args.empty())
+    {
+        printf("usage: lio_sam_benchmark <bag> [trajectory] | --micro\n");
+        return 1;
+    }
+
+    IMUPreintegration ImuP;
+    TransformFusion TF;
+    FeatureExtraction FE(true);
+    ImageProjection IP;
+    IP.setCloudInfoSink([&FE](lio_sam::cloud_info &cloudInfo, const pcl::PointCloud<PointType>::Ptr &extractedCloud) {
+        FE.processCloudInfo(cloudInfo, extractedCloud);
+    });
+    mapOptimization MO;
+
+    if (micro)
+    {
+        runMicroBenchmarks(MO);
+        return 0;
+    }
+
+    if (MO.isamBackEndThread)
+        ROS_WARN("isamBackEndThread is on, the trajectory is not repeatable between runs");
+
+    rosbag::Bag bag;
+    try
+    {
+        bag.open(args[0], rosbag::bagmode::Read);
+    }
+    catch (const rosbag::BagException &e)
+    {
+        ROS_ERROR("Cannot open %s: %s", args[0].c_str(), e.what());
+        return 1;
+    }
+
+    std::ofstream trajectory;
+    if (args.size() > 1)
+        trajectory.open(args[1]);
+    size_t numMapped = 0;
+    ros::NodeHandle nh;
+    ros::Subscriber subOdometry = nh.subscribe<nav_msgs::Odometry>("lio_sam/mapping/odometry", 1, [&](const nav_msgs::Odometry::ConstPtr &odom)
+    {
+        ++numMapped;
+        if (trajectory.is_open())
+        {
+            const auto &p = odom->pose.pose;
+            writeTumPose(trajectory, odom->header.stamp.toSec(), p.position.x, p.position.y, p.position.z,
+                         tf::Quaternion(p.orientation.x, p.orientation.y, p.orientation.z, p.orientation.w));
+        }
+    });
+    if (!waitForSubscribers({&FE.pubLaserCloudInfo, &MO.pubLaserOdometryGlobal, &MO.pubLaserOdometryIncremental, &ImuP.pubImuOdometry}, 5.0))
+        return 1;
+
+    rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{MO.imuTopic, MO.pointCloudTopic, MO.gpsTopic}));
+    if (view.size() == 0)
+    {
+        ROS_ERROR("%s has none of %s, %s, %s", args[0].c_str(), MO.imuTopic.c_str(), MO.pointCloudTopic.c_str(), MO.gpsTopic.c_str());
+        return 1;
+    }
+
+    ROS_INFO("\033[1;32m----> Benchmark: replaying %s (%u messages).\033[0m", args[0].c_str(), view.size());
+
+    size_t numScans = 0;
+    double nextLoopClosure = view.getBeginTime().toSec();
+    ros::WallTime wallBegin = ros::WallTime::now();
+    for (const rosbag::MessageInstance &m : view)
+    {
+        if (!ros::ok())
+            break;
+        ros::Time::setNow(m.getTime());
+
+        if (m.getTopic() == MO.imuTopic)
+        {
+            sensor_msgs::Imu::ConstPtr imu = m.instantiate<sensor_msgs::Imu>();
+            if (imu == nullptr)
+                continue;
+            IP.imuHandler(imu);
+            ImuP.imuHandler(imu);
+        }
+        else if (m.getTopic() == MO.pointCloudTopic)
+        {
+            sensor_msgs::PointCloud2::ConstPtr cloud = m.instantiate<sensor_msgs::PointCloud2>();
+            if (cloud == nullptr)
+                continue;
+            IP.cloudHandler(cloud);
+            ++numScans;
+        }
+        else
+        {
+            nav_msgs::Odometry::ConstPtr gps = m.instantiate<nav_msgs::Odometry>();
+            if (gps != nullptr)
+                MO.gpsHandler(gps);
+        }
+        drainCallbacks();
+
+        if (MO.loopClosureEnableFlag && m.getTime().toSec() >= nextLoopClosure)
+        {
+            nextLoopClosure = m.getTime().toSec() + 1.0 / MO.loopClosureFrequency;
+            MO.performLoopClosure();
+            MO.visualizeLoopClosure();
+            drainCallbacks();
+        }
+    }
+    double wallSeconds = (ros::WallTime::now() - wallBegin).toSec();
+    double bagSeconds = (view.getEndTime() - view.getBeginTime()).toSec();
+
+    // the optimized keyframe poses, i.e., after the loop closures and the last back-end results
+    if (trajectory.is_open())
+    {
+        MO.flushBackEnd();
+        std::ofstream keyframes(args[1] + ".keyframes");
+        for (const PointTypePose &pose : MO.cloudKeyPoses6D->points)
+            writeTumPose(keyframes, pose.time, pose.x, pose.y, pose.z, tf::createQuaternionFromRPY(pose.roll, pose.pitch, pose.yaw));
+    }
+
+    printf("\n%zu scans (%zu mapped) in %.2f s: %.1f scans/s, %.1fx real time; peak RSS %.1f MB\n",
+           numScans, numMapped, wallSeconds, numScans / wallSeconds, bagSeconds / wallSeconds, peakRssMb());
+    printMetrics();
+
+    return 0;
+}
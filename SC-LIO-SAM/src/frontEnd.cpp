@@ -0,0 +1,23 @@
+#include "imageProjection.h"
+#include "featureExtraction.h"
+
+// imageProjection and featureExtraction in one process: a scan is handed over in memory, without
+// lio_sam/deskew/cloud_info being serialized and parsed again. That topic, like the other debug
+// topics, is still published whenever something subscribes to it.
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "lio_sam");
+
+    FeatureExtraction FE(true);
+    ImageProjection IP;
+    IP.setCloudInfoSink([&FE](lio_sam::cloud_info &cloudInfo, const pcl::PointCloud<PointType>::Ptr &extractedCloud) {
+        FE.processCloudInfo(cloudInfo, extractedCloud);
+    });
+
+    ROS_INFO("\033[1;32m----> Front End (Image Projection + Feature Extraction) Started.\033[0m");
+
+    ros::MultiThreadedSpinner spinner(3);
+    spinner.spin();
+
+    return 0;
+}
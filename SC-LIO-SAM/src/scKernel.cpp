@@ -0,0 +1,206 @@
+#include "scKernel.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static inline float hsum( __m128 _v )
+{
+    __m128 shuf = _mm_movehdup_ps(_v);
+    __m128 sums = _mm_add_ps(_v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32( _mm_add_ss(sums, shuf) );
+}
+
+static inline float dot( const float* _a, const float* _b, int _n )
+{
+    __m256 acc8 = _mm256_setzero_ps();
+    int i = 0;
+    for ( ; i + 8 <= _n; i += 8 )
+        acc8 = _mm256_fmadd_ps( _mm256_loadu_ps(_a + i), _mm256_loadu_ps(_b + i), acc8 );
+    __m128 acc4 = _mm_add_ps( _mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1) );
+    for ( ; i + 4 <= _n; i += 4 )
+        acc4 = _mm_fmadd_ps( _mm_loadu_ps(_a + i), _mm_loadu_ps(_b + i), acc4 );
+    float sum = hsum(acc4);
+    const int rem = _n - i; // 0..3; a tail bounded by _n instead lets GCC see iterations past the caller's arrays
+    for ( int k = 0; k < rem; k++ )
+        sum += _a[i + k] * _b[i + k];
+    return sum;
+}
+
+static inline float sqDiff( const float* _a, const float* _b, int _n )
+{
+    __m256 acc8 = _mm256_setzero_ps();
+    int i = 0;
+    for ( ; i + 8 <= _n; i += 8 )
+    {
+        __m256 diff = _mm256_sub_ps( _mm256_loadu_ps(_a + i), _mm256_loadu_ps(_b + i) );
+        acc8 = _mm256_fmadd_ps( diff, diff, acc8 );
+    }
+    __m128 acc4 = _mm_add_ps( _mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1) );
+    for ( ; i + 4 <= _n; i += 4 )
+    {
+        __m128 diff = _mm_sub_ps( _mm_loadu_ps(_a + i), _mm_loadu_ps(_b + i) );
+        acc4 = _mm_fmadd_ps( diff, diff, acc4 );
+    }
+    float sum = hsum(acc4);
+    const int rem = _n - i; // 0..3, see dot
+    for ( int k = 0; k < rem; k++ )
+        sum += (_a[i + k] - _b[i + k]) * (_a[i + k] - _b[i + k]);
+    return sum;
+}
+
+#elif defined(__SSE2__)
+
+static inline float hsum( __m128 _v )
+{
+    __m128 shuf = _mm_shuffle_ps(_v, _v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(_v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32( _mm_add_ss(sums, shuf) );
+}
+
+static inline float dot( const float* _a, const float* _b, int _n )
+{
+    __m128 acc = _mm_setzero_ps();
+    int i = 0;
+    for ( ; i + 4 <= _n; i += 4 )
+        acc = _mm_add_ps( acc, _mm_mul_ps(_mm_loadu_ps(_a + i), _mm_loadu_ps(_b + i)) );
+    float sum = hsum(acc);
+    for ( ; i < _n; i++ )
+        sum += _a[i] * _b[i];
+    return sum;
+}
+
+static inline float sqDiff( const float* _a, const float* _b, int _n )
+{
+    __m128 acc = _mm_setzero_ps();
+    int i = 0;
+    for ( ; i + 4 <= _n; i += 4 )
+    {
+        __m128 diff = _mm_sub_ps( _mm_loadu_ps(_a + i), _mm_loadu_ps(_b + i) );
+        acc = _mm_add_ps( acc, _mm_mul_ps(diff, diff) );
+    }
+    float sum = hsum(acc);
+    for ( ; i < _n; i++ )
+        sum += (_a[i] - _b[i]) * (_a[i] - _b[i]);
+    return sum;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static inline float dot( const float* _a, const float* _b, int _n )
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int i = 0;
+    for ( ; i + 4 <= _n; i += 4 )
+        acc = vfmaq_f32( acc, vld1q_f32(_a + i), vld1q_f32(_b + i) );
+    float sum = vaddvq_f32(acc);
+    for ( ; i < _n; i++ )
+        sum += _a[i] * _b[i];
+    return sum;
+}
+
+static inline float sqDiff( const float* _a, const float* _b, int _n )
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int i = 0;
+    for ( ; i + 4 <= _n; i += 4 )
+    {
+        float32x4_t diff = vsubq_f32( vld1q_f32(_a + i), vld1q_f32(_b + i) );
+        acc = vfmaq_f32( acc, diff, diff );
+    }
+    float sum = vaddvq_f32(acc);
+    for ( ; i < _n; i++ )
+        sum += (_a[i] - _b[i]) * (_a[i] - _b[i]);
+    return sum;
+}
+
+#else
+
+static inline float dot( const float* _a, const float* _b, int _n )
+{
+    float sum = 0;
+    for ( int i = 0; i < _n; i++ )
+        sum += _a[i] * _b[i];
+    return sum;
+}
+
+static inline float sqDiff( const float* _a, const float* _b, int _n )
+{
+    float sum = 0;
+    for ( int i = 0; i < _n; i++ )
+        sum += (_a[i] - _b[i]) * (_a[i] - _b[i]);
+    return sum;
+}
+
+#endif
+
+
+void scColumnNorms( const float* _desc, float* _norms )
+{
+    for ( int col_idx = 0; col_idx < SC_NUM_SECTOR; col_idx++ )
+    {
+        const float* col = _desc + col_idx * SC_NUM_RING;
+        _norms[col_idx] = std::sqrt( dot(col, col, SC_NUM_RING) );
+    }
+} // scColumnNorms
+
+
+double scDistAtShift( const float* _sc1, const float* _norms1, const float* _sc2, const float* _norms2, int _num_shift )
+{
+    int num_eff_cols = 0; // i.e., to exclude all-nonzero sector
+    double sum_sector_similarity = 0;
+    for ( int col_idx = 0; col_idx < SC_NUM_SECTOR; col_idx++ )
+    {
+        // column col_idx of the right-shifted _sc2 is its column (col_idx - _num_shift)
+        int col_idx_sc2 = col_idx - _num_shift;
+        if( col_idx_sc2 < 0 )
+            col_idx_sc2 += SC_NUM_SECTOR;
+
+        const float norm_sc1 = _norms1[col_idx];
+        const float norm_sc2 = _norms2[col_idx_sc2];
+        if( (norm_sc1 == 0) | (norm_sc2 == 0) )
+            continue; // don't count this sector pair.
+
+        const float col_dot = dot( _sc1 + col_idx * SC_NUM_RING, _sc2 + col_idx_sc2 * SC_NUM_RING, SC_NUM_RING );
+        sum_sector_similarity = sum_sector_similarity + col_dot / (norm_sc1 * norm_sc2);
+        num_eff_cols = num_eff_cols + 1;
+    }
+
+    double sc_sim = sum_sector_similarity / num_eff_cols;
+    return 1.0 - sc_sim;
+} // scDistAtShift
+
+
+int scAlignSectorKeys( const float* _vkey1, const float* _vkey2 )
+{
+    // two back-to-back copies of _vkey2, so every right shift of it is one contiguous window
+    float vkey2_twice[2 * SC_NUM_SECTOR];
+    std::memcpy( vkey2_twice, _vkey2, SC_NUM_SECTOR * sizeof(float) );
+    std::memcpy( vkey2_twice + SC_NUM_SECTOR, _vkey2, SC_NUM_SECTOR * sizeof(float) );
+
+    int argmin_vkey_shift = 0;
+    float min_vkey_diff = std::numeric_limits<float>::max();
+    for ( int shift_idx = 0; shift_idx < SC_NUM_SECTOR; shift_idx++ )
+    {
+        float cur_diff = sqDiff( _vkey1, vkey2_twice + SC_NUM_SECTOR - shift_idx, SC_NUM_SECTOR ); // squared norm, same argmin
+        if( cur_diff < min_vkey_diff )
+        {
+            argmin_vkey_shift = shift_idx;
+            min_vkey_diff = cur_diff;
+        }
+    }
+
+    return argmin_vkey_shift;
+} // scAlignSectorKeys